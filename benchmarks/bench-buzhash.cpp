@@ -0,0 +1,91 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <zinc/zinc.h>
+#include "benchmark.h"
+
+using namespace zinc::detail;
+
+/// Rolling update as it was before kernel was moved to the header: an out of line call per byte.
+__attribute__((noinline)) uint32_t buzhash_update_out_of_line(uint32_t sum, uint8_t remove, uint8_t add, uint32_t len)
+{
+    return buzhash_update(sum, remove, add, len);
+}
+
+int main()
+{
+    zinc::Parameters parameters;
+    auto data = benchmark_data(64 * 1024 * 1024 + parameters.window_length);
+    auto count = data.size() - parameters.window_length;
+    auto initial = buzhash(&data[0], parameters.window_length);
+    const auto mask = (1U << parameters.match_bits) - 1U;
+    volatile size_t found = 0;
+
+    benchmark_throughput("out of line buzhash_update()", count, 5, [&]()
+    {
+        auto fingerprint = initial;
+        size_t matches = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if ((fingerprint & mask) == 0)
+                matches++;
+            fingerprint = buzhash_update_out_of_line(fingerprint, data[i], data[i + parameters.window_length],
+                parameters.window_length);
+        }
+        found = matches;
+    });
+
+    benchmark_throughput("GenericRollingHash", count, 5, [&]()
+    {
+        size_t matches = 0;
+        GenericRollingHash kernel(parameters.window_length, parameters.match_bits);
+        buzhash_scan(kernel, &data[0], count, initial, [&](size_t, uint32_t) { matches++; });
+        found = matches;
+    });
+
+    struct
+    {
+        const char* name;
+        ScanKernel kernel;
+    } kernels[] = {
+        {"find_split_points(Serial)", ScanKernel::Serial},
+        {"find_split_points(Lanes)", ScanKernel::Lanes},
+        {"find_split_points(AVX2)", ScanKernel::AVX2},
+        {"find_split_points(AVX512)", ScanKernel::AVX512},
+    };
+    for (const auto& kernel : kernels)
+    {
+        if (!is_scan_kernel_supported(kernel.kernel))
+            continue;
+
+        benchmark_throughput(kernel.name, count, 5, [&]()
+        {
+            zinc::BoundaryList result;
+            find_split_points(&data[0], count, initial, 0, parameters, result, kernel.kernel);
+            found = result.size();
+        });
+    }
+
+    (void)found;
+    return 0;
+}
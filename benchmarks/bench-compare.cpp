@@ -0,0 +1,77 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <string>
+#include <thread>
+#include <zinc/zinc.h>
+#include "benchmark.h"
+
+/// Block list of a file with pseudo-random block hashes.
+zinc::BoundaryList benchmark_blocks(size_t count, uint32_t seed = 1)
+{
+    zinc::BoundaryList result;
+    result.reserve(count);
+    int64_t start = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        seed = seed * 1103515245U + 12345U;
+        auto hash = static_cast<uint64_t>(seed) << 32U | i;
+        auto length = static_cast<int64_t>(512 * 1024 + hash % 1024);
+        result.emplace_back(zinc::Boundary{.start = start, .fingerprint = seed, .hash = hash, .length = length});
+        start += length;
+    }
+    return result;
+}
+
+int main()
+{
+    // Mostly unchanged file, matching dominates comparison. Block lengths are preserved, therefore other blocks stay in
+    // place.
+    auto local = benchmark_blocks(4 * 1024 * 1024);
+    auto remote = local;
+    for (size_t i = 0; i < remote.size(); i += 10007)
+        remote[i].hash++;
+    zinc::CompactBoundaryList compact_local(local), compact_remote(remote);
+
+    volatile size_t found = 0;
+    auto max_threads = std::max(1U, std::thread::hardware_concurrency());
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        auto name = "compare_files(BoundaryList), " + std::to_string(threads) + " threads";
+        benchmark_time(name.c_str(), 3, [&]()
+        {
+            found = zinc::compare_files(local, remote, nullptr, threads).size();
+        });
+    }
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        auto name = "compare_files(CompactBoundaryList), " + std::to_string(threads) + " threads";
+        benchmark_time(name.c_str(), 3, [&]()
+        {
+            found = zinc::compare_files(compact_local, compact_remote, nullptr, threads).size();
+        });
+    }
+
+    (void)found;
+    return 0;
+}
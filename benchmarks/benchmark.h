@@ -0,0 +1,99 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#   include <x86intrin.h>
+#endif
+
+
+/// Returns CPU timestamp counter when available, nanoseconds otherwise.
+inline uint64_t benchmark_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+/// Name of the unit returned by benchmark_ticks().
+inline const char* benchmark_tick_name()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return "cycle";
+#else
+    return "ns";
+#endif
+}
+
+/// Pseudo-random data which is identical on every run.
+inline std::vector<uint8_t> benchmark_data(size_t size, uint32_t seed = 1)
+{
+    std::vector<uint8_t> data(size);
+    for (auto& value : data)
+    {
+        seed = seed * 1103515245U + 12345U;
+        value = static_cast<uint8_t>(seed >> 16U);
+    }
+    return data;
+}
+
+/// Run `functor` `iterations` times and print best throughput in bytes per tick.
+template<typename Functor>
+void benchmark_throughput(const char* name, size_t bytes, unsigned iterations, Functor&& functor)
+{
+    uint64_t best = UINT64_MAX;
+    for (unsigned i = 0; i < iterations; i++)
+    {
+        auto start = benchmark_ticks();
+        functor();
+        auto ticks = benchmark_ticks() - start;
+        if (ticks < best)
+            best = ticks;
+    }
+    printf("%-40s %8.3f bytes/%s\n", name, static_cast<double>(bytes) / best, benchmark_tick_name());
+}
+
+/// Run `functor` `iterations` times and print best wall clock time.
+template<typename Functor>
+void benchmark_time(const char* name, unsigned iterations, Functor&& functor)
+{
+    auto best = std::chrono::steady_clock::duration::max();
+    for (unsigned i = 0; i < iterations; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        functor();
+        auto time = std::chrono::steady_clock::now() - start;
+        if (time < best)
+            best = time;
+    }
+    printf("%-40s %8.3f ms\n", name, std::chrono::duration<double, std::milli>(best).count());
+}
@@ -0,0 +1,102 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "zinc/zinc.h"
+
+
+namespace zinc
+{
+
+/// HTTP/1.1 server of files in a directory, a self-contained server of files and their manifests for zinc clients.
+/// Serves GET and HEAD requests over keep-alive connections. `Range` requests of a single range are answered with a
+/// partial response, requests of multiple ranges with a `multipart/byteranges` response. File data is sent by the
+/// kernel without copying it through user space. All connections are served by a single thread. Available on Linux
+/// only.
+class HttpServer
+{
+public:
+    /// \param root directory of served files.
+    /// \param idle_timeout time after which idle connections are closed.
+    explicit HttpServer(std::string root, std::chrono::milliseconds idle_timeout = std::chrono::seconds(60));
+    ~HttpServer();
+    HttpServer(const HttpServer&) = delete;
+    HttpServer& operator=(const HttpServer&) = delete;
+
+    /// Start listening for connections. Passing port 0 picks a free port, it is returned by port(). Returns false on
+    /// failure.
+    bool listen(const std::string& address = "127.0.0.1", uint16_t port = 0);
+    /// Returns port server listens on.
+    uint16_t port() const;
+    /// Serve clients until stop() is called. Returns false when server is not listening.
+    bool run();
+    /// Make run() return. May be called from any thread.
+    void stop();
+
+protected:
+    struct State;
+    std::unique_ptr<State> state_;
+};
+
+/// Provides remote file data from an http server supporting `Range` requests. Connections are kept alive between
+/// reads. Large reads are split between several connections transferring data in parallel. Batches of ranges are
+/// requested with multiple ranges per request, `multipart/byteranges` responses are parsed as they arrive and data is
+/// received directly into destination buffers, therefore memory use does not depend on size of responses. Only
+/// `http://` urls are supported. Available on Linux and other POSIX systems.
+class HttpSource : public RemoteSource
+{
+public:
+    /// \param url of remote file.
+    /// \param connections maximal number of parallel connections.
+    /// \param timeout of connecting, sending and receiving data.
+    explicit HttpSource(const std::string& url, size_t connections = 4,
+        std::chrono::milliseconds timeout = std::chrono::seconds(30));
+    ~HttpSource() override;
+    HttpSource(const HttpSource&) = delete;
+    HttpSource& operator=(const HttpSource&) = delete;
+
+    /// Returns false when url is not supported.
+    bool valid() const;
+    bool read(int64_t offset, uint8_t* buffer, size_t length) override;
+    bool read_ranges(const std::vector<RemoteRange>& ranges) override;
+    /// Abort reads in progress by closing connections.
+    void cancel() override;
+    /// Download entire file into `data`. Returns false on failure.
+    bool get(std::string& data);
+
+protected:
+    struct State;
+    std::unique_ptr<State> state_;
+};
+
+/// Returns true when `url` is an http url.
+bool is_http_url(const std::string& url);
+
+}
@@ -25,8 +25,16 @@
 
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <functional>
 #include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 
@@ -52,11 +60,306 @@ struct SyncOperation
 {
     /// A remote block information. Destination in new local file.
     const Boundary* remote;
-    /// A local block information. Source in local file when data exists. May be null, in which case block does not exist locally.
+    /// A local block information. Source in local file when data exists. May be null, in which case block does not
+    /// exist locally and is downloaded, or filled with zeros when is_zero_block() is true.
     const Boundary* local;
+    /// When true `local` points to a block of remote file. Block data is copied from location in local file that was
+    /// written by an earlier operation, instead of being downloaded again.
+    bool from_remote;
 };
 using SyncOperationList = std::vector<SyncOperation>;
 
+/// Memory efficient alternative to BoundaryList. Boundaries are stored in separate columns, fingerprints and lengths
+/// are 32bit wide and block start is derived from lengths of preceding blocks, therefore blocks must be contiguous and
+/// first block must start at offset 0. A block takes 16 bytes instead of 32.
+class CompactBoundaryList
+{
+public:
+    /// Iterates boundaries in order, block starts are accumulated on the fly.
+    class const_iterator
+    {
+    public:
+        const_iterator(const CompactBoundaryList* list, size_t index, int64_t start)
+            : list_(list), index_(index), start_(start) { }
+
+        Boundary operator*() const
+        {
+            return Boundary{.start = start_, .fingerprint = list_->fingerprint(index_), .hash = list_->hash(index_),
+                .length = list_->length(index_)};
+        }
+        const_iterator& operator++() { start_ += list_->length(index_++); return *this; }
+        bool operator==(const const_iterator& other) const { return index_ == other.index_; }
+        bool operator!=(const const_iterator& other) const { return index_ != other.index_; }
+        /// Index of current block.
+        size_t index() const { return index_; }
+
+    protected:
+        const CompactBoundaryList* list_;
+        size_t index_;
+        int64_t start_;
+    };
+
+    CompactBoundaryList() = default;
+    /// Convert regular boundary list. List is empty when boundaries are not contiguous.
+    explicit CompactBoundaryList(const BoundaryList& boundaries);
+
+    /// Reserve memory for `size` blocks.
+    void reserve(size_t size);
+    /// Append a block to the end of the list.
+    void push_back(uint32_t fingerprint, uint64_t hash, uint32_t length);
+    /// Append a block to the end of the list.
+    /// \return false and leave the list unchanged when `boundary.start` is not equal to file_size(), or block does not
+    /// fit in the list.
+    bool push_back(const Boundary& boundary);
+    /// Remove all blocks.
+    void clear();
+
+    /// Returns number of blocks.
+    size_t size() const { return hashes_.size(); }
+    /// Returns true when list has no blocks.
+    bool empty() const { return hashes_.empty(); }
+    /// Returns block fingerprint.
+    uint32_t fingerprint(size_t index) const { return fingerprints_[index]; }
+    /// Returns fnv64a hash of the block.
+    uint64_t hash(size_t index) const { return hashes_[index]; }
+    /// Returns block length.
+    int64_t length(size_t index) const { return lengths_[index]; }
+    /// Returns block start. Complexity is linear to `checkpoint_interval`, use iterators for sequential access.
+    int64_t start(size_t index) const;
+    /// Returns a copy of block descriptor.
+    Boundary operator[](size_t index) const;
+    /// Returns index of block containing `offset`, or size() when offset is past the end of file.
+    /// \param block_start optional output parameter returning start of found block.
+    size_t find(int64_t offset, int64_t* block_start = nullptr) const;
+    /// Returns sum of all block lengths.
+    int64_t file_size() const { return file_size_; }
+    /// Returns number of bytes allocated by the list.
+    size_t memory_usage() const;
+    /// Convert to regular boundary list.
+    BoundaryList to_boundary_list() const;
+
+    const_iterator begin() const { return const_iterator(this, 0, 0); }
+    const_iterator end() const { return const_iterator(this, size(), file_size_); }
+
+    /// Block start is saved once per this many blocks. Checkpoints cost an eighth of a byte per block, random access to
+    /// a block start sums at most this many lengths.
+    static const size_t checkpoint_interval = 64;
+
+protected:
+    std::vector<uint32_t> fingerprints_;
+    std::vector<uint64_t> hashes_;
+    std::vector<uint32_t> lengths_;
+    std::vector<int64_t> checkpoints_;
+    int64_t file_size_ = 0;
+};
+
+/// Descriptor of sync operation referring to blocks of CompactBoundaryList by their index.
+struct CompactSyncOperation
+{
+    /// Value of `local` when block does not exist locally.
+    static const uint32_t npos = UINT32_MAX;
+
+    /// Index of remote block. Destination in new local file.
+    uint32_t remote;
+    /// Index of local block. Source in local file when data exists. May be `npos`, in which case block does not exist
+    /// locally.
+    uint32_t local;
+    /// When true `local` is an index of remote block. Block data is copied from location in local file that was written
+    /// by an earlier operation, instead of being downloaded again.
+    bool from_remote;
+};
+using CompactSyncOperationList = std::vector<CompactSyncOperation>;
+
+/// Operation of a patch acting on a contiguous range of bytes. Unlike SyncOperation it does not refer to blocks and a
+/// single operation may span many blocks.
+struct PatchOperation
+{
+    enum Type
+    {
+        /// Move range of local file from `source` to `destination`. Ranges may overlap.
+        Copy,
+        /// Fetch range of remote file starting at `source` and write it to `destination`.
+        Download,
+        /// Fill range at `destination` with zeros, punching a hole in the file when possible. `source` is equal to
+        /// `destination`.
+        Zero,
+    };
+
+    /// Type of operation.
+    Type type;
+    /// Offset in local file for Copy operations, offset in remote file for Download operations.
+    int64_t source;
+    /// Offset in new local file.
+    int64_t destination;
+    /// Number of bytes.
+    int64_t length;
+};
+using PatchOperationList = std::vector<PatchOperation>;
+
+/// Range of remote file and a buffer it is read into.
+struct RemoteRange
+{
+    int64_t offset;
+    uint8_t* buffer;
+    size_t length;
+};
+
+/// Provides data of remote file when applying a patch.
+class RemoteSource
+{
+public:
+    virtual ~RemoteSource() = default;
+    /// Read `length` bytes of remote file starting at `offset` into `buffer`. Returns false on failure. When downloads
+    /// are prefetched it is called from a background thread, calls never overlap.
+    virtual bool read(int64_t offset, uint8_t* buffer, size_t length) = 0;
+    /// Read several ranges of remote file. Sources able to fetch multiple ranges with a single request override it, by
+    /// default ranges are read one by one. Returns false when any of ranges could not be read.
+    virtual bool read_ranges(const std::vector<RemoteRange>& ranges)
+    {
+        for (const auto& range : ranges)
+        {
+            if (!read(range.offset, range.buffer, range.length))
+                return false;
+        }
+        return true;
+    }
+    /// Abort read in progress, called from another thread. Aborted read returns false, later reads are not affected.
+    /// Sources that can not abort a read ignore it.
+    virtual void cancel() { }
+};
+
+/// Provides remote file data from a file accessible locally.
+class FileSource : public RemoteSource
+{
+public:
+    explicit FileSource(FILE* file) : file_(file) { }
+    bool read(int64_t offset, uint8_t* buffer, size_t length) override;
+
+protected:
+    FILE* file_;
+};
+
+/// Provides remote file data, part of which was reconstructed locally by reconstruct_blocks(). Reconstructed data is
+/// stored in a temporary file, other ranges are read from remote source.
+class DeltaSource : public RemoteSource
+{
+public:
+    /// \param remote source of data that was not reconstructed.
+    explicit DeltaSource(RemoteSource* remote);
+    ~DeltaSource() override;
+    DeltaSource(const DeltaSource&) = delete;
+    DeltaSource& operator=(const DeltaSource&) = delete;
+
+    /// Store `length` bytes of remote file at `offset`. Returns false when data could not be stored.
+    bool add(int64_t offset, const uint8_t* data, size_t length);
+    /// Returns number of stored bytes.
+    int64_t reconstructed_bytes() const { return spool_size_; }
+    bool read(int64_t offset, uint8_t* buffer, size_t length) override;
+    bool read_ranges(const std::vector<RemoteRange>& ranges) override;
+
+protected:
+    RemoteSource* remote_;
+    /// Temporary file holding reconstructed data.
+    FILE* spool_ = nullptr;
+    int64_t spool_size_ = 0;
+    /// Offset in remote file -> offset in spool and length.
+    std::map<int64_t, std::pair<int64_t, int64_t>> ranges_;
+};
+
+/// Scheduling parameters of MultiSource.
+struct MultiSourceOptions
+{
+    /// A read is reissued on another source when it takes longer than this percentile of previous reads, relative to
+    /// their expected duration.
+    double hedge_percentile = 0.95;
+    /// Reads are never reissued sooner than this.
+    std::chrono::milliseconds min_hedge_delay{20};
+    /// Reads from sources that were not measured yet are reissued after this long.
+    std::chrono::milliseconds initial_hedge_delay{1000};
+    /// Reads are split between sources in pieces of at least this size.
+    int64_t min_piece_size = 1024 * 1024;
+};
+
+/// Provides remote file data from several sources holding the same file, like mirrors and caches. Throughput and
+/// latency of every source are measured. Large reads are split between sources in proportion to their throughput,
+/// other reads go to the source expected to be fastest. Sources that were not measured yet are tried in order of
+/// priority. A read taking unusually long is reissued on another source, the first one to finish wins and the other
+/// one is cancelled. A failed read is retried on other sources. Every source serves at most one read at a time.
+class MultiSource : public RemoteSource
+{
+public:
+    /// \param sources of remote file, in order of priority. They must stay valid while multi source exists.
+    /// \param options of scheduling.
+    explicit MultiSource(std::vector<RemoteSource*> sources, MultiSourceOptions options = MultiSourceOptions());
+    /// Cancels reads that are still in progress and waits for them.
+    ~MultiSource() override;
+    MultiSource(const MultiSource&) = delete;
+    MultiSource& operator=(const MultiSource&) = delete;
+
+    bool read(int64_t offset, uint8_t* buffer, size_t length) override;
+    /// Returns number of bytes provided by every source.
+    std::vector<int64_t> source_bytes() const;
+    /// Returns number of reads that were reissued on another source because they took too long.
+    int64_t hedged_reads() const;
+
+protected:
+    struct State;
+    std::unique_ptr<State> state_;
+};
+
+/// Sketch of block content. Blocks sharing a super-feature are likely to have most of their content in common.
+struct BlockSketch
+{
+    /// Number of super-features.
+    static const size_t size = 4;
+    /// Super-features, all of them are 0 when block is too short to have any.
+    uint64_t features[size];
+};
+
+/// Finds blocks with similar content by their sketches.
+class SimilarityIndex
+{
+public:
+    /// Value returned when no similar block exists.
+    static const size_t npos = SIZE_MAX;
+
+    /// \param sketches of indexed blocks.
+    explicit SimilarityIndex(const std::vector<BlockSketch>& sketches);
+    /// Returns index of block sharing most super-features with `sketch`, or `npos` when no block shares any.
+    size_t find(const BlockSketch& sketch) const;
+
+protected:
+    /// Super-feature -> indices of blocks having it.
+    std::unordered_map<uint64_t, std::vector<size_t>> blocks_;
+};
+
+/// Delta of remote block against a similar reference block, stored in a delta pack. Delta packs are produced for files
+/// served along with their older versions, references are blocks of older versions.
+struct BlockDelta
+{
+    /// Index of remote block.
+    size_t block;
+    /// Hash of reference block.
+    uint64_t reference_hash;
+    /// Length of reference block.
+    int64_t reference_length;
+    /// Offset of delta in delta pack.
+    int64_t offset;
+    /// Length of delta.
+    int64_t length;
+};
+
+/// Journal recording a patch and progress of applying it. When applying a patch is interrupted, next apply_patch()
+/// call with the same journal resumes from the point where previous call stopped.
+struct PatchJournal
+{
+    /// Journal file opened for reading and writing. May be empty.
+    FILE* file = nullptr;
+    /// Identifies remote file patch was built for, for example a hash of its manifest. Journal is discarded when it
+    /// was recorded with a different identity.
+    uint64_t identity = 0;
+};
+
 /// Parameters for chunking algorithm and progress reporting.
 struct Parameters
 {
@@ -70,33 +373,580 @@ struct Parameters
     unsigned match_bits = 21;
     /// Buffer size used when reading file from disk.
     size_t read_buffer_size = 10 * 1024 * 1024;
+    /// Number of bytes of downloaded data fetched ahead on a background thread while preceding operations of a patch
+    /// are applied. When 0 data is fetched right before it is written.
+    size_t download_prefetch_size = 32 * 1024 * 1024;
+    /// When not 0, blocks are hashed in tree mode: leaves of this size are hashed in parallel and their hashes are
+    /// combined into block hash. Spreads hashing evenly across threads no matter how large blocks are. Both compared
+    /// files must be partitioned with same value.
+    size_t hash_leaf_size = 0;
+    /// When true, tar and zip archives are split at starts of their members, content defined boundaries are used inside
+    /// members. Adding or removing a member then does not change blocks of neighbouring members. Members shorter than
+    /// `min_block_size` share blocks with preceding members, unless they are last. Both compared files must be
+    /// partitioned with same value.
+    bool archive_boundaries = false;
+    /// Number of threads reading input sequentially and handing it over to hashing threads. When 0, hashing threads
+    /// read data themselves. Negative value uses a single reader thread for files on rotational disks and 0 otherwise.
+    int reader_threads = -1;
+    /// Optional callback invoked from worker threads as operation progresses. Arguments are number of processed bytes
+    /// and total number of bytes to process. Calls never overlap. Last call reports all bytes as processed, unless
+    /// operation was cancelled.
+    std::function<void(int64_t bytes_done, int64_t bytes_total)> on_progress;
+    /// Minimal time between two `on_progress` calls.
+    std::chrono::milliseconds progress_interval{100};
+    /// Optional callback invoked from worker thread once operation ends, successfully or not, right before result
+    /// becomes available in returned future.
+    std::function<void()> on_complete;
 };
 
-/// Partition file into blocks.
+/// Content addressed store of blocks kept between synchronizations of any files. Every block is stored in a file of
+/// it's own, named by hash and length of the block, and is memory-mapped when read. When total size of stored blocks
+/// exceeds size limit, least recently used blocks are evicted. Order of use is saved in an index file when store is
+/// flushed or destroyed. Methods may be called from multiple threads.
+class BlockStore
+{
+public:
+    /// \param directory of store, it is created when it does not exist.
+    /// \param max_size maximum total size of stored blocks in bytes.
+    BlockStore(std::string directory, int64_t max_size);
+    ~BlockStore();
+    BlockStore(const BlockStore&) = delete;
+    BlockStore& operator=(const BlockStore&) = delete;
+
+    /// Returns true when block with `hash` and `length` is stored.
+    bool contains(uint64_t hash, int64_t length) const;
+    /// Read block with `hash` and `length` into `buffer` and mark it as recently used. Returns false when block is not
+    /// stored or could not be read.
+    bool read(uint64_t hash, int64_t length, uint8_t* buffer)
+    {
+        return read(hash, length, 0, buffer, static_cast<size_t>(length));
+    }
+    /// Read `count` bytes at `offset` of block with `hash` and `length` into `buffer`.
+    bool read(uint64_t hash, int64_t length, int64_t offset, uint8_t* buffer, size_t count);
+    /// Store block with `hash`. Returns false when block could not be written.
+    bool add(uint64_t hash, const uint8_t* data, int64_t length);
+    /// Write index of stored blocks. Returns false on failure.
+    bool flush();
+    /// Returns total size of stored blocks.
+    int64_t size() const;
+
+protected:
+    struct Key
+    {
+        uint64_t hash;
+        int64_t length;
+        bool operator==(const Key& other) const { return hash == other.hash && length == other.length; }
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const
+        {
+            return static_cast<size_t>(key.hash ^ static_cast<uint64_t>(key.length));
+        }
+    };
+
+    /// Returns path of a file storing block.
+    std::string block_path(const Key& key) const;
+    /// Evict least recently used blocks until store fits size limit.
+    void evict();
+
+    std::string directory_;
+    int64_t max_size_;
+    int64_t size_ = 0;
+    mutable std::mutex mutex_;
+    /// Stored blocks, most recently used first.
+    std::list<Key> order_;
+    std::unordered_map<Key, std::list<Key>::iterator, KeyHash> blocks_;
+};
+
+/// Provides remote file data, blocks found in a BlockStore are read from the store instead. Blocks downloaded from
+/// remote source are verified against their hashes and added to the store.
+class StoreSource : public RemoteSource
+{
+public:
+    /// \param remote source of blocks that are not stored.
+    /// \param store of blocks.
+    /// \param blocks of remote file.
+    /// \param parameters that were used to partition remote file.
+    StoreSource(RemoteSource* remote, BlockStore& store, const CompactBoundaryList& blocks,
+        const Parameters* parameters = nullptr);
+    /// Returns number of bytes that were read from store.
+    int64_t stored_bytes() const { return stored_bytes_; }
+    bool read(int64_t offset, uint8_t* buffer, size_t length) override;
+    bool read_ranges(const std::vector<RemoteRange>& ranges) override;
+
+protected:
+    /// Consume `length` downloaded bytes at `offset` of block `index`. Block is stored once all of it is downloaded.
+    void collect(size_t index, int64_t offset, const uint8_t* data, int64_t length);
+
+    RemoteSource* remote_;
+    BlockStore& store_;
+    const CompactBoundaryList& blocks_;
+    size_t leaf_size_;
+    int64_t stored_bytes_ = 0;
+    /// Blocks downloaded in pieces: index -> data and number of downloaded bytes.
+    std::unordered_map<size_t, std::pair<std::vector<uint8_t>, int64_t>> partial_;
+};
+
+/// Verifies data written by apply_patch() against hashes of remote file blocks. Blocks are hashed as they are written,
+/// therefore verification does not read the file again. Blocks not written by the patch are not verified, they were
+/// found identical when files were compared.
+class PatchVerifier
+{
+public:
+    /// \param blocks of remote file. Must stay valid while verifier is used.
+    /// \param parameters that were used to partition remote file.
+    explicit PatchVerifier(const CompactBoundaryList& blocks, const Parameters* parameters = nullptr);
+
+    /// Consume `length` bytes written at `offset` of the file.
+    void write(int64_t offset, const uint8_t* data, size_t length);
+    /// Consume `length` zero bytes written at `offset` of the file.
+    void zero(int64_t offset, int64_t length);
+    /// Hash blocks that were not written from `file`, which must be patched and truncated to size of remote file.
+    /// Blocks that were written only partially do not match.
+    /// \return true when every block of file matches.
+    bool finish(FILE* file);
+    /// Returns indices of blocks whose content does not match. Blocks that were not written are included only after
+    /// finish().
+    const std::vector<size_t>& mismatched() const { return mismatched_; }
+    /// Returns number of bytes in blocks that were hashed and match.
+    int64_t verified_bytes() const { return verified_bytes_; }
+    /// Returns digest of file computed from hashes of it's contents. It is complete only after finish().
+    uint64_t digest() const;
+
+protected:
+    /// Block written in pieces.
+    struct PartialBlock
+    {
+        std::vector<uint8_t> data;
+        int64_t written = 0;
+    };
+
+    /// Consume a piece of block at `index`. Data may be null for a piece of zeros.
+    void consume(size_t index, int64_t block_start, int64_t offset, const uint8_t* data, int64_t length);
+    /// Record hash of completely written block.
+    void complete(size_t index, uint64_t hash);
+
+    const CompactBoundaryList& blocks_;
+    size_t leaf_size_ = 0;
+    /// Hashes of file contents.
+    std::vector<uint64_t> hashes_;
+    /// Blocks that were hashed.
+    std::vector<bool> hashed_;
+    /// Blocks that are partially written at the moment.
+    std::unordered_map<size_t, PartialBlock> partial_;
+    std::vector<size_t> mismatched_;
+    int64_t verified_bytes_ = 0;
+};
+
+/// Returns true when block consists of zero bytes only, which is determined from it's hash. Such blocks are never
+/// downloaded, they are zero-filled in place.
+/// \param parameters that were used to partition file.
+bool is_zero_block(const Boundary& block, const Parameters* parameters = nullptr);
+
+/// Partition file into blocks. Holes of sparse files are skipped instead of being read.
 /// \param file input.
-/// \param max_threads number of threads to use. Passing 0 will use as many threads as there are CPU cores.
+/// \param max_threads number of threads to use. Passing 0 will use as many threads as there are CPU cores. Result does
+/// not depend on number of threads.
 /// \param bytes_done optional output parameter for monitoring operation progress.
 /// \param bytes_to_process optional output parameter returning number of bytes that will be processed. Operation is finished when bytes_done == bytes_to_process.
 /// \param cancel set to true when async operation should be terminated prematurely.
 /// \param parameters for chunking algorithm. Do not use unless you know what you are doing.
-/// \return a list of boundaries.
+/// \return a list of boundaries, empty when file could not be read. Empty file has a single empty block.
 std::future<BoundaryList> partition_file(FILE* file, size_t max_threads = 0, std::atomic<int64_t>* bytes_done = nullptr,
     int64_t* bytes_to_process = nullptr, std::atomic<bool>* cancel = nullptr, const Parameters* parameters = nullptr);
 
-/// Compare file blocks and produce delta operations list.
+/// Partition memory buffer into blocks. Data is hashed in place by all threads, without copying it.
+/// \param data input. Must stay valid until operation completes.
+/// \param size of input in bytes.
+/// \param max_threads number of threads to use. Passing 0 will use as many threads as there are CPU cores. Result does
+/// not depend on number of threads.
+/// \param bytes_done optional output parameter for monitoring operation progress.
+/// \param bytes_to_process optional output parameter returning number of bytes that will be processed. Operation is finished when bytes_done == bytes_to_process.
+/// \param cancel set to true when async operation should be terminated prematurely.
+/// \param parameters for chunking algorithm. Do not use unless you know what you are doing.
+/// \return a list of boundaries.
+std::future<BoundaryList> partition_buffer(const uint8_t* data, size_t size, size_t max_threads = 0,
+    std::atomic<int64_t>* bytes_done = nullptr, int64_t* bytes_to_process = nullptr,
+    std::atomic<bool>* cancel = nullptr, const Parameters* parameters = nullptr);
+
+/// Verify file content against blocks of remote file. Blocks are hashed in parallel, like partition_file() does.
+/// \param file to verify.
+/// \param blocks of remote file. Must stay valid until operation completes.
+/// \param max_threads number of threads to use. Passing 0 will use as many threads as there are CPU cores.
+/// \param bytes_done optional output parameter for monitoring operation progress.
+/// \param bytes_to_process optional output parameter returning number of bytes that will be processed.
+/// \param cancel set to true when async operation should be terminated prematurely.
+/// \param parameters that were used to partition remote file.
+/// \return indices of blocks whose content does not match, including blocks past the end of file. Size of file is not
+/// checked otherwise.
+std::future<std::vector<size_t>> verify_file(FILE* file, const CompactBoundaryList& blocks, size_t max_threads = 0,
+    std::atomic<int64_t>* bytes_done = nullptr, int64_t* bytes_to_process = nullptr,
+    std::atomic<bool>* cancel = nullptr, const Parameters* parameters = nullptr);
+
+/// Returns digest of entire file, a hash of block hashes and lengths. It is computed from a list of blocks, without
+/// reading the file.
+uint64_t file_digest(const CompactBoundaryList& blocks);
+/// Returns digest of entire file, a hash of block hashes and lengths.
+uint64_t file_digest(const BoundaryList& blocks);
+
+/// Compute sketches of file blocks. Blocks are read in parallel, like partition_file() does.
+/// \param file to read.
+/// \param blocks of file. Must stay valid until operation completes.
+/// \param max_threads number of threads to use. Passing 0 will use as many threads as there are CPU cores.
+/// \param bytes_done optional output parameter for monitoring operation progress.
+/// \param bytes_to_process optional output parameter returning number of bytes that will be processed.
+/// \param cancel set to true when async operation should be terminated prematurely.
+/// \param parameters specifying buffer size and progress callbacks.
+/// \return a sketch of every block. Blocks that could not be read have empty sketches.
+std::future<std::vector<BlockSketch>> sketch_file(FILE* file, const CompactBoundaryList& blocks, size_t max_threads = 0,
+    std::atomic<int64_t>* bytes_done = nullptr, int64_t* bytes_to_process = nullptr,
+    std::atomic<bool>* cancel = nullptr, const Parameters* parameters = nullptr);
+
+/// Encode `target` as a delta against `reference`. Delta is a sequence of instructions copying ranges of reference and
+/// adding literal data.
+std::vector<uint8_t> encode_delta(const uint8_t* reference, size_t reference_length, const uint8_t* target,
+    size_t target_length);
+
+/// Decode delta produced by encode_delta().
+/// \return false when delta is malformed.
+bool decode_delta(const uint8_t* reference, size_t reference_length, const uint8_t* delta, size_t delta_length,
+    std::vector<uint8_t>& target);
+
+/// Reconstruct blocks downloaded by a patch from deltas against local blocks, before patch is applied. Reconstructed
+/// blocks are verified against their hashes and stored in `output`, which then serves them instead of downloading.
+/// Blocks whose reference does not exist locally are downloaded as usual.
+/// \param local_file local file, it must not be modified yet.
+/// \param local_blocks blocks of local file.
+/// \param remote_blocks blocks of remote file.
+/// \param patch that will be applied.
+/// \param deltas of remote blocks.
+/// \param delta_pack source of delta pack data.
+/// \param output storing reconstructed blocks.
+/// \param delta_bytes optional output parameter returning number of bytes of deltas that were fetched.
+/// \param parameters that were used to partition remote file.
+/// \return false when reconstructed data could not be stored.
+bool reconstruct_blocks(FILE* local_file, const CompactBoundaryList& local_blocks,
+    const CompactBoundaryList& remote_blocks, const PatchOperationList& patch, const std::vector<BlockDelta>& deltas,
+    RemoteSource* delta_pack, DeltaSource& output, int64_t* delta_bytes = nullptr,
+    const Parameters* parameters = nullptr);
+
+/// Add blocks of local file that remote file does not contain to a store, before patch overwrites them. They are
+/// reused when local file is synchronized back to it's older version, or when other files contain them. Blocks of
+/// zeros are not stored.
+/// \param store of blocks.
+/// \param local_file local file, it must not be modified yet.
+/// \param local_blocks blocks of local file.
+/// \param remote_blocks blocks of remote file.
+/// \param parameters that were used to partition both files.
+/// \return number of bytes that were added to the store.
+int64_t retain_blocks(BlockStore& store, FILE* local_file, const CompactBoundaryList& local_blocks,
+    const CompactBoundaryList& remote_blocks, const Parameters* parameters = nullptr);
+
+/// Options of estimate_reuse().
+struct ReuseEstimateOptions
+{
+    /// Number of sampled regions of local file. File is split into this many equal parts and a region is sampled at
+    /// a random offset of every part.
+    size_t samples = 32;
+    /// Size of a sampled region in bytes. Region should span several blocks. When 0, eight times the expected block
+    /// size is used.
+    size_t sample_size = 0;
+    /// No estimate is made when sampled regions would cover more than this fraction of local file. Small files are
+    /// cheaper to partition fully.
+    double max_sampled_fraction = 0.25;
+    /// Half-width of confidence interval in standard errors.
+    double confidence = 1.96;
+};
+
+/// Estimated share of remote file that does not need to be downloaded.
+struct ReuseEstimate
+{
+    /// False when file was too small to sample or could not be read.
+    bool valid = false;
+    /// Estimated fraction of remote file bytes that can be copied from local file or filled with zeros.
+    double reuse = 0;
+    /// Lower bound of confidence interval.
+    double low = 0;
+    /// Upper bound of confidence interval.
+    double high = 0;
+    /// Number of bytes of local file that were read.
+    int64_t sampled_bytes = 0;
+};
+
+/// Estimate how much of remote file can be reused from local file without partitioning all of it. Sampled regions of
+/// local file are partitioned and their blocks are looked up in remote file. Blocks cut by region edges are not
+/// counted, therefore estimate leans towards lower values. When upper bound of estimate is low, downloading the whole
+/// file is cheaper than synchronizing it.
+/// \param local_file local file.
+/// \param remote_blocks blocks of remote file.
+/// \param options of sampling.
+/// \param parameters that were used to partition remote file.
+ReuseEstimate estimate_reuse(FILE* local_file, const CompactBoundaryList& remote_blocks,
+    const ReuseEstimateOptions& options = ReuseEstimateOptions(), const Parameters* parameters = nullptr);
+
+/// Compare file blocks and produce delta operations list. A block that is missing locally and appears multiple times in
+/// remote file is downloaded once, other instances are copied from it by operations at the end of the list.
 /// \param local_file a BoundaryList produced from local (old) file.
 /// \param remote_file a BoundaryList produced from remote (new) file.
+/// \param parameters that were used to partition both files.
+/// \param max_threads number of threads looking up blocks. Passing 0 will use as many threads as there are CPU cores.
+/// Result does not depend on number of threads.
 /// \return a list of delta sync operations.
-SyncOperationList compare_files(const BoundaryList& local_file, const BoundaryList& remote_file);
+SyncOperationList compare_files(const BoundaryList& local_file, const BoundaryList& remote_file,
+    const Parameters* parameters = nullptr, size_t max_threads = 0);
+
+/// Compare file blocks and produce delta operations list. Produces same operations as compare_files() for BoundaryList.
+/// \param local_file a CompactBoundaryList produced from local (old) file.
+/// \param remote_file a CompactBoundaryList produced from remote (new) file.
+/// \param parameters that were used to partition both files.
+/// \param max_threads number of threads looking up blocks. Passing 0 will use as many threads as there are CPU cores.
+/// Result does not depend on number of threads.
+/// \return a list of delta sync operations.
+CompactSyncOperationList compare_files(const CompactBoundaryList& local_file, const CompactBoundaryList& remote_file,
+    const Parameters* parameters = nullptr, size_t max_threads = 0);
+
+/// Convert delta operations to a patch. Consecutive operations with contiguous source and destination ranges are merged
+/// into a single operation, therefore a block that moved together with its neighbours is copied in one go.
+/// \param operations a list produced by compare_files().
+/// \param parameters that were passed to compare_files().
+/// \return a list of patch operations in the order they must be applied.
+PatchOperationList build_patch(const SyncOperationList& operations, const Parameters* parameters = nullptr);
+
+/// Convert delta operations to a patch. Consecutive operations with contiguous source and destination ranges are merged
+/// into a single operation.
+/// \param operations a list produced by compare_files().
+/// \param local_file a CompactBoundaryList that was passed to compare_files().
+/// \param remote_file a CompactBoundaryList that was passed to compare_files().
+/// \param parameters that were passed to compare_files().
+/// \return a list of patch operations in the order they must be applied.
+PatchOperationList build_patch(const CompactSyncOperationList& operations, const CompactBoundaryList& local_file,
+    const CompactBoundaryList& remote_file, const Parameters* parameters = nullptr);
+
+/// Produces blocks of a file one at a time, in any order. Returns false when there are no more blocks.
+using BoundaryReader = std::function<bool(Boundary& boundary)>;
+
+/// Compare files whose block lists do not fit in memory and produce a patch. Blocks of both files are sorted by content
+/// in temporary files and merge joined. Unlike compare_files() block lists are never held in memory as a whole, memory
+/// used for buffers stays within `memory_limit` no matter how large files are, returned patch excluded. Blocks that
+/// moved towards end of file and whose source is overwritten by a block moving towards start of file are downloaded,
+/// therefore patch may download more than the one produced by compare_files().
+/// \param local_file reader of blocks produced from local (old) file.
+/// \param remote_file reader of blocks produced from remote (new) file.
+/// \param patch output, a list of patch operations in the order they must be applied.
+/// \param memory_limit number of bytes used for buffers, at most.
+/// \param parameters that were used to partition both files.
+/// \return false when temporary files could not be written or read.
+bool compare_files_external(const BoundaryReader& local_file, const BoundaryReader& remote_file,
+    PatchOperationList& patch, size_t memory_limit, const Parameters* parameters = nullptr);
+
+/// Apply patch to local file. Copies are streamed in chunks of `Parameters::read_buffer_size`, or done by the kernel
+/// when possible. File is not truncated, caller should truncate it to the size of remote file. Zero ranges past the end
+/// of file may be left unwritten, truncation fills them.
+/// \param file local file opened for reading and writing.
+/// \param patch a list produced by build_patch().
+/// \param remote source of downloaded data. May be null if patch has no Download operations.
+/// \param parameters specifying buffer size.
+/// \param journal to record progress in. When journal contains progress of applying same patch, already applied
+/// operations are skipped. Data of copies overlapping their own source is recorded before it is written, so it can be
+/// restored. Journal does not grow beyond two buffers of `Parameters::read_buffer_size`. It is not synced to disk, it
+/// protects from interruption of the process, not from a power loss.
+/// \param verifier hashing written data. Kernel copies are not used when verifying, data passes through the buffer.
+/// \return true on success.
+bool apply_patch(FILE* file, const PatchOperationList& patch, RemoteSource* remote,
+    const Parameters* parameters = nullptr, const PatchJournal* journal = nullptr, PatchVerifier* verifier = nullptr);
+
+/// Read patch recorded in the journal.
+/// \param journal to read.
+/// \param patch recorded in the journal.
+/// \return true when journal contains a patch recorded with the same identity.
+bool read_journal(const PatchJournal& journal, PatchOperationList& patch);
+
+/// Write a patch pack, a patch precomputed for a known version of local file followed by remote data the patch
+/// downloads. Data is stored in the order it is downloaded and Download operations of stored patch refer to offsets in
+/// the pack, therefore pack is the remote source of it's own patch and it is read sequentially from start to end.
+/// \param pack output file.
+/// \param patch produced by build_patch() for known version of local file.
+/// \param remote source of remote file data.
+/// \param source identity of file version patch applies to.
+/// \param target identity of file version patch produces.
+/// \return false when remote data could not be read or pack could not be written.
+bool write_patch_pack(FILE* pack, const PatchOperationList& patch, RemoteSource* remote, uint64_t source,
+    uint64_t target);
+
+/// Read patch stored in a patch pack.
+/// \param pack source of patch pack data.
+/// \param source identity of file version patch must apply to.
+/// \param target identity of file version patch must produce.
+/// \param patch output.
+/// \return false when pack is damaged or it was built for other versions.
+bool read_patch_pack(RemoteSource* pack, uint64_t source, uint64_t target, PatchOperationList& patch);
+
+/// Write a patch pack uploading local file to a passive store, which holds an older version of it. Pack holds only
+/// blocks stored file does not have and patch rebuilding local file from stored file with range copies. Stored file is
+/// described by it's blocks, it is not read.
+/// \param pack output file.
+/// \param local_file local file.
+/// \param local_blocks blocks of local file.
+/// \param stored_blocks blocks of stored file, empty when nothing was stored yet.
+/// \param source identity of stored file version.
+/// \param target identity of local file version.
+/// \param parameters that were used to partition both files.
+/// \return false when local file could not be read or pack could not be written.
+bool write_push_pack(FILE* pack, FILE* local_file, const CompactBoundaryList& local_blocks,
+    const CompactBoundaryList& stored_blocks, uint64_t source, uint64_t target, const Parameters* parameters = nullptr);
+
+/// Apply patch pack written by write_push_pack() to stored file and truncate it to size of local file. Interrupted
+/// patching is resumed from the journal, entire file is verified then, otherwise written blocks are verified as they
+/// are written.
+/// \param stored_file stored file opened for reading and writing.
+/// \param pack source of patch pack data.
+/// \param blocks of local file pack was written for.
+/// \param source identity of stored file version.
+/// \param target identity of local file version.
+/// \param journal_file file recording progress, opened for reading and writing. May be null.
+/// \param parameters that were used to partition files.
+/// \return false when pack does not apply to stored file, could not be applied or result does not match `blocks`.
+bool apply_push_pack(FILE* stored_file, RemoteSource* pack, const CompactBoundaryList& blocks, uint64_t source,
+    uint64_t target, FILE* journal_file = nullptr, const Parameters* parameters = nullptr);
 
 namespace detail
 {
+/// Substitution table of buzhash algorithm.
+extern const uint32_t buzhash_table[256];
+
+/// Rotate 32bit value left.
+inline uint32_t barrel_shift(uint32_t value, uint32_t shift)
+{
+    return (value << shift) | (value >> ((32U - shift) & 0x1fU));
+}
+
 /// Compute a rolling hash on a block of memory.
 uint32_t buzhash(const uint8_t* data, uint32_t len);
 /// Roll one byte out and one byte in.
-uint32_t buzhash_update(uint32_t sum, uint8_t remove, uint8_t add, uint32_t len);
+inline uint32_t buzhash_update(uint32_t sum, uint8_t remove, uint8_t add, uint32_t len)
+{
+    return barrel_shift(sum, 1U) ^ barrel_shift(buzhash_table[remove], len & 0x1fU) ^ buzhash_table[add];
+}
 /// Compute strong hash.
 uint64_t fnv64a(const uint8_t* data, size_t length, uint64_t hash = 14695981039346656037UL);
+/// Compute strong hash of `length` zero bytes in logarithmic time. Equal to fnv64a() of a zero-filled buffer.
+uint64_t fnv64a_zeros(uint64_t length, uint64_t hash = 14695981039346656037UL);
+/// Continue strong hash with bytes of `count` hashes in little endian order.
+uint64_t fnv64a_combine(const uint64_t* hashes, size_t count, uint64_t hash = 14695981039346656037UL);
+/// Compute block hash. When `leaf_size` is not 0 block is hashed in tree mode: every `leaf_size` bytes are hashed
+/// separately and leaf hashes are combined with fnv64a_combine(). Otherwise it is fnv64a() of entire block.
+uint64_t block_hash(const uint8_t* data, size_t length, size_t leaf_size = 0);
+/// Compute block hash of `length` zero bytes.
+uint64_t block_hash_zeros(uint64_t length, size_t leaf_size = 0);
+/// Compute sketch of block content, see BlockSketch.
+BlockSketch block_sketch(const uint8_t* data, size_t length);
+/// Returns sorted offsets at which members of a tar or zip archive start, or nothing when file is not an archive.
+/// Offset of zip central directory is included.
+/// \param read returns pointer to `length` bytes at `offset` of file, or null when they can not be read. Data must stay
+/// valid until next call.
+/// \param file_size size of file.
+std::vector<int64_t> find_archive_members(const std::function<const uint8_t*(int64_t offset, size_t length)>& read,
+    int64_t file_size);
+
+/// Rolling hash kernel with window length and match bits known only at runtime. Kernels with them known at compile
+/// time were not measurably faster.
+struct GenericRollingHash
+{
+    GenericRollingHash(uint32_t window_length, uint32_t match_bits)
+        : window_length_(window_length)
+        , lenmod_(window_length & 0x1fU)
+        , mask_((1U << match_bits) - 1U)
+    {
+    }
+
+    inline uint32_t window_length() const { return window_length_; }
+    inline uint32_t mask() const { return mask_; }
+    inline uint32_t update(uint32_t sum, uint8_t remove, uint8_t add) const
+    {
+        return barrel_shift(sum, 1U) ^ barrel_shift(buzhash_table[remove], lenmod_) ^ buzhash_table[add];
+    }
+
+    uint32_t window_length_;
+    uint32_t lenmod_;
+    uint32_t mask_;
+};
+
+/// Roll `kernel` over `count` window positions starting at `data` and call `on_match(offset, fingerprint)` for every
+/// position whose fingerprint has all masked bits clear.
+/// \param fingerprint buzhash of the window starting at `data`.
+/// \param data must contain `count + kernel.window_length()` readable bytes.
+/// \return fingerprint of the window starting at `data + count`.
+template<typename Kernel, typename Callback>
+inline uint32_t buzhash_scan(const Kernel& kernel, const uint8_t* data, size_t count, uint32_t fingerprint,
+    Callback&& on_match)
+{
+    const auto mask = kernel.mask();
+    const auto* add = data + kernel.window_length();
+    size_t i = 0;
+
+    // Dependency chain of rolling hash can not be broken, but testing positions in batches keeps branches off the
+    // critical path.
+    for (; i + 4 <= count; i += 4)
+    {
+        auto f0 = fingerprint;
+        auto f1 = kernel.update(f0, data[i + 0], add[i + 0]);
+        auto f2 = kernel.update(f1, data[i + 1], add[i + 1]);
+        auto f3 = kernel.update(f2, data[i + 2], add[i + 2]);
+        fingerprint = kernel.update(f3, data[i + 3], add[i + 3]);
+
+        if (!((f0 & mask) && (f1 & mask) && (f2 & mask) && (f3 & mask)))
+        {
+            if ((f0 & mask) == 0)
+                on_match(i + 0, f0);
+            if ((f1 & mask) == 0)
+                on_match(i + 1, f1);
+            if ((f2 & mask) == 0)
+                on_match(i + 2, f2);
+            if ((f3 & mask) == 0)
+                on_match(i + 3, f3);
+        }
+    }
+
+    for (; i < count; i++)
+    {
+        if ((fingerprint & mask) == 0)
+            on_match(i, fingerprint);
+        fingerprint = kernel.update(fingerprint, data[i], add[i]);
+    }
+
+    return fingerprint;
+}
+
+/// Implementations of split point search.
+enum class ScanKernel
+{
+    /// Single rolling hash chain.
+    Serial,
+    /// Several independent chains interleaved in scalar code. Portable, but slower than Serial, Auto never selects it.
+    Lanes,
+    /// 8 chains in AVX2 lanes.
+    AVX2,
+    /// 16 chains in AVX-512 lanes.
+    AVX512,
+    /// Fastest kernel supported by running CPU.
+    Auto,
+};
+
+/// Returns true when `kernel` can be used on running CPU.
+bool is_scan_kernel_supported(ScanKernel kernel);
+
+/// Find split point candidates among `count` window positions starting at `data`. Large inputs are split into
+/// independent sub-ranges rolled in parallel lanes, small inputs use a serial kernel. Results are identical for every
+/// kernel.
+/// \param data must contain `count + parameters.window_length` readable bytes.
+/// \param fingerprint buzhash of the window starting at `data`.
+/// \param offset file offset of `data`, added to start of every found boundary.
+/// \param result found boundaries are appended to this list.
+/// \return fingerprint of the window starting at `data + count`.
+/// \param kernel implementation to use, must be supported by running CPU.
+uint32_t find_split_points(const uint8_t* data, size_t count, uint32_t fingerprint, int64_t offset,
+    const Parameters& parameters, BoundaryList& result, ScanKernel kernel = ScanKernel::Auto);
 }
 
 }
@@ -0,0 +1,225 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <algorithm>
+#include <cstring>
+#include "zinc/zinc.h"
+
+namespace zinc
+{
+
+namespace detail
+{
+
+using ArchiveReader = std::function<const uint8_t*(int64_t offset, size_t length)>;
+
+/// Size of tar header and unit of member data.
+const int64_t tar_block_size = 512;
+/// Zip central directories larger than this are not parsed.
+const int64_t max_central_directory_size = 256 * 1024 * 1024;
+
+uint16_t read_u16(const uint8_t* data) { return static_cast<uint16_t>(data[0] | data[1] << 8U); }
+uint32_t read_u32(const uint8_t* data) { return read_u16(data) | static_cast<uint32_t>(read_u16(data + 2)) << 16U; }
+uint64_t read_u64(const uint8_t* data) { return read_u32(data) | static_cast<uint64_t>(read_u32(data + 4)) << 32U; }
+
+/// Parse octal number of tar header field. Large sizes are stored in base-256 with highest bit of first byte set.
+/// Returns -1 when field is malformed.
+int64_t parse_tar_number(const uint8_t* field, size_t length)
+{
+    int64_t result = 0;
+    if (field[0] & 0x80U)
+    {
+        for (size_t i = 1; i < length; i++)
+        {
+            if (result > (INT64_MAX >> 8))
+                return -1;
+            result = result << 8 | field[i];
+        }
+        return result;
+    }
+
+    size_t i = 0;
+    while (i < length && field[i] == ' ')
+        i++;
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; i++)
+    {
+        if (result > (INT64_MAX >> 3))
+            return -1;
+        result = result << 3 | (field[i] - '0');
+    }
+    return i == length || field[i] == ' ' || field[i] == 0 ? result : -1;
+}
+
+/// Returns true when `header` is a tar header with valid checksum.
+bool is_tar_header(const uint8_t* header)
+{
+    // Checksum is a sum of header bytes, with checksum field itself counted as spaces.
+    int64_t sum = 8 * ' ';
+    for (int64_t i = 0; i < tar_block_size; i++)
+    {
+        if (i < 148 || i >= 156)
+            sum += header[i];
+    }
+    return sum != 8 * ' ' && parse_tar_number(header + 148, 8) == sum;
+}
+
+std::vector<int64_t> find_tar_members(const ArchiveReader& read, int64_t file_size)
+{
+    std::vector<int64_t> members;
+    int64_t member_start = -1;
+    for (int64_t offset = 0; offset + tar_block_size <= file_size;)
+    {
+        const auto* header = read(offset, static_cast<size_t>(tar_block_size));
+        if (header == nullptr || !is_tar_header(header))
+            break;
+        auto size = parse_tar_number(header + 124, 12);
+        if (size < 0 || size > file_size)
+            break;
+
+        // Long names and extended attributes are stored in headers of their own preceding the member.
+        if (member_start < 0)
+            member_start = offset;
+        auto type = header[156];
+        if (type != 'L' && type != 'K' && type != 'x' && type != 'g')
+        {
+            members.push_back(member_start);
+            member_start = -1;
+        }
+        offset += tar_block_size + (size + tar_block_size - 1) / tar_block_size * tar_block_size;
+    }
+    return members;
+}
+
+std::vector<int64_t> find_zip_members(const ArchiveReader& read, int64_t file_size)
+{
+    // End of central directory record is at the end of file, followed by a comment of at most 64KB.
+    const size_t eocd_size = 22;
+    auto tail_size = static_cast<size_t>(std::min<int64_t>(file_size, eocd_size + 0xFFFF));
+    const auto* data = read(file_size - static_cast<int64_t>(tail_size), tail_size);
+    if (data == nullptr || tail_size < eocd_size)
+        return {};
+    std::vector<uint8_t> tail(data, data + tail_size);
+    auto position = tail_size - eocd_size;
+    while (read_u32(&tail[position]) != 0x06054b50)
+    {
+        if (position == 0)
+            return {};
+        position--;
+    }
+
+    const auto* eocd = &tail[position];
+    uint64_t entries = read_u16(eocd + 10);
+    uint64_t directory_size = read_u32(eocd + 12);
+    uint64_t directory_offset = read_u32(eocd + 16);
+    if (entries == 0xFFFF || directory_size == 0xFFFFFFFF || directory_offset == 0xFFFFFFFF)
+    {
+        // Zip64 end of central directory record is found through a locator preceding end of central directory.
+        auto eocd_offset = file_size - static_cast<int64_t>(tail_size - position);
+        const auto* locator = eocd_offset >= 20 ? read(eocd_offset - 20, 20) : nullptr;
+        if (locator == nullptr || read_u32(locator) != 0x07064b50)
+            return {};
+        auto record_offset = read_u64(locator + 8);
+        const auto* record = file_size >= 56 && record_offset <= static_cast<uint64_t>(file_size - 56) ?
+            read(static_cast<int64_t>(record_offset), 56) : nullptr;
+        if (record == nullptr || read_u32(record) != 0x06064b50)
+            return {};
+        entries = read_u64(record + 32);
+        directory_size = read_u64(record + 40);
+        directory_offset = read_u64(record + 48);
+    }
+    // Offsets come from the file, compare without adding them so that bogus values can not wrap around.
+    if (directory_size > static_cast<uint64_t>(max_central_directory_size) ||
+        directory_size > static_cast<uint64_t>(file_size) ||
+        directory_offset > static_cast<uint64_t>(file_size) - directory_size)
+        return {};
+
+    const auto* directory_data = read(static_cast<int64_t>(directory_offset), static_cast<size_t>(directory_size));
+    if (directory_data == nullptr)
+        return {};
+    std::vector<uint8_t> directory(directory_data, directory_data + directory_size);
+
+    std::vector<int64_t> members;
+    size_t entry = 0;
+    for (uint64_t i = 0; i < entries && entry + 46 <= directory.size(); i++)
+    {
+        const auto* header = &directory[entry];
+        if (read_u32(header) != 0x02014b50)
+            break;
+        size_t name_length = read_u16(header + 28);
+        size_t extra_length = read_u16(header + 30);
+        size_t comment_length = read_u16(header + 32);
+        if (entry + 46 + name_length + extra_length > directory.size())
+            break;
+
+        // Offsets that do not fit in 32 bits are stored in zip64 extra field, after sizes that do not fit either.
+        uint64_t offset = read_u32(header + 42);
+        if (offset == 0xFFFFFFFF)
+        {
+            const auto* extra = header + 46 + name_length;
+            for (size_t field = 0; field + 4 <= extra_length;)
+            {
+                auto id = read_u16(extra + field);
+                size_t field_length = read_u16(extra + field + 2);
+                if (id == 0x0001)
+                {
+                    size_t skip = (read_u32(header + 24) == 0xFFFFFFFF ? 8 : 0) +
+                        (read_u32(header + 20) == 0xFFFFFFFF ? 8 : 0);
+
+                    if (skip + 8 <= field_length && field + 4 + field_length <= extra_length)
+                        offset = read_u64(extra + field + 4 + skip);
+                    break;
+                }
+                field += 4 + field_length;
+            }
+        }
+        if (offset < static_cast<uint64_t>(file_size))
+            members.push_back(static_cast<int64_t>(offset));
+        entry += 46 + name_length + extra_length + comment_length;
+    }
+    members.push_back(static_cast<int64_t>(directory_offset));
+    return members;
+}
+
+std::vector<int64_t> find_archive_members(const ArchiveReader& read, int64_t file_size)
+{
+    std::vector<int64_t> members;
+    if (file_size >= tar_block_size)
+    {
+        const auto* header = read(0, static_cast<size_t>(tar_block_size));
+        if (header != nullptr && is_tar_header(header))
+            members = find_tar_members(read, file_size);
+    }
+    if (members.empty() && file_size >= 4)
+    {
+        const auto* signature = read(0, 4);
+        if (signature != nullptr && read_u32(signature) == 0x04034b50)
+            members = find_zip_members(read, file_size);
+    }
+    std::sort(members.begin(), members.end());
+    members.erase(std::unique(members.begin(), members.end()), members.end());
+    return members;
+}
+
+}
+
+}
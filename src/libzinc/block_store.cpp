@@ -0,0 +1,368 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#if _WIN32
+#   include <windows.h>
+#   include <direct.h>
+#else
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include "zinc/zinc.h"
+#include "file.h"
+
+namespace zinc
+{
+
+/// Name of a file listing stored blocks from least to most recently used.
+const char* store_index_name = "index";
+
+/// Copy `count` bytes at `offset` of file at `path` to `buffer`. File is mapped into memory and must be exactly
+/// `length` bytes long.
+bool read_mapped(const std::string& path, int64_t length, int64_t offset, uint8_t* buffer, size_t count)
+{
+    bool result = false;
+#if _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size{};
+    if (GetFileSizeEx(file, &size) && size.QuadPart == length)
+    {
+        if (HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr))
+        {
+            if (const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, static_cast<SIZE_T>(length)))
+            {
+                memcpy(buffer, static_cast<const uint8_t*>(view) + offset, count);
+                UnmapViewOfFile(view);
+                result = true;
+            }
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info{};
+    if (fstat(fd, &info) == 0 && info.st_size == length)
+    {
+        auto* view = mmap(nullptr, static_cast<size_t>(length), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view != MAP_FAILED)
+        {
+            memcpy(buffer, static_cast<const uint8_t*>(view) + offset, count);
+            munmap(view, static_cast<size_t>(length));
+            result = true;
+        }
+    }
+    close(fd);
+#endif
+    return result;
+}
+
+BlockStore::BlockStore(std::string directory, int64_t max_size)
+    : directory_(std::move(directory))
+    , max_size_(max_size)
+{
+#if _WIN32
+    _mkdir(directory_.c_str());
+#else
+    mkdir(directory_.c_str(), 0755);
+#endif
+
+    // Blocks are listed from least to most recently used.
+    if (FILE* index = fopen((directory_ + "/" + store_index_name).c_str(), "r"))
+    {
+        Key key{};
+        while (fscanf(index, "%" SCNx64 " %" SCNd64, &key.hash, &key.length) == 2)
+        {
+            if (key.length <= 0 || blocks_.find(key) != blocks_.end())
+                continue;
+            order_.push_front(key);
+            blocks_[key] = order_.begin();
+            size_ += key.length;
+        }
+        fclose(index);
+    }
+    evict();
+}
+
+BlockStore::~BlockStore()
+{
+    flush();
+}
+
+bool BlockStore::contains(uint64_t hash, int64_t length) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return blocks_.find(Key{hash, length}) != blocks_.end();
+}
+
+bool BlockStore::read(uint64_t hash, int64_t length, int64_t offset, uint8_t* buffer, size_t count)
+{
+    if (offset < 0 || offset + static_cast<int64_t>(count) > length)
+        return false;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    Key key{hash, length};
+    auto it = blocks_.find(key);
+    if (it == blocks_.end())
+        return false;
+    order_.splice(order_.begin(), order_, it->second);
+    lock.unlock();
+
+    if (read_mapped(block_path(key), length, offset, buffer, count))
+        return true;
+
+    // Block file was removed or damaged.
+    lock.lock();
+    it = blocks_.find(key);
+    if (it != blocks_.end())
+    {
+        order_.erase(it->second);
+        blocks_.erase(it);
+        size_ -= length;
+    }
+    return false;
+}
+
+bool BlockStore::add(uint64_t hash, const uint8_t* data, int64_t length)
+{
+    if (length <= 0 || length > max_size_)
+        return false;
+
+    Key key{hash, length};
+    if (contains(hash, length))
+        return true;
+
+    // Block is written under a temporary name, a damaged block is never visible under it's final name.
+    auto path = block_path(key);
+    auto temporary_path = path + ".tmp";
+    FILE* file = fopen(temporary_path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+    bool written = fwrite(data, 1, static_cast<size_t>(length), file) == static_cast<size_t>(length);
+    written = fclose(file) == 0 && written;
+#if _WIN32
+    remove(path.c_str());
+#endif
+    if (!written || rename(temporary_path.c_str(), path.c_str()) != 0)
+    {
+        remove(temporary_path.c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (blocks_.find(key) == blocks_.end())
+    {
+        order_.push_front(key);
+        blocks_[key] = order_.begin();
+        size_ += length;
+        evict();
+    }
+    return true;
+}
+
+bool BlockStore::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto path = directory_ + "/" + store_index_name;
+    FILE* index = fopen((path + ".tmp").c_str(), "w");
+    if (index == nullptr)
+        return false;
+
+    bool written = true;
+    for (auto it = order_.rbegin(); it != order_.rend() && written; ++it)
+        written = fprintf(index, "%016" PRIx64 " %" PRId64 "\n", it->hash, it->length) > 0;
+    written = fclose(index) == 0 && written;
+#if _WIN32
+    remove(path.c_str());
+#endif
+    return written && rename((path + ".tmp").c_str(), path.c_str()) == 0;
+}
+
+int64_t BlockStore::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return size_;
+}
+
+std::string BlockStore::block_path(const Key& key) const
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/%016" PRIx64 "-%" PRIx64, key.hash, static_cast<uint64_t>(key.length));
+    return directory_ + name;
+}
+
+void BlockStore::evict()
+{
+    while (size_ > max_size_ && !order_.empty())
+    {
+        const auto& key = order_.back();
+        remove(block_path(key).c_str());
+        size_ -= key.length;
+        blocks_.erase(key);
+        order_.pop_back();
+    }
+}
+
+StoreSource::StoreSource(RemoteSource* remote, BlockStore& store, const CompactBoundaryList& blocks,
+    const Parameters* parameters)
+    : remote_(remote)
+    , store_(store)
+    , blocks_(blocks)
+    , leaf_size_(parameters ? parameters->hash_leaf_size : 0)
+{
+}
+
+bool StoreSource::read(int64_t offset, uint8_t* buffer, size_t length)
+{
+    return read_ranges({RemoteRange{offset, buffer, length}});
+}
+
+bool StoreSource::read_ranges(const std::vector<RemoteRange>& ranges)
+{
+    // Runs of blocks that are not stored are downloaded at once, first and last index of blocks in every run are kept.
+    std::vector<RemoteRange> missing;
+    std::vector<std::pair<size_t, size_t>> missing_blocks;
+    for (const auto& range : ranges)
+    {
+        auto* buffer = range.buffer;
+        for (auto offset = range.offset, end = range.offset + static_cast<int64_t>(range.length); offset < end;)
+        {
+            int64_t block_start = 0;
+            auto index = blocks_.find(offset, &block_start);
+            if (index >= blocks_.size())
+            {
+                missing.push_back(RemoteRange{offset, buffer, static_cast<size_t>(end - offset)});
+                missing_blocks.emplace_back(index, index);
+                break;
+            }
+
+            auto piece = std::min(end, block_start + blocks_.length(index)) - offset;
+            if (store_.read(blocks_.hash(index), blocks_.length(index), offset - block_start, buffer,
+                static_cast<size_t>(piece)))
+            {
+                stored_bytes_ += piece;
+                offset += piece;
+                buffer += piece;
+                continue;
+            }
+
+            auto last = index;
+            auto last_end = block_start + blocks_.length(index);
+            auto run_end = offset + piece;
+            while (run_end < end && last + 1 < blocks_.size() &&
+                !store_.contains(blocks_.hash(last + 1), blocks_.length(last + 1)))
+            {
+                last_end += blocks_.length(++last);
+                run_end = std::min(end, last_end);
+            }
+            missing.push_back(RemoteRange{offset, buffer, static_cast<size_t>(run_end - offset)});
+            missing_blocks.emplace_back(index, last);
+            buffer += run_end - offset;
+            offset = run_end;
+        }
+    }
+    if (missing.empty())
+        return true;
+    if (remote_ == nullptr || !remote_->read_ranges(missing))
+        return false;
+
+    for (size_t run = 0; run < missing.size(); run++)
+    {
+        const auto& range = missing[run];
+        auto run_end = range.offset + static_cast<int64_t>(range.length);
+        auto first = missing_blocks[run].first;
+        auto block_start = first < blocks_.size() ? blocks_.start(first) : 0;
+        for (auto i = first; i <= missing_blocks[run].second && i < blocks_.size(); block_start += blocks_.length(i++))
+        {
+            auto from = std::max(range.offset, block_start);
+            auto to = std::min(run_end, block_start + blocks_.length(i));
+            collect(i, from - block_start, range.buffer + (from - range.offset), to - from);
+        }
+    }
+    return true;
+}
+
+void StoreSource::collect(size_t index, int64_t offset, const uint8_t* data, int64_t length)
+{
+    auto block_length = blocks_.length(index);
+    if (length < block_length)
+    {
+        // Pieces of block are collected until all of it is downloaded.
+        auto& partial = partial_[index];
+        if (partial.first.empty())
+            partial.first.resize(static_cast<size_t>(block_length));
+        memcpy(&partial.first[static_cast<size_t>(offset)], data, static_cast<size_t>(length));
+        partial.second += length;
+        if (partial.second < block_length)
+            return;
+        data = partial.first.data();
+    }
+
+    // Only blocks whose data matches their hash are stored.
+    if (detail::block_hash(data, static_cast<size_t>(block_length), leaf_size_) == blocks_.hash(index))
+        store_.add(blocks_.hash(index), data, block_length);
+    partial_.erase(index);
+}
+
+int64_t retain_blocks(BlockStore& store, FILE* local_file, const CompactBoundaryList& local_blocks,
+    const CompactBoundaryList& remote_blocks, const Parameters* parameters)
+{
+    if (local_file == nullptr)
+        return 0;
+
+    std::unordered_map<uint64_t, std::vector<int64_t>> remote_table;
+    for (size_t i = 0; i < remote_blocks.size(); i++)
+        remote_table[remote_blocks.hash(i)].push_back(remote_blocks.length(i));
+
+    int64_t result = 0;
+    std::vector<uint8_t> data;
+    for (size_t i = 0; i < local_blocks.size(); i++)
+    {
+        auto block = local_blocks[i];
+        auto it = remote_table.find(block.hash);
+        if (is_zero_block(block, parameters) || store.contains(block.hash, block.length) ||
+            (it != remote_table.end() &&
+                std::find(it->second.begin(), it->second.end(), block.length) != it->second.end()))
+            continue;
+
+        data.resize(static_cast<size_t>(block.length));
+        if (read_at(local_file, block.start, data.data(), data.size()) &&
+            store.add(block.hash, data.data(), block.length))
+            result += block.length;
+    }
+    return result;
+}
+
+}
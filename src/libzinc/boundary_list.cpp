@@ -0,0 +1,128 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <algorithm>
+#include "zinc/zinc.h"
+
+namespace zinc
+{
+
+const size_t CompactBoundaryList::checkpoint_interval;
+const uint32_t CompactSyncOperation::npos;
+
+CompactBoundaryList::CompactBoundaryList(const BoundaryList& boundaries)
+{
+    reserve(boundaries.size());
+    for (const auto& boundary : boundaries)
+    {
+        if (!push_back(boundary))
+        {
+            clear();
+            return;
+        }
+    }
+}
+
+void CompactBoundaryList::reserve(size_t size)
+{
+    fingerprints_.reserve(size);
+    hashes_.reserve(size);
+    lengths_.reserve(size);
+    checkpoints_.reserve(size / checkpoint_interval + 1);
+}
+
+void CompactBoundaryList::push_back(uint32_t fingerprint, uint64_t hash, uint32_t length)
+{
+    if (size() % checkpoint_interval == 0)
+        checkpoints_.push_back(file_size_);
+
+    fingerprints_.push_back(fingerprint);
+    hashes_.push_back(hash);
+    lengths_.push_back(length);
+    file_size_ += length;
+}
+
+bool CompactBoundaryList::push_back(const Boundary& boundary)
+{
+    if (boundary.start != file_size_ || boundary.length < 0 || boundary.length > UINT32_MAX ||
+        boundary.fingerprint > UINT32_MAX)
+        return false;
+    push_back(static_cast<uint32_t>(boundary.fingerprint), boundary.hash, static_cast<uint32_t>(boundary.length));
+    return true;
+}
+
+void CompactBoundaryList::clear()
+{
+    fingerprints_.clear();
+    hashes_.clear();
+    lengths_.clear();
+    checkpoints_.clear();
+    file_size_ = 0;
+}
+
+int64_t CompactBoundaryList::start(size_t index) const
+{
+    auto checkpoint = index / checkpoint_interval;
+    int64_t result = checkpoints_[checkpoint];
+    for (auto i = checkpoint * checkpoint_interval; i < index; i++)
+        result += lengths_[i];
+    return result;
+}
+
+size_t CompactBoundaryList::find(int64_t offset, int64_t* block_start) const
+{
+    if (offset < 0 || offset >= file_size_)
+        return size();
+
+    auto checkpoint = std::upper_bound(checkpoints_.begin(), checkpoints_.end(), offset) - checkpoints_.begin() - 1;
+    auto index = static_cast<size_t>(checkpoint) * checkpoint_interval;
+    auto start = checkpoints_[checkpoint];
+    for (; start + lengths_[index] <= offset; index++)
+        start += lengths_[index];
+    if (block_start != nullptr)
+        *block_start = start;
+    return index;
+}
+
+Boundary CompactBoundaryList::operator[](size_t index) const
+{
+    return Boundary{.start = start(index), .fingerprint = fingerprint(index), .hash = hash(index),
+        .length = length(index)};
+}
+
+size_t CompactBoundaryList::memory_usage() const
+{
+    return fingerprints_.capacity() * sizeof(fingerprints_[0]) + hashes_.capacity() * sizeof(hashes_[0]) +
+        lengths_.capacity() * sizeof(lengths_[0]) + checkpoints_.capacity() * sizeof(checkpoints_[0]);
+}
+
+BoundaryList CompactBoundaryList::to_boundary_list() const
+{
+    BoundaryList result;
+    result.reserve(size());
+    for (auto boundary : *this)
+        result.emplace_back(boundary);
+    return result;
+}
+
+}
@@ -0,0 +1,355 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <algorithm>
+#include <cassert>
+#include "zinc/zinc.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#   define ZINC_X86_KERNELS 1
+#   include <immintrin.h>
+#endif
+
+namespace zinc
+{
+
+namespace detail
+{
+
+template<typename Kernel>
+uint32_t find_split_points(const Kernel& kernel, const uint8_t* data, size_t count, uint32_t fingerprint,
+    int64_t offset, BoundaryList& result)
+{
+    return buzhash_scan(kernel, data, count, fingerprint, [&](size_t position, uint32_t match)
+    {
+        auto start = offset + static_cast<int64_t>(position);
+        result.emplace_back(Boundary{.start = start, .fingerprint = match, .hash = 0, .length = 0});
+    });
+}
+
+uint32_t find_split_points_serial(const uint8_t* data, size_t count, uint32_t fingerprint, int64_t offset,
+    const Parameters& parameters, BoundaryList& result)
+{
+    GenericRollingHash kernel(parameters.window_length, parameters.match_bits);
+    return find_split_points(kernel, data, count, fingerprint, offset, result);
+}
+
+/////////////////////////////////////////////// multi-lane kernels /////////////////////////////////////////////////////
+
+/// State of independent rolling hash chains. Chain `k` scans `segment` positions starting at `data + k * segment`.
+struct LaneState
+{
+    const uint8_t* data;
+    size_t segment;
+    uint32_t window_length;
+    uint32_t lenmod;
+    uint32_t mask;
+    int64_t offset;
+    uint32_t* fingerprints;
+    BoundaryList* results;
+};
+
+/// Rolls all chains forward by at most `steps` positions and returns number of positions actually rolled.
+using LaneKernel = size_t(*)(const LaneState& state, size_t steps);
+
+template<unsigned Lanes>
+size_t roll_lanes_portable(const LaneState& state, size_t steps)
+{
+    uint32_t fingerprints[Lanes];
+    const uint8_t* remove[Lanes];
+    for (unsigned k = 0; k < Lanes; k++)
+    {
+        fingerprints[k] = state.fingerprints[k];
+        remove[k] = state.data + k * state.segment;
+    }
+
+    for (size_t i = 0; i < steps; i++)
+    {
+        for (unsigned k = 0; k < Lanes; k++)
+        {
+            if ((fingerprints[k] & state.mask) == 0)
+            {
+                auto start = state.offset + static_cast<int64_t>(k * state.segment + i);
+                state.results[k].emplace_back(Boundary{.start = start, .fingerprint = fingerprints[k], .hash = 0,
+                    .length = 0});
+            }
+        }
+        for (unsigned k = 0; k < Lanes; k++)
+        {
+            fingerprints[k] = barrel_shift(fingerprints[k], 1U) ^
+                barrel_shift(buzhash_table[remove[k][i]], state.lenmod) ^
+                buzhash_table[remove[k][i + state.window_length]];
+        }
+    }
+
+    for (unsigned k = 0; k < Lanes; k++)
+        state.fingerprints[k] = fingerprints[k];
+    return steps;
+}
+
+#if ZINC_X86_KERNELS
+// AVX-512 intrinsics of GCC initialize results with _mm512_undefined_epi32(), which trips this warning in optimized
+// builds.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx2")))
+size_t roll_lanes_avx2(const LaneState& state, size_t steps)
+{
+    // Gathers load 4 bytes, last lane must not read past the end of the buffer.
+    if (state.segment < 4)
+        return 0;
+    steps = std::min(steps, state.segment - 3);
+
+    const auto segment = static_cast<int>(state.segment);
+    const auto* table = reinterpret_cast<const int*>(buzhash_table);
+    const auto* remove = reinterpret_cast<const int*>(state.data);
+    const auto* add = reinterpret_cast<const int*>(state.data + state.window_length);
+    const auto byte_mask = _mm256_set1_epi32(0xff);
+    const auto match_mask = _mm256_set1_epi32(static_cast<int>(state.mask));
+    const auto zero = _mm256_setzero_si256();
+    const auto lenmod = _mm_cvtsi32_si128(static_cast<int>(state.lenmod));
+    const auto lenmod_inverse = _mm_cvtsi32_si128(static_cast<int>((32U - state.lenmod) & 0x1fU));
+    auto index = _mm256_setr_epi32(0, segment, 2 * segment, 3 * segment, 4 * segment, 5 * segment, 6 * segment,
+        7 * segment);
+    auto fingerprints = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state.fingerprints));
+
+    __m256i removed_bytes = zero, added_bytes = zero;
+    for (size_t i = 0; i < steps; i++)
+    {
+        // Every gather fetches bytes for four consecutive steps.
+        if ((i & 3U) == 0)
+        {
+            removed_bytes = _mm256_i32gather_epi32(remove, index, 1);
+            added_bytes = _mm256_i32gather_epi32(add, index, 1);
+            index = _mm256_add_epi32(index, _mm256_set1_epi32(4));
+        }
+
+        auto matched = _mm256_cmpeq_epi32(_mm256_and_si256(fingerprints, match_mask), zero);
+        auto matches = _mm256_movemask_ps(_mm256_castsi256_ps(matched));
+        if (matches != 0)
+        {
+            alignas(32) uint32_t values[8];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(values), fingerprints);
+            for (unsigned k = 0; k < 8; k++)
+            {
+                if (matches & (1 << k))
+                {
+                    auto start = state.offset + static_cast<int64_t>(k * state.segment + i);
+                    state.results[k].emplace_back(Boundary{.start = start, .fingerprint = values[k], .hash = 0,
+                        .length = 0});
+                }
+            }
+        }
+
+        auto removed = _mm256_and_si256(removed_bytes, byte_mask);
+        auto added = _mm256_and_si256(added_bytes, byte_mask);
+        removed_bytes = _mm256_srli_epi32(removed_bytes, 8);
+        added_bytes = _mm256_srli_epi32(added_bytes, 8);
+        removed = _mm256_i32gather_epi32(table, removed, 4);
+        added = _mm256_i32gather_epi32(table, added, 4);
+
+        auto rolled = _mm256_or_si256(_mm256_slli_epi32(fingerprints, 1), _mm256_srli_epi32(fingerprints, 31));
+        removed = _mm256_or_si256(_mm256_sll_epi32(removed, lenmod), _mm256_srl_epi32(removed, lenmod_inverse));
+        fingerprints = _mm256_xor_si256(_mm256_xor_si256(rolled, removed), added);
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(state.fingerprints), fingerprints);
+    return steps;
+}
+
+__attribute__((target("avx512f")))
+size_t roll_lanes_avx512(const LaneState& state, size_t steps)
+{
+    // Gathers load 4 bytes, last lane must not read past the end of the buffer.
+    if (state.segment < 4)
+        return 0;
+    steps = std::min(steps, state.segment - 3);
+
+    const auto segment = static_cast<int>(state.segment);
+    const auto* remove = state.data;
+    const auto* add = state.data + state.window_length;
+    const auto byte_mask = _mm512_set1_epi32(0xff);
+    const auto match_mask = _mm512_set1_epi32(static_cast<int>(state.mask));
+    const auto lenmod = _mm512_set1_epi32(static_cast<int>(state.lenmod));
+    auto index = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+        _mm512_set1_epi32(segment));
+    auto fingerprints = _mm512_loadu_si512(state.fingerprints);
+
+    auto removed_bytes = _mm512_setzero_si512(), added_bytes = _mm512_setzero_si512();
+    for (size_t i = 0; i < steps; i++)
+    {
+        // Every gather fetches bytes for four consecutive steps.
+        if ((i & 3U) == 0)
+        {
+            removed_bytes = _mm512_i32gather_epi32(index, remove, 1);
+            added_bytes = _mm512_i32gather_epi32(index, add, 1);
+            index = _mm512_add_epi32(index, _mm512_set1_epi32(4));
+        }
+
+        auto matches = static_cast<unsigned>(_mm512_test_epi32_mask(fingerprints, match_mask)) ^ 0xffffU;
+        if (matches != 0)
+        {
+            alignas(64) uint32_t values[16];
+            _mm512_store_si512(values, fingerprints);
+            for (unsigned k = 0; k < 16; k++)
+            {
+                if (matches & (1U << k))
+                {
+                    auto start = state.offset + static_cast<int64_t>(k * state.segment + i);
+                    state.results[k].emplace_back(Boundary{.start = start, .fingerprint = values[k], .hash = 0,
+                        .length = 0});
+                }
+            }
+        }
+
+        auto removed = _mm512_and_si512(removed_bytes, byte_mask);
+        auto added = _mm512_and_si512(added_bytes, byte_mask);
+        removed_bytes = _mm512_srli_epi32(removed_bytes, 8);
+        added_bytes = _mm512_srli_epi32(added_bytes, 8);
+        removed = _mm512_i32gather_epi32(removed, buzhash_table, 4);
+        added = _mm512_i32gather_epi32(added, buzhash_table, 4);
+
+        auto shifted = _mm512_xor_si512(_mm512_rol_epi32(fingerprints, 1), _mm512_rolv_epi32(removed, lenmod));
+        fingerprints = _mm512_xor_si512(shifted, added);
+    }
+
+    _mm512_storeu_si512(state.fingerprints, fingerprints);
+    return steps;
+}
+
+#pragma GCC diagnostic pop
+#endif
+
+/// Splits input into `lanes` sub-ranges and rolls them with `roll`. Every sub-range starts with a freshly computed
+/// fingerprint, which is equal to what a serial scan would have at that position, therefore results are identical.
+uint32_t find_split_points_lanes(LaneKernel roll, unsigned lanes, const uint8_t* data, size_t count,
+    uint32_t fingerprint, int64_t offset, const Parameters& parameters, BoundaryList& result)
+{
+    GenericRollingHash serial(parameters.window_length, parameters.match_bits);
+
+    // Lane indices are 32bit in vector kernels.
+    const size_t max_piece = 256 * 1024 * 1024;
+    // Each lane recomputes fingerprint of entire window at its start, it must be negligible compared to lane length.
+    const size_t min_segment = 16 * (parameters.window_length + 64);
+
+    while (count > 0)
+    {
+        auto piece = std::min(count, max_piece);
+        auto segment = piece / lanes;
+        if (segment < min_segment)
+            return find_split_points(serial, data, count, fingerprint, offset, result);
+
+        uint32_t fingerprints[16];
+        fingerprints[0] = fingerprint;
+        for (unsigned k = 1; k < lanes; k++)
+            fingerprints[k] = buzhash(data + k * segment, parameters.window_length);
+
+        std::vector<BoundaryList> lane_results(lanes);
+        LaneState state{data, segment, parameters.window_length, parameters.window_length & 0x1fU, serial.mask(),
+            offset, fingerprints, &lane_results[0]};
+        auto steps = roll(state, segment);
+
+        for (unsigned k = 0; k < lanes; k++)
+        {
+            auto lane_offset = k * segment + steps;
+            fingerprints[k] = find_split_points(serial, data + lane_offset, segment - steps, fingerprints[k],
+                offset + static_cast<int64_t>(lane_offset), lane_results[k]);
+            result.insert(result.end(), lane_results[k].begin(), lane_results[k].end());
+        }
+
+        // Remainder which did not divide evenly between lanes
+        auto tail = lanes * segment;
+        fingerprint = find_split_points(serial, data + tail, piece - tail, fingerprints[lanes - 1],
+            offset + static_cast<int64_t>(tail), result);
+
+        data += piece;
+        offset += piece;
+        count -= piece;
+    }
+
+    return fingerprint;
+}
+
+bool is_scan_kernel_supported(ScanKernel kernel)
+{
+    switch (kernel)
+    {
+    case ScanKernel::Serial:
+    case ScanKernel::Lanes:
+    case ScanKernel::Auto:
+        return true;
+#if ZINC_X86_KERNELS
+    case ScanKernel::AVX2:
+        return __builtin_cpu_supports("avx2");
+    case ScanKernel::AVX512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return false;
+    }
+}
+
+ScanKernel select_scan_kernel()
+{
+    // Table lookups are gathers in vector kernels and they do not get any faster with wider registers, therefore AVX2
+    // is preferred over AVX-512 which may also lower clock speed. Portable lanes measure slower than serial kernel,
+    // they are never selected.
+    for (auto kernel : {ScanKernel::AVX2, ScanKernel::AVX512})
+    {
+        if (is_scan_kernel_supported(kernel))
+            return kernel;
+    }
+    return ScanKernel::Serial;
+}
+
+uint32_t find_split_points(const uint8_t* data, size_t count, uint32_t fingerprint, int64_t offset,
+    const Parameters& parameters, BoundaryList& result, ScanKernel kernel)
+{
+    if (kernel == ScanKernel::Auto)
+    {
+        static const auto best_kernel = select_scan_kernel();
+        kernel = best_kernel;
+    }
+
+    assert(is_scan_kernel_supported(kernel));
+    switch (kernel)
+    {
+    case ScanKernel::Lanes:
+        return find_split_points_lanes(&roll_lanes_portable<4>, 4, data, count, fingerprint, offset, parameters,
+            result);
+
+#if ZINC_X86_KERNELS
+    case ScanKernel::AVX2:
+        return find_split_points_lanes(&roll_lanes_avx2, 8, data, count, fingerprint, offset, parameters, result);
+    case ScanKernel::AVX512:
+        return find_split_points_lanes(&roll_lanes_avx512, 16, data, count, fingerprint, offset, parameters, result);
+#endif
+    default:
+        return find_split_points_serial(data, count, fingerprint, offset, parameters, result);
+    }
+}
+
+}   // detail
+
+}   // zinc
@@ -0,0 +1,216 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <tuple>
+#include "zinc/zinc.h"
+#include "external_sort.h"
+
+namespace zinc
+{
+
+/// Defined in patch.cpp.
+void append_operation(PatchOperationList& patch, const PatchOperation& operation);
+
+/// Block of compared file.
+struct BlockRecord
+{
+    uint64_t hash;
+    uint64_t fingerprint;
+    int64_t length;
+    int64_t start;
+};
+
+/// Returns true when blocks have same content.
+inline bool same_block(const BlockRecord& a, const BlockRecord& b)
+{
+    return a.hash == b.hash && a.fingerprint == b.fingerprint && a.length == b.length;
+}
+
+/// Orders blocks with same content together, in order of descending start.
+struct BlockOrder
+{
+    bool operator()(const BlockRecord& a, const BlockRecord& b) const
+    {
+        return std::tie(a.hash, a.fingerprint, a.length, b.start) < std::tie(b.hash, b.fingerprint, b.length, a.start);
+    }
+};
+
+/// Orders operations by ascending destination.
+struct DestinationOrder
+{
+    bool operator()(const PatchOperation& a, const PatchOperation& b) const { return a.destination < b.destination; }
+};
+
+/// Orders operations by descending destination.
+struct ReverseDestinationOrder
+{
+    bool operator()(const PatchOperation& a, const PatchOperation& b) const { return a.destination > b.destination; }
+};
+
+/// Orders operations by ascending source.
+struct SourceOrder
+{
+    bool operator()(const PatchOperation& a, const PatchOperation& b) const { return a.source < b.source; }
+};
+
+/// Sort blocks produced by `reader`.
+bool sort_blocks(const BoundaryReader& reader, ExternalSorter<BlockRecord, BlockOrder>& sorter)
+{
+    Boundary boundary{};
+    while (reader(boundary))
+    {
+        if (!sorter.push(BlockRecord{boundary.hash, boundary.fingerprint, boundary.length, boundary.start}))
+            return false;
+    }
+    return sorter.finish();
+}
+
+/// Append operations of `sorter` to the patch.
+template<typename Less>
+bool append_sorted(ExternalSorter<PatchOperation, Less>& sorter, PatchOperationList& patch)
+{
+    if (!sorter.finish())
+        return false;
+    PatchOperation operation{};
+    while (sorter.next(operation))
+        append_operation(patch, operation);
+    return !sorter.failed();
+}
+
+bool compare_files_external(const BoundaryReader& local_file, const BoundaryReader& remote_file,
+    PatchOperationList& patch, size_t memory_limit, const Parameters* parameters)
+{
+    // At most six sorters hold buffers at the same time.
+    auto sorter_memory = memory_limit / 6;
+
+    // Copies towards start of file do not overwrite sources of each other when applied in order of destination, copies
+    // towards end of file - in reverse order. Downloads and fills do not read local file and come after copies,
+    // repeated downloads are copied from location written by first download at the very end.
+    ExternalSorter<PatchOperation, DestinationOrder> backward_copies(sorter_memory);
+    ExternalSorter<PatchOperation, SourceOrder> forward_copies(sorter_memory);
+    ExternalSorter<PatchOperation, DestinationOrder> downloads(sorter_memory);
+    ExternalSorter<PatchOperation, DestinationOrder> duplicates(sorter_memory);
+    {
+        ExternalSorter<BlockRecord, BlockOrder> local_blocks(sorter_memory);
+        ExternalSorter<BlockRecord, BlockOrder> remote_blocks(sorter_memory);
+        if (!sort_blocks(local_file, local_blocks) || !sort_blocks(remote_file, remote_blocks))
+            return false;
+
+        // Merge join of both files. Blocks with same content come in order of descending start in both of them.
+        BlockRecord local{}, remote{}, group{};
+        int64_t group_source = -1;          // Start of last local block with content of current group
+        int64_t group_download = -1;        // Start of remote block of current group that is downloaded
+        bool has_local = local_blocks.next(local);
+        bool has_group = false;
+        while (remote_blocks.next(remote))
+        {
+            while (has_local && BlockOrder()(local, remote) && !same_block(local, remote))
+                has_local = local_blocks.next(local);
+
+            if (!has_group || !same_block(group, remote))
+            {
+                group = remote;
+                has_group = true;
+                group_source = has_local && same_block(local, remote) ? local.start : -1;
+                group_download = -1;
+            }
+
+            // Exactly same block at required position exists in a local file. No need to do anything.
+            while (has_local && same_block(local, remote) && local.start > remote.start)
+                has_local = local_blocks.next(local);
+            if (has_local && same_block(local, remote) && local.start == remote.start)
+                continue;
+
+            bool pushed;
+            Boundary block{.start = remote.start, .fingerprint = remote.fingerprint, .hash = remote.hash,
+                .length = remote.length};
+            // Operation writing this block.
+            auto write = [&](PatchOperation::Type type, int64_t source)
+            {
+                return PatchOperation{type, source, block.start, block.length};
+            };
+            if (is_zero_block(block, parameters))
+            {
+                // Filling with zeros is cheaper than copying zeros.
+                pushed = downloads.push(write(PatchOperation::Zero, block.start));
+            }
+            else if (group_source > block.start)
+                pushed = backward_copies.push(write(PatchOperation::Copy, group_source));
+            else if (group_source >= 0)
+                pushed = forward_copies.push(write(PatchOperation::Copy, group_source));
+            else if (group_download < 0)
+            {
+                group_download = block.start;
+                pushed = downloads.push(write(PatchOperation::Download, block.start));
+            }
+            else
+                pushed = duplicates.push(write(PatchOperation::Copy, group_download));
+
+            if (!pushed)
+                return false;
+        }
+
+        if (local_blocks.failed() || remote_blocks.failed())
+            return false;
+    }
+
+    // Copies towards end of file whose source is overwritten by a copy towards start of file are downloaded instead.
+    // Both lists are sorted by offset of ranges that are compared, destinations of copies do not overlap.
+    ExternalSorter<PatchOperation, ReverseDestinationOrder> ordered_forward_copies(sorter_memory);
+    if (!backward_copies.finish() || !forward_copies.finish())
+        return false;
+
+    patch.clear();
+    PatchOperation backward{}, forward{};
+    bool has_backward = backward_copies.next(backward);
+    while (forward_copies.next(forward))
+    {
+        while (has_backward && backward.destination + backward.length <= forward.source)
+        {
+            append_operation(patch, backward);
+            has_backward = backward_copies.next(backward);
+        }
+
+        bool pushed;
+        if (has_backward && backward.destination < forward.source + forward.length)
+        {
+            pushed = downloads.push(PatchOperation{PatchOperation::Download, forward.destination, forward.destination,
+                forward.length});
+        }
+        else
+            pushed = ordered_forward_copies.push(forward);
+
+        if (!pushed)
+            return false;
+    }
+    for (; has_backward; has_backward = backward_copies.next(backward))
+        append_operation(patch, backward);
+
+    if (backward_copies.failed() || forward_copies.failed())
+        return false;
+
+    return append_sorted(ordered_forward_copies, patch) && append_sorted(downloads, patch) &&
+        append_sorted(duplicates, patch);
+}
+
+}
@@ -0,0 +1,389 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include "zinc/zinc.h"
+#include "file.h"
+
+namespace zinc
+{
+
+const size_t BlockSketch::size;
+const size_t SimilarityIndex::npos;
+
+//////////////////////////////////////////////// block sketches ////////////////////////////////////////////////////////
+
+/// Window of rolling hash sampling block content.
+const uint32_t sketch_window = 32;
+/// Roughly one of this many positions is sampled.
+const uint32_t sketch_sample_mask = 0x1f;
+/// Number of features combined into one super-feature.
+const size_t features_per_super_feature = 3;
+
+/// Mix bits of a fingerprint with a seed of a feature.
+inline uint64_t mix_feature(uint64_t value, uint64_t seed)
+{
+    value ^= seed;
+    value ^= value >> 33U;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33U;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    return value ^ (value >> 33U);
+}
+
+namespace detail
+{
+
+BlockSketch block_sketch(const uint8_t* data, size_t length)
+{
+    const size_t num_features = BlockSketch::size * features_per_super_feature;
+    uint64_t features[num_features] = {};
+    bool sampled = false;
+    if (length >= sketch_window)
+    {
+        // Every feature is a maximum of differently mixed fingerprints of sampled windows. Similar blocks share most of
+        // windows, therefore they are likely to share features as well.
+        auto fingerprint = buzhash(data, sketch_window);
+        for (size_t i = 0;; i++)
+        {
+            if ((fingerprint & sketch_sample_mask) == 0)
+            {
+                sampled = true;
+                for (size_t j = 0; j < num_features; j++)
+                    features[j] = std::max(features[j], mix_feature(fingerprint, j + 1));
+            }
+            if (i + sketch_window >= length)
+                break;
+            fingerprint = buzhash_update(fingerprint, data[i], data[i + sketch_window], sketch_window);
+        }
+    }
+
+    BlockSketch result{};
+    if (!sampled)
+        return result;                                  // No features, block is not similar to anything
+
+    for (size_t i = 0; i < BlockSketch::size; i++)
+    {
+        auto feature = fnv64a_combine(&features[i * features_per_super_feature], features_per_super_feature);
+        result.features[i] = std::max<uint64_t>(1, feature);
+    }
+    return result;
+}
+
+}
+
+SimilarityIndex::SimilarityIndex(const std::vector<BlockSketch>& sketches)
+{
+    for (size_t i = 0; i < sketches.size(); i++)
+    {
+        for (auto feature : sketches[i].features)
+        {
+            if (feature != 0)
+                blocks_[feature].push_back(i);
+        }
+    }
+}
+
+size_t SimilarityIndex::find(const BlockSketch& sketch) const
+{
+    // Block sharing most super-features wins, earlier block wins a tie.
+    std::unordered_map<size_t, size_t> shared;
+    for (auto feature : sketch.features)
+    {
+        auto it = blocks_.find(feature);
+        if (feature == 0 || it == blocks_.end())
+            continue;
+        for (auto index : it->second)
+            shared[index]++;
+    }
+
+    auto result = npos;
+    size_t best = 0;
+    for (const auto& candidate : shared)
+    {
+        if (candidate.second > best || (candidate.second == best && candidate.first < result))
+        {
+            result = candidate.first;
+            best = candidate.second;
+        }
+    }
+    return result;
+}
+
+//////////////////////////////////////////////// delta encoding ////////////////////////////////////////////////////////
+
+/// Shortest match copied from reference.
+const size_t min_delta_match = 16;
+/// Reference positions are indexed with this step. Target is searched at every position, therefore any match longer
+/// than `min_delta_match + delta_index_step` is found.
+const size_t delta_index_step = 4;
+
+/// Hash of `min_delta_match` bytes.
+inline uint32_t delta_key(const uint8_t* data, unsigned bits)
+{
+    uint64_t a, b;
+    memcpy(&a, data, sizeof(a));
+    memcpy(&b, data + sizeof(a), sizeof(b));
+    return static_cast<uint32_t>((a * 0x9e3779b97f4a7c15ULL ^ b * 0xc2b2ae3d27d4eb4fULL) >> (64U - bits));
+}
+
+/// Append variable length integer, 7 bits per byte.
+void write_varint(std::vector<uint8_t>& output, uint64_t value)
+{
+    for (; value >= 0x80; value >>= 7U)
+        output.push_back(static_cast<uint8_t>(value | 0x80U));
+    output.push_back(static_cast<uint8_t>(value));
+}
+
+/// Read variable length integer. Returns false when input ends prematurely.
+bool read_varint(const uint8_t*& input, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for (unsigned shift = 0; input < end && shift < 64; shift += 7)
+    {
+        auto byte = *input++;
+        value |= static_cast<uint64_t>(byte & 0x7fU) << shift;
+        if ((byte & 0x80U) == 0)
+            return true;
+    }
+    return false;
+}
+
+/// Append instruction adding literal data.
+void write_add(std::vector<uint8_t>& output, const uint8_t* data, size_t length)
+{
+    if (length == 0)
+        return;
+    write_varint(output, static_cast<uint64_t>(length) << 1U);
+    output.insert(output.end(), data, data + length);
+}
+
+std::vector<uint8_t> encode_delta(const uint8_t* reference, size_t reference_length, const uint8_t* target,
+    size_t target_length)
+{
+    std::vector<uint8_t> result;
+    if (reference_length < min_delta_match || target_length < min_delta_match)
+    {
+        write_add(result, target, target_length);
+        return result;
+    }
+
+    // Positions of reference indexed by hash of data at them, later positions replace earlier ones.
+    unsigned bits = 10;
+    while ((1ULL << bits) < reference_length / delta_index_step && bits < 30)
+        bits++;
+    std::vector<uint32_t> table(1ULL << bits, UINT32_MAX);
+    for (size_t i = 0; i + min_delta_match <= reference_length; i += delta_index_step)
+        table[delta_key(reference + i, bits)] = static_cast<uint32_t>(i);
+
+    size_t literal = 0;                                 // Start of data not encoded yet
+    for (size_t i = 0; i + min_delta_match <= target_length;)
+    {
+        auto candidate = table[delta_key(target + i, bits)];
+        if (candidate == UINT32_MAX || memcmp(reference + candidate, target + i, min_delta_match) != 0)
+        {
+            i++;
+            continue;
+        }
+
+        // Extend match in both directions, backwards only over data not encoded yet.
+        size_t source = candidate;
+        size_t end = i + min_delta_match;
+        auto source_end = source + min_delta_match;
+        while (end < target_length && source_end < reference_length && target[end] == reference[source_end])
+        {
+            end++;
+            source_end++;
+        }
+        while (i > literal && source > 0 && target[i - 1] == reference[source - 1])
+        {
+            i--;
+            source--;
+        }
+
+        write_add(result, target + literal, i - literal);
+        write_varint(result, static_cast<uint64_t>(end - i) << 1U | 1U);
+        write_varint(result, source);
+        i = literal = end;
+    }
+    write_add(result, target + literal, target_length - literal);
+    return result;
+}
+
+bool decode_delta(const uint8_t* reference, size_t reference_length, const uint8_t* delta, size_t delta_length,
+    std::vector<uint8_t>& target)
+{
+    target.clear();
+    for (const auto* end = delta + delta_length; delta < end;)
+    {
+        uint64_t header = 0;
+        if (!read_varint(delta, end, header))
+            return false;
+        auto length = header >> 1U;
+        if (header & 1U)
+        {
+            uint64_t source = 0;
+            if (!read_varint(delta, end, source) || source > reference_length || length > reference_length - source)
+                return false;
+            target.insert(target.end(), reference + source, reference + source + length);
+        }
+        else
+        {
+            if (length > static_cast<uint64_t>(end - delta))
+                return false;
+            target.insert(target.end(), delta, delta + length);
+            delta += length;
+        }
+    }
+    return true;
+}
+
+//////////////////////////////////////////////// reconstructed blocks //////////////////////////////////////////////////
+
+DeltaSource::DeltaSource(RemoteSource* remote)
+    : remote_(remote)
+{
+}
+
+DeltaSource::~DeltaSource()
+{
+    if (spool_ != nullptr)
+        fclose(spool_);
+}
+
+bool DeltaSource::add(int64_t offset, const uint8_t* data, size_t length)
+{
+    if (spool_ == nullptr && (spool_ = tmpfile()) == nullptr)
+        return false;
+    if (!write_at(spool_, spool_size_, data, length))
+        return false;
+    ranges_[offset] = std::make_pair(spool_size_, static_cast<int64_t>(length));
+    spool_size_ += length;
+    return true;
+}
+
+bool DeltaSource::read(int64_t offset, uint8_t* buffer, size_t length)
+{
+    return read_ranges({RemoteRange{offset, buffer, length}});
+}
+
+bool DeltaSource::read_ranges(const std::vector<RemoteRange>& ranges)
+{
+    // Pieces that were not reconstructed are read from remote source at once.
+    std::vector<RemoteRange> missing;
+    for (const auto& range : ranges)
+    {
+        auto* buffer = range.buffer;
+        for (auto offset = range.offset, end = range.offset + static_cast<int64_t>(range.length); offset < end;)
+        {
+            // Range that contains offset, or first range after it.
+            auto it = ranges_.upper_bound(offset);
+            if (it != ranges_.begin() && std::prev(it)->first + std::prev(it)->second.second > offset)
+                --it;
+
+            int64_t piece = 0;
+            if (it != ranges_.end() && it->first <= offset)
+            {
+                piece = std::min(end, it->first + it->second.second) - offset;
+                if (!read_at(spool_, it->second.first + offset - it->first, buffer, static_cast<size_t>(piece)))
+                    return false;
+            }
+            else
+            {
+                piece = (it != ranges_.end() ? std::min(end, it->first) : end) - offset;
+                missing.push_back(RemoteRange{offset, buffer, static_cast<size_t>(piece)});
+            }
+            offset += piece;
+            buffer += piece;
+        }
+    }
+    return missing.empty() || (remote_ != nullptr && remote_->read_ranges(missing));
+}
+
+bool reconstruct_blocks(FILE* local_file, const CompactBoundaryList& local_blocks,
+    const CompactBoundaryList& remote_blocks, const PatchOperationList& patch, const std::vector<BlockDelta>& deltas,
+    RemoteSource* delta_pack, DeltaSource& output, int64_t* delta_bytes, const Parameters* parameters)
+{
+    if (delta_bytes != nullptr)
+        *delta_bytes = 0;
+    if (local_file == nullptr || delta_pack == nullptr)
+        return true;
+
+    // Only blocks downloaded by the patch are reconstructed.
+    std::vector<std::pair<int64_t, int64_t>> downloads;
+    for (const auto& operation : patch)
+    {
+        if (operation.type == PatchOperation::Download)
+            downloads.emplace_back(operation.destination, operation.destination + operation.length);
+    }
+    std::sort(downloads.begin(), downloads.end());
+
+    std::unordered_map<uint64_t, std::vector<size_t>> local_table;
+    for (size_t i = 0; i < local_blocks.size(); i++)
+        local_table[local_blocks.hash(i)].push_back(i);
+
+    auto leaf_size = parameters ? parameters->hash_leaf_size : 0;
+    std::vector<uint8_t> reference, delta, target;
+    for (const auto& block_delta : deltas)
+    {
+        if (block_delta.block >= remote_blocks.size())
+            continue;
+        auto block = remote_blocks[block_delta.block];
+        auto download = std::upper_bound(downloads.begin(), downloads.end(), std::make_pair(block.start, INT64_MAX));
+        if (download == downloads.begin() || std::prev(download)->second < block.start + block.length)
+            continue;
+
+        // Reference block must exist locally.
+        auto it = local_table.find(block_delta.reference_hash);
+        if (it == local_table.end())
+            continue;
+        auto local = std::find_if(it->second.begin(), it->second.end(), [&](size_t index)
+        {
+            return local_blocks.length(index) == block_delta.reference_length;
+        });
+        if (local == it->second.end())
+            continue;
+
+        reference.resize(static_cast<size_t>(block_delta.reference_length));
+        delta.resize(static_cast<size_t>(block_delta.length));
+        if (!read_at(local_file, local_blocks.start(*local), reference.data(), reference.size()) ||
+            !delta_pack->read(block_delta.offset, delta.data(), delta.size()))
+            continue;
+
+        // Blocks whose data does not match their hash are downloaded as usual.
+        if (!decode_delta(reference.data(), reference.size(), delta.data(), delta.size(), target) ||
+            target.size() != static_cast<size_t>(block.length) ||
+            detail::block_hash(target.data(), target.size(), leaf_size) != block.hash)
+            continue;
+
+        if (!output.add(block.start, target.data(), target.size()))
+            return false;
+        if (delta_bytes != nullptr)
+            *delta_bytes += block_delta.length;
+    }
+    return true;
+}
+
+}
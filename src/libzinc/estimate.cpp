@@ -0,0 +1,132 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <unordered_set>
+#include "zinc/zinc.h"
+#include "file.h"
+
+namespace zinc
+{
+
+const Parameters default_parameters{};
+
+ReuseEstimate estimate_reuse(FILE* local_file, const CompactBoundaryList& remote_blocks,
+    const ReuseEstimateOptions& options, const Parameters* parameters)
+{
+    if (parameters == nullptr)
+        parameters = &default_parameters;
+
+    ReuseEstimate estimate;
+    auto local_size = get_file_size(local_file);
+    auto remote_size = remote_blocks.file_size();
+    auto sample_size = static_cast<int64_t>(options.sample_size);
+    if (sample_size == 0)
+        sample_size = 8 * (static_cast<int64_t>(parameters->min_block_size) + (int64_t(1) << parameters->match_bits));
+    auto samples = static_cast<int64_t>(options.samples);
+    if (local_size <= 0 || remote_size <= 0 || samples < 2 ||
+        static_cast<double>(samples * sample_size) > options.max_sampled_fraction * static_cast<double>(local_size) ||
+        samples * sample_size > local_size)
+        return estimate;
+
+    std::unordered_set<uint64_t> remote_hashes;
+    remote_hashes.reserve(remote_blocks.size());
+    int64_t zero_bytes = 0;
+    for (const auto& block : remote_blocks)
+    {
+        if (is_zero_block(block, parameters))
+            zero_bytes += block.length;
+        else
+            remote_hashes.insert(block.hash);
+    }
+
+    // Sampling only reads data, progress is not reported.
+    Parameters sample_parameters = *parameters;
+    sample_parameters.on_progress = nullptr;
+    sample_parameters.on_complete = nullptr;
+
+    // Seeded with a constant so estimates of the same files are repeatable.
+    std::minstd_rand random(static_cast<uint32_t>(local_size));
+    auto stride = local_size / samples;
+    std::vector<uint8_t> data(static_cast<size_t>(sample_size));
+    std::vector<double> matched;
+    std::vector<double> counted;
+    for (int64_t i = 0; i < samples; i++)
+    {
+        auto offset = i * stride + static_cast<int64_t>(random() % static_cast<uint64_t>(stride - sample_size + 1));
+        if (!read_at(local_file, offset, data.data(), data.size()))
+            return estimate;
+        estimate.sampled_bytes += sample_size;
+
+        // Region edges cut blocks at arbitrary positions, chunking is in sync with remote file only after first
+        // boundary and last block is cut short.
+        auto blocks = partition_buffer(data.data(), data.size(), 0, nullptr, nullptr, nullptr,
+            &sample_parameters).get();
+
+        if (blocks.size() < 3)
+            continue;
+        int64_t region_matched = 0;
+        int64_t region_counted = 0;
+        for (size_t j = 1; j + 1 < blocks.size(); j++)
+        {
+            region_counted += blocks[j].length;
+            if (!is_zero_block(blocks[j], parameters) && remote_hashes.count(blocks[j].hash) > 0)
+                region_matched += blocks[j].length;
+        }
+        matched.push_back(static_cast<double>(region_matched));
+        counted.push_back(static_cast<double>(region_counted));
+    }
+
+    if (matched.size() < 2)
+        return estimate;
+
+    // Ratio estimator over regions, variance is estimated from residuals of every region.
+    double total_matched = 0;
+    double total_counted = 0;
+    for (size_t i = 0; i < matched.size(); i++)
+    {
+        total_matched += matched[i];
+        total_counted += counted[i];
+    }
+    auto n = static_cast<double>(matched.size());
+    auto ratio = total_matched / total_counted;
+    auto mean_counted = total_counted / n;
+    double residuals = 0;
+    for (size_t i = 0; i < matched.size(); i++)
+        residuals += (matched[i] - ratio * counted[i]) * (matched[i] - ratio * counted[i]);
+    auto error = std::sqrt(residuals / (n * (n - 1))) / mean_counted;
+
+    // Share of local file is converted to share of remote file. Zero blocks of remote file are never downloaded.
+    auto scale = static_cast<double>(local_size) / static_cast<double>(remote_size);
+    auto zeros = static_cast<double>(zero_bytes) / static_cast<double>(remote_size);
+    auto to_reuse = [&](double local_ratio) { return std::min(1.0, std::max(0.0, local_ratio) * scale + zeros); };
+    estimate.valid = true;
+    estimate.reuse = to_reuse(ratio);
+    estimate.low = to_reuse(ratio - options.confidence * error);
+    estimate.high = to_reuse(ratio + options.confidence * error);
+    return estimate;
+}
+
+}
@@ -0,0 +1,280 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "file.h"
+
+
+namespace zinc
+{
+
+/// Sorts more records than fit in memory. Records are collected in a buffer, which is sorted and written to a
+/// temporary file as a run once it is full. Runs are merged when records are read, in several passes when there are
+/// too many of them to read at once. Records must be trivially copyable.
+template<typename Record, typename Less>
+class ExternalSorter
+{
+public:
+    /// Minimal size of a buffer used for reading a run while merging. Limits number of runs merged at once.
+    static const size_t merge_buffer_size = 64 * 1024;
+
+    /// \param memory_limit number of bytes used for buffers, at most.
+    explicit ExternalSorter(size_t memory_limit, Less less = Less())
+        : memory_limit_(std::max(memory_limit, 2 * sizeof(Record)))
+        , less_(less)
+    {
+    }
+    ExternalSorter(const ExternalSorter&) = delete;
+    ExternalSorter& operator=(const ExternalSorter&) = delete;
+    ~ExternalSorter()
+    {
+        if (file_ != nullptr)
+            fclose(file_);
+    }
+
+    /// Add a record. Returns false when run could not be written.
+    bool push(const Record& record)
+    {
+        auto capacity = memory_limit_ / sizeof(Record);
+        if (buffer_.size() == capacity && !write_run())
+            return false;
+        if (buffer_.size() == buffer_.capacity())
+            buffer_.reserve(std::min(capacity, std::max<size_t>(64, buffer_.size() * 2)));
+        buffer_.push_back(record);
+        return true;
+    }
+
+    /// Finish adding records and prepare to read them in order. Returns false on failure of temporary file. Records
+    /// that fit in memory are never written to a file.
+    bool finish()
+    {
+        if (runs_.empty())
+        {
+            std::sort(buffer_.begin(), buffer_.end(), less_);
+            return true;
+        }
+
+        if (!buffer_.empty() && !write_run())
+            return false;
+        std::vector<Record>().swap(buffer_);
+
+        // Merge groups of runs into longer runs stored in a new file until all of them can be read at once.
+        auto max_runs = std::max<size_t>(2, memory_limit_ / merge_buffer_size);
+        while (runs_.size() > max_runs)
+        {
+            FILE* output = tmpfile();
+            if (output == nullptr)
+                return false;
+
+            std::vector<Run> merged;
+            int64_t end = 0;
+            std::vector<Record> write_buffer;
+            auto buffer_records = buffer_records_per_run(max_runs + 1);
+            write_buffer.reserve(buffer_records);
+            for (size_t first = 0; first < runs_.size(); first += max_runs)
+            {
+                auto last = std::min(runs_.size(), first + max_runs);
+                Merge merge(this, first, last, buffer_records);
+                Run run{end, 0};
+                Record record;
+                while (merge.next(record))
+                {
+                    write_buffer.push_back(record);
+                    if (write_buffer.size() == buffer_records && !flush(output, write_buffer, end))
+                        merge.failed = true;
+                    run.count++;
+                }
+                if (merge.failed || !flush(output, write_buffer, end))
+                {
+                    fclose(output);
+                    return false;
+                }
+                merged.push_back(run);
+            }
+            fclose(file_);
+            file_ = output;
+            runs_ = merged;
+        }
+
+        merge_.reset(new Merge(this, 0, runs_.size(), buffer_records_per_run(runs_.size())));
+        return !merge_->failed;
+    }
+
+    /// Read next record in sorted order. Returns false when all records were read or reading failed.
+    bool next(Record& record)
+    {
+        if (!merge_)
+        {
+            if (position_ >= buffer_.size())
+                return false;
+            record = buffer_[position_++];
+            return true;
+        }
+        return merge_->next(record);
+    }
+
+    /// Returns true when temporary file could not be read or written.
+    bool failed() const { return merge_ && merge_->failed; }
+
+protected:
+    /// Sorted records stored in the temporary file.
+    struct Run
+    {
+        int64_t offset;
+        uint64_t count;
+    };
+
+    /// Reads records of several runs in sorted order.
+    struct Merge
+    {
+        /// Part of run that was not consumed yet.
+        struct Input
+        {
+            int64_t offset;
+            uint64_t remaining;
+            std::vector<Record> buffer;
+            size_t position;
+        };
+
+        Merge(const ExternalSorter* owner, size_t first, size_t last, size_t buffer_records)
+            : sorter(owner)
+        {
+            for (auto i = first; i < last; i++)
+            {
+                Input input{owner->runs_[i].offset, owner->runs_[i].count, {}, 0};
+                input.buffer.reserve(buffer_records);
+                inputs.push_back(std::move(input));
+                if (!fill(inputs.back()))
+                    failed = true;
+                else if (!inputs.back().buffer.empty())
+                    heap.push_back(inputs.size() - 1);
+            }
+            std::make_heap(heap.begin(), heap.end(), Greater{this});
+        }
+
+        bool next(Record& record)
+        {
+            if (failed || heap.empty())
+                return false;
+
+            std::pop_heap(heap.begin(), heap.end(), Greater{this});
+            auto& input = inputs[heap.back()];
+            record = input.buffer[input.position++];
+            if (input.position == input.buffer.size() && !fill(input))
+                failed = true;
+            if (input.position < input.buffer.size())
+                std::push_heap(heap.begin(), heap.end(), Greater{this});
+            else
+                heap.pop_back();
+            return true;
+        }
+
+        /// Read next part of run into buffer.
+        bool fill(Input& input)
+        {
+            auto count = static_cast<size_t>(std::min<uint64_t>(input.remaining, input.buffer.capacity()));
+            input.buffer.resize(count);
+            input.position = 0;
+            if (count == 0)
+                return true;
+            auto* buffer = reinterpret_cast<uint8_t*>(&input.buffer[0]);
+            if (!read_at(sorter->file_, input.offset, buffer, count * sizeof(Record)))
+                return false;
+            input.offset += count * sizeof(Record);
+            input.remaining -= count;
+            return true;
+        }
+
+        /// Orders heap so that input with smallest current record is on top.
+        struct Greater
+        {
+            const Merge* merge;
+            bool operator()(size_t a, size_t b) const
+            {
+                const auto& input_a = merge->inputs[a];
+                const auto& input_b = merge->inputs[b];
+                return merge->sorter->less_(input_b.buffer[input_b.position], input_a.buffer[input_a.position]);
+            }
+        };
+
+        const ExternalSorter* sorter;
+        std::vector<Input> inputs;
+        /// Indices of inputs that have records left.
+        std::vector<size_t> heap;
+        bool failed = false;
+    };
+
+    /// Returns number of records buffered for every run when `count` runs are read at once.
+    size_t buffer_records_per_run(size_t count) const
+    {
+        return std::max<size_t>(1, memory_limit_ / count / sizeof(Record));
+    }
+
+    /// Sort buffer and append it to the temporary file as a new run.
+    bool write_run()
+    {
+        if (file_ == nullptr && (file_ = tmpfile()) == nullptr)
+            return false;
+        std::sort(buffer_.begin(), buffer_.end(), less_);
+        runs_.push_back(Run{end_, buffer_.size()});
+        return flush(file_, buffer_, end_);
+    }
+
+    /// Write records at the `end` of file and clear them.
+    static bool flush(FILE* file, std::vector<Record>& records, int64_t& end)
+    {
+        if (records.empty())
+            return true;
+        auto size = records.size() * sizeof(Record);
+        if (!write_at(file, end, reinterpret_cast<const uint8_t*>(&records[0]), size))
+            return false;
+        end += size;
+        records.clear();
+        return true;
+    }
+
+    size_t memory_limit_;
+    Less less_;
+    /// Records that were not written to a run yet.
+    std::vector<Record> buffer_;
+    /// Position of next record to read when all records fit in the buffer.
+    size_t position_ = 0;
+    /// Temporary file storing runs.
+    FILE* file_ = nullptr;
+    /// Size of data in temporary file.
+    int64_t end_ = 0;
+    std::vector<Run> runs_;
+    std::unique_ptr<Merge> merge_;
+};
+
+template<typename Record, typename Less>
+const size_t ExternalSorter<Record, Less>::merge_buffer_size;
+
+}
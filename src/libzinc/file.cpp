@@ -0,0 +1,181 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#if _WIN32
+#   include <windows.h>
+#   include <io.h>
+#else
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+#if __linux__
+#   include <sys/sysmacros.h>
+#endif
+#include <cerrno>
+#include <initializer_list>
+#include "file.h"
+
+namespace zinc
+{
+
+bool seek_file(FILE* file, int64_t offset, int origin)
+{
+#if _WIN32
+    return _fseeki64(file, offset, origin) == 0;
+#else
+    return fseeko(file, static_cast<off_t>(offset), origin) == 0;
+#endif
+}
+
+int64_t tell_file(FILE* file)
+{
+#if _WIN32
+    return _ftelli64(file);
+#else
+    return ftello(file);
+#endif
+}
+
+int64_t get_file_size(FILE* file)
+{
+    if (!file)
+        return 0;
+
+#if !_WIN32
+    struct stat info{};
+    auto fd = fileno(file);
+    if (fd >= 0 && fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+        return info.st_size;
+#endif
+
+    auto pos = tell_file(file);
+    seek_file(file, 0, SEEK_END);
+
+    auto result = tell_file(file);
+    seek_file(file, pos, SEEK_SET);
+
+    return result;
+}
+
+bool is_rotational(FILE* file)
+{
+#if __linux__
+    struct stat info{};
+    auto fd = file != nullptr ? fileno(file) : -1;
+    if (fd < 0 || fstat(fd, &info) != 0)
+        return false;
+
+    // Queue attributes are found on a whole disk, partitions are subdirectories of it.
+    for (const char* path : {"/sys/dev/block/%u:%u/queue/rotational", "/sys/dev/block/%u:%u/../queue/rotational"})
+    {
+        char file_path[64];
+        snprintf(file_path, sizeof(file_path), path, major(info.st_dev), minor(info.st_dev));
+        if (FILE* attribute = fopen(file_path, "r"))
+        {
+            int rotational = 0;
+            auto parsed = fscanf(attribute, "%d", &rotational);
+            fclose(attribute);
+            if (parsed == 1)
+                return rotational != 0;
+        }
+    }
+#else
+    (void)file;
+#endif
+    return false;
+}
+
+bool read_at(FILE* file, int64_t offset, uint8_t* buffer, size_t length)
+{
+#if !_WIN32
+    auto fd = fileno(file);
+    if (fd >= 0)
+    {
+        size_t done = 0;
+        while (done < length)
+        {
+            auto result = pread(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+            if (result < 0 && errno == EINTR)
+                continue;
+            if (result <= 0)
+                return false;
+            done += static_cast<size_t>(result);
+        }
+        return true;
+    }
+
+    // Stream without a file descriptor (like fmemopen()). Seek and read must not be interleaved with other threads.
+    flockfile(file);
+#endif
+    size_t done = 0;
+    if (seek_file(file, offset))
+        done = fread(buffer, 1, length, file);
+#if !_WIN32
+    funlockfile(file);
+#endif
+    return done == length;
+}
+
+bool write_at(FILE* file, int64_t offset, const uint8_t* buffer, size_t length)
+{
+#if !_WIN32
+    auto fd = fileno(file);
+    if (fd >= 0)
+    {
+        size_t done = 0;
+        while (done < length)
+        {
+            auto result = pwrite(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+            if (result < 0 && errno == EINTR)
+                continue;
+            if (result <= 0)
+                return false;
+            done += static_cast<size_t>(result);
+        }
+        return true;
+    }
+
+    flockfile(file);
+#endif
+    size_t done = 0;
+    if (seek_file(file, offset))
+        done = fwrite(buffer, 1, length, file);
+#if !_WIN32
+    funlockfile(file);
+#endif
+    return done == length;
+}
+
+bool truncate_file(FILE* file, int64_t size)
+{
+    auto fd = fileno(file);
+    if (fd < 0 || fflush(file) != 0)
+        return false;
+#if _WIN32
+    return _chsize_s(fd, size) == 0;
+#else
+    return ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+}
+
+}
@@ -0,0 +1,51 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+
+#include <cstdint>
+#include <cstdio>
+
+
+namespace zinc
+{
+
+/// Set stream position. Unlike fseek() works with offsets beyond 2GB on all platforms.
+bool seek_file(FILE* file, int64_t offset, int origin = SEEK_SET);
+/// Returns stream position or -1 on failure. Unlike ftell() works with offsets beyond 2GB on all platforms.
+int64_t tell_file(FILE* file);
+/// Returns size of file. Stream position is not changed.
+int64_t get_file_size(FILE* file);
+/// Returns true when file is stored on a rotational disk, where concurrent reads at different offsets are slow.
+bool is_rotational(FILE* file);
+/// Read exactly `length` bytes at `offset` of a file. Files with a descriptor are read without touching stream
+/// position, other streams (like fmemopen()) are locked while seeking and reading, therefore function may be called
+/// from multiple threads.
+bool read_at(FILE* file, int64_t offset, uint8_t* buffer, size_t length);
+/// Write exactly `length` bytes at `offset` of a file.
+bool write_at(FILE* file, int64_t offset, const uint8_t* buffer, size_t length);
+/// Change size of a file. Returns false for streams without a descriptor.
+bool truncate_file(FILE* file, int64_t size);
+
+}
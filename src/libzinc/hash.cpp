@@ -49,6 +49,8 @@
  */
 #include <cstddef>
 #include <cstdint>
+#include <algorithm>
+#include "zinc/zinc.h"
 
 namespace zinc
 {
@@ -56,7 +58,7 @@ namespace zinc
 namespace detail
 {
 
-static uint32_t table_base[] =
+const uint32_t buzhash_table[256] =
 {
     0xe7f831ec, 0xf4026465, 0xafb50cae, 0x6d553c7a, 0xd639efe3, 0x19a7b895, 0x9aba5b21, 0x5417d6d4,
     0x35fd2b84, 0xd1f6a159, 0x3f8e323f, 0xb419551c, 0xf444cebf, 0x21dc3b80, 0xde8d1e36, 0x84a32436,
@@ -92,8 +94,6 @@ static uint32_t table_base[] =
     0xc5ae37bb, 0xa76ce12a, 0x8150d8f3, 0x2ec29218, 0xa35f0984, 0x48c0647e, 0x0b5ff98c, 0x71893f7b
 };
 
-#define BARREL_SHIFT(v, shift) ( ((v) << (shift)) | ((v) >> ((32U - (shift)) & 0x1fU)) )
-
 uint32_t buzhash(const uint8_t *data, uint32_t len)
 {
     uint32_t i;
@@ -101,16 +101,10 @@ uint32_t buzhash(const uint8_t *data, uint32_t len)
     for (i = len - 1; i > 0; i--)
     {
         imod = i & 0x1fU;
-        sum ^= BARREL_SHIFT(table_base[*data], imod);
+        sum ^= barrel_shift(buzhash_table[*data], imod);
         data++;
     }
-    return sum ^ table_base[*data];
-}
-
-uint32_t buzhash_update(uint32_t sum, uint8_t remove, uint8_t add, uint32_t len)
-{
-    uint32_t lenmod = len & 0x1fU;  /* Note: replace by constant to get small speedup */
-    return BARREL_SHIFT(sum, 1U) ^ BARREL_SHIFT(table_base[remove], lenmod) ^ table_base[add];
+    return sum ^ buzhash_table[*data];
 }
 
 uint64_t fnv64a(const uint8_t* data, size_t length, uint64_t hash)
@@ -128,6 +122,68 @@ uint64_t fnv64a(const uint8_t* data, size_t length, uint64_t hash)
     return hash;
 }
 
+uint64_t fnv64a_zeros(uint64_t length, uint64_t hash)
+{
+    // Xor with zero byte is a no-op, therefore hashing `length` zeros is multiplication by prime^length.
+    uint64_t factor = 1099511628211UL;
+    for (; length > 0; length >>= 1U)
+    {
+        if (length & 1U)
+            hash *= factor;
+        factor *= factor;
+    }
+    return hash;
+}
+
+uint64_t fnv64a_combine(const uint64_t* hashes, size_t count, uint64_t hash)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t bytes[8];
+        for (unsigned b = 0; b < 8; b++)
+            bytes[b] = static_cast<uint8_t>(hashes[i] >> (b * 8U));
+        hash = fnv64a(bytes, sizeof(bytes), hash);
+    }
+    return hash;
+}
+
+uint64_t block_hash(const uint8_t* data, size_t length, size_t leaf_size)
+{
+    if (leaf_size == 0)
+        return fnv64a(data, length);
+
+    auto hash = fnv64a(nullptr, 0);
+    for (size_t offset = 0; offset < length; offset += leaf_size)
+    {
+        auto leaf = fnv64a(data + offset, std::min(leaf_size, length - offset));
+        hash = fnv64a_combine(&leaf, 1, hash);
+    }
+    return hash;
+}
+
+uint64_t block_hash_zeros(uint64_t length, size_t leaf_size)
+{
+    if (leaf_size == 0)
+        return fnv64a_zeros(length);
+
+    auto hash = fnv64a(nullptr, 0);
+    auto leaf = fnv64a_zeros(leaf_size);
+    for (auto count = length / leaf_size; count > 0; count--)
+        hash = fnv64a_combine(&leaf, 1, hash);
+    if (length % leaf_size)
+    {
+        leaf = fnv64a_zeros(length % leaf_size);
+        hash = fnv64a_combine(&leaf, 1, hash);
+    }
+    return hash;
+}
+
 }   // detail
 
+bool is_zero_block(const Boundary& block, const Parameters* parameters)
+{
+    auto leaf_size = parameters != nullptr ? parameters->hash_leaf_size : 0;
+    return block.hash == detail::block_hash_zeros(static_cast<uint64_t>(block.length), leaf_size);
+}
+
 }   // zinc
@@ -0,0 +1,810 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#if !_WIN32
+#   include <sys/socket.h>
+#   include <sys/time.h>
+#   include <netdb.h>
+#   include <netinet/in.h>
+#   include <netinet/tcp.h>
+#   include <unistd.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include "zinc/http.h"
+
+namespace zinc
+{
+
+bool is_http_url(const std::string& url)
+{
+    return url.compare(0, 7, "http://") == 0;
+}
+
+#if !_WIN32
+
+/// Reads larger than this are split between connections.
+const int64_t min_parallel_piece = 256 * 1024;
+/// Maximal number of ranges requested at once, keeps request within header size limits of common servers.
+const size_t max_ranges_per_request = 64;
+/// Size of receive buffer of a connection. Larger reads are received directly into destination buffers.
+const size_t receive_buffer_size = 64 * 1024;
+/// Unread remainder of a response larger than this closes the connection instead of being read and discarded.
+const int64_t max_drain_size = 256 * 1024;
+/// Maximal length of a line of response headers.
+const size_t max_line_length = 16 * 1024;
+
+/// Components of an http url.
+struct Url
+{
+    std::string host;
+    std::string port;
+    std::string path;
+    /// Value of `Host` header.
+    std::string authority;
+};
+
+bool parse_url(const std::string& url, Url& result)
+{
+    if (!is_http_url(url))
+        return false;
+
+    auto path_start = url.find('/', 7);
+    result.authority = url.substr(7, path_start == std::string::npos ? std::string::npos : path_start - 7);
+    result.path = path_start == std::string::npos ? "/" : url.substr(path_start);
+    result.port = "80";
+    auto host = result.authority;
+    auto port_separator = host.rfind(':');
+    if (!host.empty() && host[0] == '[')
+    {
+        // IPv6 address
+        auto end = host.find(']');
+        if (end == std::string::npos)
+            return false;
+        if (end + 1 < host.size() && host[end + 1] == ':')
+            result.port = host.substr(end + 2);
+        host = host.substr(1, end - 1);
+    }
+    else if (port_separator != std::string::npos)
+    {
+        result.port = host.substr(port_separator + 1);
+        host = host.substr(0, port_separator);
+    }
+    result.host = host;
+    return !result.host.empty() && !result.port.empty() &&
+        result.port.find_first_not_of("0123456789") == std::string::npos;
+}
+
+/// Compare header name ignoring case.
+bool name_equals(const std::string& a, const char* b)
+{
+    auto same_letter = [](char x, char y) { return tolower(x) == tolower(y); };
+    return a.size() == strlen(b) && std::equal(a.begin(), a.end(), b, same_letter);
+}
+
+/// Parse `bytes first-last/size` value of `Content-Range` header.
+bool parse_content_range(const std::string& value, int64_t& first, int64_t& last)
+{
+    long long parsed_first = 0, parsed_last = 0;
+    if (sscanf(value.c_str(), "bytes %lld-%lld", &parsed_first, &parsed_last) != 2 || parsed_first > parsed_last)
+        return false;
+    first = parsed_first;
+    last = parsed_last;
+    return true;
+}
+
+/// Headers of a response.
+struct Response
+{
+    int status = 0;
+    bool keep_alive = false;
+    std::string content_type;
+    std::string content_range;
+};
+
+/// Persistent connection to http server. Response bodies are read in a streaming manner.
+class HttpConnection
+{
+public:
+    HttpConnection(const Url& url, std::chrono::milliseconds timeout)
+        : url_(url)
+        , timeout_(timeout)
+        , buffer_(receive_buffer_size)
+    {
+    }
+
+    ~HttpConnection()
+    {
+        disconnect();
+    }
+
+    /// Send a GET request with optional `Range` header value and receive response headers. Connection that was closed
+    /// by server while idle is reopened.
+    bool request(const std::string& range, Response& response)
+    {
+        std::string text = "GET " + url_.path + " HTTP/1.1\r\nHost: " + url_.authority + "\r\n";
+        if (!range.empty())
+            text += "Range: bytes=" + range + "\r\n";
+        text += "\r\n";
+
+        for (int attempt = 0; attempt < 2; attempt++)
+        {
+            bool reused = fd_ >= 0;
+            if (!reused && !connect_socket())
+                return false;
+            if (send_all(text) && read_headers(response))
+                return true;
+            disconnect();
+            if (!reused)
+                return false;
+        }
+        return false;
+    }
+
+    /// Read up to `length` bytes of response body. Returns 0 at the end of body or on failure, see failed().
+    size_t read_some(uint8_t* data, size_t length)
+    {
+        if (chunked_)
+        {
+            if (chunk_remaining_ == 0)
+            {
+                if (body_finished_ || !next_chunk() || body_finished_)
+                    return 0;
+            }
+            auto received = raw_read(data, static_cast<size_t>(std::min<int64_t>(length, chunk_remaining_)));
+            chunk_remaining_ -= static_cast<int64_t>(received);
+            return received;
+        }
+        if (body_remaining_ >= 0)
+        {
+            auto received = raw_read(data, static_cast<size_t>(std::min<int64_t>(length, body_remaining_)));
+            body_remaining_ -= static_cast<int64_t>(received);
+            if (received == 0 && length > 0 && body_remaining_ > 0)
+                failed_ = true;
+            return received;
+        }
+        return raw_read(data, length);                  // Body ends when connection is closed
+    }
+
+    /// Read exactly `length` bytes of response body.
+    bool read(uint8_t* data, size_t length)
+    {
+        while (length > 0)
+        {
+            auto received = read_some(data, length);
+            if (received == 0)
+                return false;
+            data += received;
+            length -= received;
+        }
+        return true;
+    }
+
+    /// Read a line of response body, without line terminator.
+    bool read_line(std::string& line)
+    {
+        line.clear();
+        uint8_t value = 0;
+        while (read_some(&value, 1) == 1)
+        {
+            if (value == '\n')
+            {
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                return true;
+            }
+            if (line.size() >= max_line_length)
+                return false;
+            line += static_cast<char>(value);
+        }
+        return false;
+    }
+
+    /// Finish reading response. Connection is kept open for next request when rest of response is small enough to be
+    /// discarded, otherwise it is closed.
+    void finish(bool success)
+    {
+        if (success && keep_alive_ && !failed_ &&
+            (chunked_ || (body_remaining_ >= 0 && body_remaining_ <= max_drain_size)))
+        {
+            uint8_t discarded[4096];
+            int64_t drained = 0;
+            while (drained <= max_drain_size)
+            {
+                auto received = read_some(discarded, sizeof(discarded));
+                if (received == 0)
+                    break;
+                drained += static_cast<int64_t>(received);
+            }
+            if (!failed_ && drained <= max_drain_size && (chunked_ ? body_finished_ : body_remaining_ == 0))
+                return;
+        }
+        disconnect();
+    }
+
+    bool failed() const { return failed_; }
+
+    /// Abort request in progress from another thread.
+    void abort()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (fd_ >= 0)
+            shutdown(fd_, SHUT_RDWR);
+    }
+
+protected:
+    bool connect_socket()
+    {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(url_.host.c_str(), url_.port.c_str(), &hints, &addresses) != 0)
+            return false;
+
+        timeval timeout{};
+        timeout.tv_sec = static_cast<time_t>(timeout_.count() / 1000);
+        timeout.tv_usec = static_cast<suseconds_t>(timeout_.count() % 1000 * 1000);
+        int fd = -1;
+        for (auto* info = addresses; info != nullptr && fd < 0; info = info->ai_next)
+        {
+            fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+            if (fd < 0)
+                continue;
+            int enable = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            if (connect(fd, info->ai_addr, info->ai_addrlen) != 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        fd_ = fd;
+        begin_ = end_ = 0;
+        return fd_ >= 0;
+    }
+
+    void disconnect()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (fd_ >= 0)
+            close(fd_);
+        fd_ = -1;
+        begin_ = end_ = 0;
+    }
+
+    bool send_all(const std::string& text)
+    {
+        for (size_t sent = 0; sent < text.size();)
+        {
+            auto result = send(fd_, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+            if (result < 0 && errno == EINTR)
+                continue;
+            if (result <= 0)
+                return false;
+            sent += static_cast<size_t>(result);
+        }
+        return true;
+    }
+
+    /// Read from receive buffer, or directly from socket when buffer is empty and read is large.
+    size_t raw_read(uint8_t* data, size_t length)
+    {
+        if (length == 0)
+            return 0;
+        if (begin_ == end_)
+        {
+            if (length >= buffer_.size() / 2)
+                return receive(data, length);
+            begin_ = 0;
+            end_ = receive(buffer_.data(), buffer_.size());
+            if (end_ == 0)
+                return 0;
+        }
+        auto result = std::min(length, end_ - begin_);
+        memcpy(data, &buffer_[begin_], result);
+        begin_ += result;
+        return result;
+    }
+
+    size_t receive(uint8_t* data, size_t length)
+    {
+        for (;;)
+        {
+            auto result = recv(fd_, data, length, 0);
+            if (result < 0 && errno == EINTR)
+                continue;
+            if (result <= 0)
+            {
+                // Connection closed, failed or timed out.
+                if (result < 0 || body_remaining_ >= 0 || chunked_)
+                    failed_ = true;
+                return 0;
+            }
+            return static_cast<size_t>(result);
+        }
+    }
+
+    /// Read a line of response headers.
+    bool raw_line(std::string& line)
+    {
+        line.clear();
+        uint8_t value = 0;
+        while (raw_read(&value, 1) == 1)
+        {
+            if (value == '\n')
+            {
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                return true;
+            }
+            if (line.size() >= max_line_length)
+                return false;
+            line += static_cast<char>(value);
+        }
+        return false;
+    }
+
+    bool read_headers(Response& response)
+    {
+        failed_ = false;
+        chunked_ = false;
+        body_finished_ = false;
+        chunk_remaining_ = 0;
+        body_remaining_ = -1;
+
+        std::string line;
+        if (!raw_line(line) || line.compare(0, 5, "HTTP/") != 0 || line.size() < 12)
+            return false;
+        response = Response();
+        response.status = atoi(line.c_str() + 9);
+        response.keep_alive = line.compare(0, 8, "HTTP/1.1") == 0;
+
+        int64_t content_length = -1;
+        while (raw_line(line) && !line.empty())
+        {
+            auto colon = line.find(':');
+            if (colon == std::string::npos)
+                continue;
+            auto name = line.substr(0, colon);
+            auto value_start = line.find_first_not_of(" \t", colon + 1);
+            auto value = value_start == std::string::npos ? std::string() : line.substr(value_start);
+            if (name_equals(name, "content-length"))
+                content_length = std::strtoll(value.c_str(), nullptr, 10);
+            else if (name_equals(name, "transfer-encoding"))
+                chunked_ = value.find("chunked") != std::string::npos;
+            else if (name_equals(name, "content-type"))
+                response.content_type = value;
+            else if (name_equals(name, "content-range"))
+                response.content_range = value;
+            else if (name_equals(name, "connection"))
+            {
+                response.keep_alive = name_equals(value, "keep-alive") ||
+                    (response.keep_alive && !name_equals(value, "close"));
+            }
+        }
+        if (!line.empty())
+            return false;
+
+        if (!chunked_)
+            body_remaining_ = content_length;
+        if (!chunked_ && content_length < 0)
+            response.keep_alive = false;                // Body ends when connection is closed
+        keep_alive_ = response.keep_alive;
+        return true;
+    }
+
+    /// Read header of next chunk of chunked body.
+    bool next_chunk()
+    {
+        // Data of previous chunk is followed by a line break.
+        std::string line;
+        if ((chunk_started_ && (!raw_line(line) || !line.empty())) || !raw_line(line) || line.empty())
+        {
+            failed_ = true;
+            return false;
+        }
+        chunk_remaining_ = std::strtoll(line.c_str(), nullptr, 16);
+        chunk_started_ = true;
+        if (chunk_remaining_ == 0)
+        {
+            // Trailers end with an empty line.
+            while (raw_line(line) && !line.empty()) { }
+            body_finished_ = true;
+            chunk_started_ = false;
+        }
+        return true;
+    }
+
+    const Url& url_;
+    std::chrono::milliseconds timeout_;
+    std::mutex mutex_;
+    int fd_ = -1;
+    std::vector<uint8_t> buffer_;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+    bool keep_alive_ = false;
+    bool failed_ = false;
+    /// Remaining bytes of response body, -1 when body is chunked or ends with connection.
+    int64_t body_remaining_ = -1;
+    bool chunked_ = false;
+    bool chunk_started_ = false;
+    int64_t chunk_remaining_ = 0;
+    bool body_finished_ = false;
+};
+
+/// Writes received data to ranges it belongs to.
+class RangeWriter
+{
+public:
+    RangeWriter(const RemoteRange* ranges, size_t count)
+        : ranges_(ranges)
+        , count_(count)
+        , written_(count, 0)
+    {
+    }
+
+    /// Receive bytes `first` to `last` of remote file from connection.
+    bool receive(HttpConnection& connection, int64_t first, int64_t last)
+    {
+        for (auto offset = first; offset <= last;)
+        {
+            // Data is received directly into range containing it, data not belonging to any range is discarded.
+            const RemoteRange* target = nullptr;
+            auto piece_end = last + 1;
+            for (size_t i = 0; i < count_; i++)
+            {
+                auto end = ranges_[i].offset + static_cast<int64_t>(ranges_[i].length);
+                if (ranges_[i].offset <= offset && offset < end && target == nullptr)
+                {
+                    target = &ranges_[i];
+                    piece_end = std::min(piece_end, end);
+                }
+                else if (ranges_[i].offset > offset)
+                    piece_end = std::min(piece_end, ranges_[i].offset);
+            }
+
+            auto length = static_cast<size_t>(piece_end - offset);
+            if (target != nullptr)
+            {
+                auto* data = target->buffer + (offset - target->offset);
+                if (!connection.read(data, length))
+                    return false;
+                copy(offset, data, length);
+            }
+            else
+            {
+                uint8_t discarded[4096];
+                length = std::min(length, sizeof(discarded));
+                if (!connection.read(discarded, length))
+                    return false;
+            }
+            offset += static_cast<int64_t>(length);
+        }
+        return true;
+    }
+
+    /// Returns true when all ranges were written.
+    bool complete() const
+    {
+        for (size_t i = 0; i < count_; i++)
+        {
+            if (written_[i] < ranges_[i].length)
+                return false;
+        }
+        return true;
+    }
+
+protected:
+    /// Copy received data to all ranges overlapping it.
+    void copy(int64_t offset, const uint8_t* data, size_t length)
+    {
+        auto end = offset + static_cast<int64_t>(length);
+        for (size_t i = 0; i < count_; i++)
+        {
+            auto range_end = ranges_[i].offset + static_cast<int64_t>(ranges_[i].length);
+            auto from = std::max(offset, ranges_[i].offset);
+            auto to = std::min(end, range_end);
+            if (from >= to)
+                continue;
+            auto* destination = ranges_[i].buffer + (from - ranges_[i].offset);
+            if (destination != data + (from - offset))
+                memcpy(destination, data + (from - offset), static_cast<size_t>(to - from));
+            written_[i] += static_cast<size_t>(to - from);
+        }
+    }
+
+    const RemoteRange* ranges_;
+    size_t count_;
+    std::vector<size_t> written_;
+};
+
+/// Receive parts of `multipart/byteranges` response.
+bool receive_multipart(HttpConnection& connection, const std::string& content_type, RangeWriter& writer)
+{
+    auto boundary_start = content_type.find("boundary=");
+    if (boundary_start == std::string::npos)
+        return false;
+    auto boundary = content_type.substr(boundary_start + 9);
+    boundary = boundary.substr(0, boundary.find(';'));
+    if (boundary.size() >= 2 && boundary.front() == '"' && boundary.back() == '"')
+        boundary = boundary.substr(1, boundary.size() - 2);
+    auto delimiter = "--" + boundary;
+
+    std::string line;
+    do
+    {
+        if (!connection.read_line(line))
+            return false;
+    } while (line != delimiter);                        // Preamble is skipped
+
+    for (;;)
+    {
+        int64_t first = 0, last = -1;
+        while (connection.read_line(line) && !line.empty())
+        {
+            auto colon = line.find(':');
+            if (colon != std::string::npos && name_equals(line.substr(0, colon), "content-range"))
+                parse_content_range(line.substr(line.find_first_not_of(" \t", colon + 1)), first, last);
+        }
+        if (!line.empty() || last < first || !writer.receive(connection, first, last))
+            return false;
+
+        // Data is followed by a line break and next delimiter.
+        if (!connection.read_line(line) || !line.empty() || !connection.read_line(line))
+            return false;
+        if (line == delimiter + "--")
+            return true;
+        if (line != delimiter)
+            return false;
+    }
+}
+
+struct HttpSource::State
+{
+    Url url;
+    bool valid = false;
+    std::chrono::milliseconds timeout;
+    std::vector<std::unique_ptr<HttpConnection>> connections;
+    std::mutex mutex;
+
+    HttpConnection& connection(size_t index)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!connections[index])
+            connections[index].reset(new HttpConnection(url, timeout));
+        return *connections[index];
+    }
+
+    /// Request ranges with a single request.
+    bool fetch(HttpConnection& connection, const RemoteRange* ranges, size_t count)
+    {
+        // Adjacent and overlapping ranges are requested as one range.
+        std::vector<std::pair<int64_t, int64_t>> requested;
+        for (size_t i = 0; i < count; i++)
+            requested.emplace_back(ranges[i].offset, ranges[i].offset + static_cast<int64_t>(ranges[i].length));
+        std::sort(requested.begin(), requested.end());
+        std::string header;
+        for (size_t i = 0; i < requested.size();)
+        {
+            auto first = requested[i].first;
+            auto end = requested[i].second;
+            for (i++; i < requested.size() && requested[i].first <= end; i++)
+                end = std::max(end, requested[i].second);
+            header += (header.empty() ? "" : ",") + std::to_string(first) + "-" + std::to_string(end - 1);
+        }
+
+        Response response;
+        if (!connection.request(header, response))
+            return false;
+
+        RangeWriter writer(ranges, count);
+        bool success = false;
+        int64_t first = 0, last = 0;
+        if (response.status == 206 && response.content_type.compare(0, 20, "multipart/byteranges") == 0)
+            success = receive_multipart(connection, response.content_type, writer);
+        else if (response.status == 206)
+        {
+            success = parse_content_range(response.content_range, first, last) &&
+                writer.receive(connection, first, last);
+        }
+        else if (response.status == 200)
+        {
+            // Server ignored ranges and sends entire file, it is received until requested ranges are complete.
+            success = writer.receive(connection, 0, requested.back().second - 1);
+        }
+        success = success && writer.complete();
+        connection.finish(success);
+        return success;
+    }
+};
+
+HttpSource::HttpSource(const std::string& url, size_t connections, std::chrono::milliseconds timeout)
+    : state_(new State())
+{
+    state_->valid = parse_url(url, state_->url);
+    state_->timeout = timeout;
+    state_->connections.resize(std::max<size_t>(connections, 1));
+}
+
+HttpSource::~HttpSource() = default;
+
+bool HttpSource::valid() const
+{
+    return state_->valid;
+}
+
+bool HttpSource::read(int64_t offset, uint8_t* buffer, size_t length)
+{
+    // Large reads are split between connections.
+    auto pieces = std::min<size_t>(state_->connections.size(), std::max<size_t>(length / min_parallel_piece, 1));
+    std::vector<RemoteRange> ranges;
+    size_t done = 0;
+    for (size_t i = 0; i < pieces; i++)
+    {
+        auto piece = i + 1 == pieces ? length - done : length / pieces;
+        ranges.push_back(RemoteRange{offset + static_cast<int64_t>(done), buffer + done, piece});
+        done += piece;
+    }
+    return read_ranges(ranges);
+}
+
+bool HttpSource::read_ranges(const std::vector<RemoteRange>& ranges)
+{
+    auto& state = *state_;
+    if (!state.valid)
+        return false;
+
+    std::vector<RemoteRange> requested;
+    size_t total = 0;
+    for (const auto& range : ranges)
+    {
+        if (range.length > 0)
+        {
+            requested.push_back(range);
+            total += range.length;
+        }
+    }
+    if (requested.empty())
+        return true;
+
+    // Ranges are split to groups of similar size, every group is fetched by it's own connection.
+    auto num_groups = std::min(state.connections.size(), requested.size());
+    num_groups = std::min<size_t>(num_groups, std::max<size_t>(total / min_parallel_piece, 1));
+    std::vector<size_t> group_starts{0};
+    size_t accumulated = 0;
+    for (size_t i = 0; i < requested.size() && group_starts.size() < num_groups; i++)
+    {
+        accumulated += requested[i].length;
+        if (accumulated * num_groups >= total * group_starts.size() && i + 1 < requested.size())
+            group_starts.push_back(i + 1);
+    }
+    group_starts.push_back(requested.size());
+
+    std::atomic<bool> success{true};
+    auto fetch_group = [&](size_t group)
+    {
+        auto& connection = state.connection(group);
+        for (auto i = group_starts[group]; i < group_starts[group + 1] && success; i += max_ranges_per_request)
+        {
+            auto count = std::min(max_ranges_per_request, group_starts[group + 1] - i);
+            if (!state.fetch(connection, &requested[i], count))
+                success = false;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t group = 1; group + 1 < group_starts.size(); group++)
+        threads.emplace_back(fetch_group, group);
+    fetch_group(0);
+    for (auto& thread : threads)
+        thread.join();
+    return success;
+}
+
+void HttpSource::cancel()
+{
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    for (auto& connection : state_->connections)
+    {
+        if (connection)
+            connection->abort();
+    }
+}
+
+bool HttpSource::get(std::string& data)
+{
+    if (!state_->valid)
+        return false;
+
+    auto& connection = state_->connection(0);
+    Response response;
+    if (!connection.request(std::string(), response))
+        return false;
+
+    data.clear();
+    uint8_t buffer[16 * 1024];
+    while (auto received = connection.read_some(buffer, sizeof(buffer)))
+        data.append(reinterpret_cast<const char*>(buffer), received);
+    auto success = response.status == 200 && !connection.failed();
+    connection.finish(success);
+    return success;
+}
+
+#else
+
+struct HttpSource::State
+{
+};
+
+HttpSource::HttpSource(const std::string& url, size_t connections, std::chrono::milliseconds timeout)
+    : state_(new State())
+{
+    (void)url;
+    (void)connections;
+    (void)timeout;
+}
+
+HttpSource::~HttpSource() = default;
+
+bool HttpSource::valid() const
+{
+    return false;
+}
+
+bool HttpSource::read(int64_t offset, uint8_t* buffer, size_t length)
+{
+    (void)offset;
+    (void)buffer;
+    (void)length;
+    return false;
+}
+
+bool HttpSource::read_ranges(const std::vector<RemoteRange>& ranges)
+{
+    (void)ranges;
+    return false;
+}
+
+void HttpSource::cancel()
+{
+}
+
+bool HttpSource::get(std::string& data)
+{
+    (void)data;
+    return false;
+}
+
+#endif
+
+}
@@ -0,0 +1,760 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#if __linux__
+#   include <sys/epoll.h>
+#   include <sys/eventfd.h>
+#   include <sys/sendfile.h>
+#   include <sys/socket.h>
+#   include <sys/stat.h>
+#   include <netdb.h>
+#   include <netinet/in.h>
+#   include <netinet/tcp.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include "zinc/http.h"
+
+namespace zinc
+{
+
+#if __linux__
+
+using Clock = std::chrono::steady_clock;
+
+/// Maximal size of request headers.
+const size_t max_request_size = 64 * 1024;
+/// Maximal number of bytes sent by one sendfile() call.
+const size_t max_sendfile_size = 1024 * 1024 * 1024;
+/// Requests with more ranges are answered with entire file.
+const size_t max_range_count = 64;
+/// Separator of parts of multipart responses.
+const char* multipart_boundary = "zinc-byteranges-7d0f3a";
+
+/// Descriptor of an open file, closed when last part of response using it is sent.
+struct OpenFile
+{
+    explicit OpenFile(int descriptor) : fd(descriptor) { }
+    ~OpenFile() { close(fd); }
+    int fd;
+};
+
+/// Part of a response, either a text or a range of a file.
+struct Segment
+{
+    std::string text;
+    size_t text_sent = 0;
+    std::shared_ptr<OpenFile> file;
+    off_t offset = 0;
+    int64_t remaining = 0;
+};
+
+/// Range of bytes, both ends inclusive.
+struct ByteRange
+{
+    int64_t first;
+    int64_t last;
+};
+
+struct Connection
+{
+    int fd = -1;
+    /// Received data that was not processed yet.
+    std::string input;
+    /// Response being sent.
+    std::deque<Segment> output;
+    /// Connection is closed once response is sent.
+    bool close_after_response = false;
+    /// Connection waits for socket to become writable.
+    bool waiting_writable = false;
+    Clock::time_point last_activity;
+};
+
+/// Compare header name ignoring case.
+bool header_equals(const std::string& a, const char* b)
+{
+    auto same_letter = [](char x, char y) { return tolower(x) == tolower(y); };
+    return a.size() == strlen(b) && std::equal(a.begin(), a.end(), b, same_letter);
+}
+
+/// Trim whitespace at both ends of a string.
+std::string trim(const std::string& value)
+{
+    auto first = value.find_first_not_of(" \t");
+    if (first == std::string::npos)
+        return std::string();
+    return value.substr(first, value.find_last_not_of(" \t") - first + 1);
+}
+
+/// Parse value of `Range` header for a file of `file_size` bytes. Unsatisfiable ranges are dropped, overlapping and
+/// adjacent ranges are merged, therefore no byte is sent twice. Returns false when header is not valid or has more than
+/// `max_range_count` ranges, in which case it is ignored.
+bool parse_ranges(const std::string& header, int64_t file_size, std::vector<ByteRange>& ranges)
+{
+    ranges.clear();
+    auto value = trim(header);
+    if (value.compare(0, 6, "bytes=") != 0)
+        return false;
+
+    size_t count = 0;
+    for (size_t position = 6; position <= value.size();)
+    {
+        if (++count > max_range_count)
+        {
+            ranges.clear();
+            return false;
+        }
+
+        auto end = value.find(',', position);
+        if (end == std::string::npos)
+            end = value.size();
+        auto spec = trim(value.substr(position, end - position));
+        position = end + 1;
+
+        auto dash = spec.find('-');
+        if (dash == std::string::npos || spec.find_first_not_of("0123456789-") != std::string::npos)
+        {
+            ranges.clear();
+            return false;
+        }
+        auto first_text = spec.substr(0, dash);
+        auto last_text = spec.substr(dash + 1);
+        if ((first_text.empty() && last_text.empty()) || last_text.find('-') != std::string::npos ||
+            first_text.size() > 18 || last_text.size() > 18)
+        {
+            ranges.clear();
+            return false;
+        }
+
+        ByteRange range{};
+        if (first_text.empty())
+        {
+            // Suffix of the file.
+            auto length = std::stoll(last_text);
+            if (length == 0)
+                continue;
+            range.first = std::max<int64_t>(file_size - length, 0);
+            range.last = file_size - 1;
+        }
+        else
+        {
+            range.first = std::stoll(first_text);
+            range.last = last_text.empty() ? file_size - 1 : std::min<int64_t>(std::stoll(last_text), file_size - 1);
+            if (!last_text.empty() && std::stoll(last_text) < range.first)
+            {
+                ranges.clear();
+                return false;
+            }
+        }
+        if (range.first < file_size && range.first <= range.last)
+            ranges.push_back(range);
+    }
+
+    std::sort(ranges.begin(), ranges.end(), [](const ByteRange& a, const ByteRange& b) { return a.first < b.first; });
+    size_t merged = 0;
+    for (size_t i = 1; i < ranges.size(); i++)
+    {
+        if (ranges[i].first <= ranges[merged].last + 1)
+            ranges[merged].last = std::max(ranges[merged].last, ranges[i].last);
+        else
+            ranges[++merged] = ranges[i];
+    }
+    if (!ranges.empty())
+        ranges.resize(merged + 1);
+    return true;
+}
+
+/// Decode percent-encoded characters of request path. Returns false when path is not valid.
+bool decode_path(const std::string& target, std::string& path)
+{
+    auto end = target.find_first_of("?#");
+    auto encoded = target.substr(0, end);
+    if (encoded.empty() || encoded[0] != '/')
+        return false;
+
+    path.clear();
+    for (size_t i = 0; i < encoded.size(); i++)
+    {
+        if (encoded[i] == '%')
+        {
+            if (i + 2 >= encoded.size() || !isxdigit(encoded[i + 1]) || !isxdigit(encoded[i + 2]))
+                return false;
+            path += static_cast<char>(std::stoi(encoded.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        }
+        else
+            path += encoded[i];
+    }
+
+    // Files outside of root directory are not served.
+    if (path.find('\0') != std::string::npos)
+        return false;
+    for (size_t position = 0; position < path.size();)
+    {
+        auto next = path.find('/', position + 1);
+        if (next == std::string::npos)
+            next = path.size();
+        if (path.compare(position, next - position, "/..") == 0)
+            return false;
+        position = next;
+    }
+    return true;
+}
+
+struct HttpServer::State
+{
+    std::string root;
+    std::chrono::milliseconds idle_timeout;
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    uint16_t port = 0;
+    std::atomic<bool> stopping{false};
+    std::unordered_map<int, Connection> connections;
+
+    ~State()
+    {
+        for (auto& connection : connections)
+            close(connection.first);
+        for (int fd : {listen_fd, epoll_fd, wake_fd})
+        {
+            if (fd >= 0)
+                close(fd);
+        }
+    }
+
+    void accept_connections()
+    {
+        for (;;)
+        {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+                return;                                 // No more pending connections, or out of descriptors
+
+            int enable = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.fd = fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+            {
+                close(fd);
+                continue;
+            }
+            auto& connection = connections[fd];
+            connection.fd = fd;
+            connection.last_activity = Clock::now();
+        }
+    }
+
+    void close_connection(Connection& connection)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection.fd, nullptr);
+        close(connection.fd);
+        connections.erase(connection.fd);
+    }
+
+    void respond_error(Connection& connection, int status, const char* reason, const std::string& extra_headers = "")
+    {
+        std::string body = std::to_string(status) + " " + reason + "\n";
+        Segment segment;
+        segment.text = "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\nServer: zinc\r\n" + extra_headers +
+            "Content-Type: text/plain\r\nContent-Length: " + std::to_string(body.size()) + "\r\n" +
+            (connection.close_after_response ? "Connection: close\r\n" : "") + "\r\n" + body;
+        connection.output.push_back(std::move(segment));
+    }
+
+    /// Parse one request from input of connection and queue it's response. Returns false when input does not hold a
+    /// complete request yet.
+    bool process_request(Connection& connection)
+    {
+        auto header_end = connection.input.find("\r\n\r\n");
+        if (header_end == std::string::npos)
+        {
+            if (connection.input.size() > max_request_size)
+            {
+                connection.close_after_response = true;
+                respond_error(connection, 431, "Request Header Fields Too Large");
+                connection.input.clear();
+                return true;
+            }
+            return false;
+        }
+        auto request = connection.input.substr(0, header_end);
+        connection.input.erase(0, header_end + 4);
+
+        // Request line
+        auto line_end = request.find("\r\n");
+        auto request_line = request.substr(0, line_end);
+        auto method_end = request_line.find(' ');
+        auto target_end = request_line.find(' ', method_end + 1);
+        if (method_end == std::string::npos || target_end == std::string::npos)
+        {
+            connection.close_after_response = true;
+            respond_error(connection, 400, "Bad Request");
+            return true;
+        }
+        auto method = request_line.substr(0, method_end);
+        auto target = request_line.substr(method_end + 1, target_end - method_end - 1);
+        auto version = request_line.substr(target_end + 1);
+
+        // Headers
+        std::string range_header, connection_header;
+        bool has_range = false, has_body = false;
+        for (auto position = line_end; position != std::string::npos && position < request.size();)
+        {
+            auto start = position + 2;
+            position = request.find("\r\n", start);
+            auto line = request.substr(start, position == std::string::npos ? std::string::npos : position - start);
+            auto colon = line.find(':');
+            if (colon == std::string::npos)
+                continue;
+            auto name = line.substr(0, colon);
+            auto value = trim(line.substr(colon + 1));
+            if (header_equals(name, "range"))
+            {
+                range_header = value;
+                has_range = true;
+            }
+            else if (header_equals(name, "connection"))
+                connection_header = value;
+            else if ((header_equals(name, "content-length") && value != "0") ||
+                header_equals(name, "transfer-encoding"))
+                has_body = true;
+        }
+
+        bool keep_alive = version == "HTTP/1.1" ? !header_equals(connection_header, "close") :
+            header_equals(connection_header, "keep-alive");
+        connection.close_after_response = !keep_alive || has_body;
+        if (version != "HTTP/1.1" && version != "HTTP/1.0")
+        {
+            connection.close_after_response = true;
+            respond_error(connection, 505, "HTTP Version Not Supported");
+            return true;
+        }
+        if (has_body)
+        {
+            respond_error(connection, 400, "Bad Request");
+            return true;
+        }
+        bool head = method == "HEAD";
+        if (method != "GET" && !head)
+        {
+            respond_error(connection, 405, "Method Not Allowed", "Allow: GET, HEAD\r\n");
+            return true;
+        }
+
+        std::string path;
+        if (!decode_path(target, path))
+        {
+            respond_error(connection, 400, "Bad Request");
+            return true;
+        }
+        int fd = open((root + path).c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info{};
+        if (fd >= 0 && (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)))
+        {
+            close(fd);
+            fd = -1;
+        }
+        if (fd < 0)
+        {
+            respond_error(connection, 404, "Not Found");
+            return true;
+        }
+        auto file = std::make_shared<OpenFile>(fd);
+        int64_t file_size = info.st_size;
+
+        std::vector<ByteRange> ranges;
+        if (has_range && parse_ranges(range_header, file_size, ranges) && ranges.empty())
+        {
+            respond_error(connection, 416, "Range Not Satisfiable",
+                "Content-Range: bytes */" + std::to_string(file_size) + "\r\n");
+            return true;
+        }
+
+        auto content_type = path.size() > 5 && path.compare(path.size() - 5, 5, ".json") == 0 ? "application/json" :
+            "application/octet-stream";
+        std::string headers = "Server: zinc\r\nAccept-Ranges: bytes\r\n";
+        if (connection.close_after_response)
+            headers += "Connection: close\r\n";
+
+        std::deque<Segment> body;
+        auto add_file = [&](int64_t offset, int64_t length)
+        {
+            if (length == 0)
+                return;
+            Segment segment;
+            segment.file = file;
+            segment.offset = static_cast<off_t>(offset);
+            segment.remaining = length;
+            body.push_back(std::move(segment));
+        };
+        auto add_text = [&](std::string text)
+        {
+            Segment segment;
+            segment.text = std::move(text);
+            body.push_back(std::move(segment));
+        };
+
+        int64_t content_length = 0;
+        std::string status;
+        if (ranges.empty())
+        {
+            status = "200 OK";
+            headers += std::string("Content-Type: ") + content_type + "\r\n";
+            add_file(0, file_size);
+            content_length = file_size;
+        }
+        else if (ranges.size() == 1)
+        {
+            status = "206 Partial Content";
+            headers += std::string("Content-Type: ") + content_type + "\r\nContent-Range: bytes " +
+                std::to_string(ranges[0].first) + "-" + std::to_string(ranges[0].last) + "/" +
+                std::to_string(file_size) + "\r\n";
+            add_file(ranges[0].first, ranges[0].last - ranges[0].first + 1);
+            content_length = ranges[0].last - ranges[0].first + 1;
+        }
+        else
+        {
+            // Every range is a part of multipart body.
+            status = "206 Partial Content";
+            headers += std::string("Content-Type: multipart/byteranges; boundary=") + multipart_boundary + "\r\n";
+            for (size_t i = 0; i < ranges.size(); i++)
+            {
+                auto part = std::string(i == 0 ? "" : "\r\n") + "--" + multipart_boundary + "\r\nContent-Type: " +
+                    content_type + "\r\nContent-Range: bytes " + std::to_string(ranges[i].first) + "-" +
+                    std::to_string(ranges[i].last) + "/" + std::to_string(file_size) + "\r\n\r\n";
+                content_length += static_cast<int64_t>(part.size()) + ranges[i].last - ranges[i].first + 1;
+                add_text(std::move(part));
+                add_file(ranges[i].first, ranges[i].last - ranges[i].first + 1);
+            }
+            auto end = std::string("\r\n--") + multipart_boundary + "--\r\n";
+            content_length += static_cast<int64_t>(end.size());
+            add_text(std::move(end));
+        }
+
+        Segment response;
+        response.text = "HTTP/1.1 " + status + "\r\n" + headers + "Content-Length: " +
+            std::to_string(content_length) + "\r\n\r\n";
+        connection.output.push_back(std::move(response));
+        if (!head)
+        {
+            for (auto& segment : body)
+                connection.output.push_back(std::move(segment));
+        }
+        return true;
+    }
+
+    /// Send queued response. Returns false when connection failed.
+    bool send_output(Connection& connection)
+    {
+        while (!connection.output.empty())
+        {
+            auto& segment = connection.output.front();
+            ssize_t sent = 0;
+            if (segment.file)
+            {
+                sent = sendfile(connection.fd, segment.file->fd, &segment.offset,
+                    static_cast<size_t>(std::min<int64_t>(segment.remaining, max_sendfile_size)));
+                if (sent == 0)
+                    return false;                       // File was truncated while being served
+                if (sent > 0)
+                    segment.remaining -= sent;
+            }
+            else
+            {
+                // Headers are sent together with data following them.
+                int flags = MSG_NOSIGNAL | (connection.output.size() > 1 ? MSG_MORE : 0);
+                sent = send(connection.fd, segment.text.data() + segment.text_sent,
+                    segment.text.size() - segment.text_sent, flags);
+
+                if (sent > 0)
+                    segment.text_sent += static_cast<size_t>(sent);
+            }
+
+            if (sent < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    return false;
+                set_writable_wait(connection, true);
+                return true;
+            }
+            connection.last_activity = Clock::now();
+            if (segment.file ? segment.remaining == 0 : segment.text_sent == segment.text.size())
+                connection.output.pop_front();
+        }
+        set_writable_wait(connection, false);
+        return true;
+    }
+
+    void set_writable_wait(Connection& connection, bool writable)
+    {
+        if (connection.waiting_writable == writable)
+            return;
+        epoll_event event{};
+        event.events = writable ? EPOLLOUT : EPOLLIN | EPOLLRDHUP;
+        event.data.fd = connection.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+        connection.waiting_writable = writable;
+    }
+
+    /// Serve requests received on connection. Returns false when connection must be closed.
+    bool serve(Connection& connection)
+    {
+        // Pipelined requests are served one at a time.
+        while (connection.output.empty())
+        {
+            if (connection.close_after_response || !process_request(connection))
+                break;
+            if (!send_output(connection))
+                return false;
+        }
+        return !(connection.output.empty() && connection.close_after_response);
+    }
+
+    void handle_event(const epoll_event& event)
+    {
+        auto it = connections.find(event.data.fd);
+        if (it == connections.end())
+            return;
+        auto& connection = it->second;
+
+        if (event.events & EPOLLOUT)
+        {
+            if (!send_output(connection))
+            {
+                close_connection(connection);
+                return;
+            }
+        }
+        else if (event.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        {
+            char buffer[16 * 1024];
+            bool peer_closed = false;
+            for (;;)
+            {
+                auto received = recv(connection.fd, buffer, sizeof(buffer), 0);
+                if (received > 0)
+                {
+                    connection.input.append(buffer, static_cast<size_t>(received));
+                    connection.last_activity = Clock::now();
+                    if (connection.input.size() > max_request_size * 2)
+                        break;                          // Too much is pipelined, rest is received later
+                    continue;
+                }
+                if (received < 0 && errno == EINTR)
+                    continue;
+                peer_closed = received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+                break;
+            }
+
+            // Requests received before client closed connection are still answered.
+            if (peer_closed)
+            {
+                if (!serve(connection) || connection.output.empty())
+                    close_connection(connection);
+                else
+                    connection.close_after_response = true;
+                return;
+            }
+        }
+
+        if (!serve(connection))
+            close_connection(connection);
+    }
+
+    void close_idle_connections()
+    {
+        auto now = Clock::now();
+        std::vector<int> idle;
+        for (const auto& connection : connections)
+        {
+            if (now - connection.second.last_activity > idle_timeout)
+                idle.push_back(connection.first);
+        }
+        for (int fd : idle)
+            close_connection(connections[fd]);
+    }
+};
+
+HttpServer::HttpServer(std::string root, std::chrono::milliseconds idle_timeout)
+    : state_(new State())
+{
+    state_->root = std::move(root);
+    state_->idle_timeout = idle_timeout;
+}
+
+HttpServer::~HttpServer() = default;
+
+bool HttpServer::listen(const std::string& address, uint16_t port)
+{
+    auto& state = *state_;
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(address.empty() ? nullptr : address.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+        return false;
+
+    for (auto* info = addresses; info != nullptr && state.listen_fd < 0; info = info->ai_next)
+    {
+        int fd = socket(info->ai_family, info->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, info->ai_protocol);
+        if (fd < 0)
+            continue;
+        int enable = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+        if (bind(fd, info->ai_addr, info->ai_addrlen) != 0 || ::listen(fd, SOMAXCONN) != 0)
+        {
+            close(fd);
+            continue;
+        }
+        state.listen_fd = fd;
+    }
+    freeaddrinfo(addresses);
+    if (state.listen_fd < 0)
+        return false;
+
+    sockaddr_storage bound{};
+    socklen_t length = sizeof(bound);
+    getsockname(state.listen_fd, reinterpret_cast<sockaddr*>(&bound), &length);
+    if (bound.ss_family == AF_INET6)
+        state.port = ntohs(reinterpret_cast<sockaddr_in6*>(&bound)->sin6_port);
+    else
+        state.port = ntohs(reinterpret_cast<sockaddr_in*>(&bound)->sin_port);
+
+    state.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    state.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (state.epoll_fd < 0 || state.wake_fd < 0)
+        return false;
+    for (int fd : {state.listen_fd, state.wake_fd})
+    {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(state.epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+            return false;
+    }
+    return true;
+}
+
+uint16_t HttpServer::port() const
+{
+    return state_->port;
+}
+
+bool HttpServer::run()
+{
+    auto& state = *state_;
+    if (state.epoll_fd < 0)
+        return false;
+
+    const int max_events = 256;
+    epoll_event events[max_events];
+    auto last_sweep = Clock::now();
+    while (!state.stopping.load())
+    {
+        auto count = epoll_wait(state.epoll_fd, events, max_events, 1000);
+        if (count < 0 && errno != EINTR)
+            return false;
+        for (int i = 0; i < count; i++)
+        {
+            if (events[i].data.fd == state.listen_fd)
+                state.accept_connections();
+            else if (events[i].data.fd != state.wake_fd)
+                state.handle_event(events[i]);
+        }
+
+        auto now = Clock::now();
+        if (now - last_sweep > std::chrono::seconds(1))
+        {
+            state.close_idle_connections();
+            last_sweep = now;
+        }
+    }
+    state.stopping = false;
+    uint64_t value = 0;
+    while (read(state.wake_fd, &value, sizeof(value)) > 0) { }
+    return true;
+}
+
+void HttpServer::stop()
+{
+    state_->stopping = true;
+    if (state_->wake_fd >= 0)
+    {
+        uint64_t value = 1;
+        auto written = write(state_->wake_fd, &value, sizeof(value));
+        (void)written;
+    }
+}
+
+#else
+
+struct HttpServer::State
+{
+};
+
+HttpServer::HttpServer(std::string root, std::chrono::milliseconds idle_timeout)
+    : state_(new State())
+{
+    (void)root;
+    (void)idle_timeout;
+}
+
+HttpServer::~HttpServer() = default;
+
+bool HttpServer::listen(const std::string& address, uint16_t port)
+{
+    (void)address;
+    (void)port;
+    return false;
+}
+
+uint16_t HttpServer::port() const
+{
+    return 0;
+}
+
+bool HttpServer::run()
+{
+    return false;
+}
+
+void HttpServer::stop()
+{
+}
+
+#endif
+
+}
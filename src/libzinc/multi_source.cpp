@@ -0,0 +1,396 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <thread>
+#include "zinc/zinc.h"
+
+namespace zinc
+{
+
+using Clock = std::chrono::steady_clock;
+
+/// Number of recent reads whose durations determine when reads are reissued.
+const size_t hedge_history_size = 64;
+/// Number of reads that must be measured before their durations determine when reads are reissued.
+const size_t min_hedge_history_size = 8;
+/// Weight of a new measurement in moving averages.
+const double measurement_weight = 0.25;
+/// Reads of at most this many bytes measure latency, larger reads measure throughput.
+const int64_t latency_read_size = 64 * 1024;
+
+/// Measurements of a source.
+struct SourceState
+{
+    RemoteSource* source = nullptr;
+    /// A read is in progress.
+    bool busy = false;
+    /// Average duration of small reads, in seconds.
+    double latency = 0;
+    /// Average throughput of large reads in bytes per second, 0 when unknown.
+    double throughput = 0;
+    /// True when at least one read succeeded.
+    bool measured = false;
+    /// Number of reads that failed in a row.
+    int failures = 0;
+    /// Number of bytes provided to reader.
+    int64_t bytes = 0;
+
+    /// Returns expected duration of reading `length` bytes in seconds, 0 when source was not measured yet.
+    double expected(int64_t length) const
+    {
+        return latency + (throughput > 0 ? static_cast<double>(length) / throughput : 0);
+    }
+
+    void measure(int64_t length, double duration)
+    {
+        if (length <= latency_read_size)
+            latency = latency > 0 ? latency + (duration - latency) * measurement_weight : duration;
+        else
+        {
+            auto sample = static_cast<double>(length) / std::max(duration - latency, 1e-6);
+            throughput = throughput > 0 ? throughput + (sample - throughput) * measurement_weight : sample;
+        }
+        measured = true;
+    }
+};
+
+/// Read of a piece of data from one source.
+struct Attempt
+{
+    size_t source = 0;
+    int64_t offset = 0;
+    std::vector<uint8_t> data;
+    /// Expected duration of the read, 0 when unknown.
+    double expected = 0;
+    bool finished = false;
+    bool success = false;
+    std::thread thread;
+};
+
+struct MultiSource::State
+{
+    MultiSourceOptions options;
+    std::vector<SourceState> sources;
+    /// Attempts that were started and not joined yet.
+    std::list<std::unique_ptr<Attempt>> attempts;
+    /// Ratios of actual to expected duration of recent reads.
+    std::vector<double> ratios;
+    size_t next_ratio = 0;
+    int64_t hedged_reads = 0;
+    mutable std::mutex mutex;
+    std::condition_variable finished;
+
+    /// Start reading data of `attempt` on a thread.
+    Attempt* start(size_t source, int64_t offset, size_t length)
+    {
+        std::unique_ptr<Attempt> attempt(new Attempt());
+        attempt->source = source;
+        attempt->offset = offset;
+        attempt->data.resize(length);
+        attempt->expected = sources[source].measured ? sources[source].expected(static_cast<int64_t>(length)) : 0;
+        sources[source].busy = true;
+
+        auto* result = attempt.get();
+        auto* remote = sources[source].source;
+        attempt->thread = std::thread([this, result, remote]()
+        {
+            auto start_time = Clock::now();
+            auto success = remote->read(result->offset, result->data.data(), result->data.size());
+            std::chrono::duration<double> duration = Clock::now() - start_time;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            auto& source_state = sources[result->source];
+            source_state.busy = false;
+            if (success)
+            {
+                if (result->expected > 0)
+                    record_ratio(duration.count() / result->expected);
+                source_state.measure(static_cast<int64_t>(result->data.size()), duration.count());
+                source_state.failures = 0;
+            }
+            else
+                source_state.failures++;
+            result->success = success;
+            result->finished = true;
+            finished.notify_all();
+        });
+        attempts.push_back(std::move(attempt));
+        return result;
+    }
+
+    void record_ratio(double ratio)
+    {
+        if (ratios.size() < hedge_history_size)
+            ratios.push_back(ratio);
+        else
+            ratios[next_ratio++ % hedge_history_size] = ratio;
+    }
+
+    /// Returns time after which attempt is reissued on another source.
+    Clock::duration hedge_delay(const Attempt& attempt) const
+    {
+        Clock::duration result = options.initial_hedge_delay;
+        if (attempt.expected > 0 && ratios.size() >= min_hedge_history_size)
+        {
+            auto sorted = ratios;
+            auto index = std::min(sorted.size() - 1, static_cast<size_t>(options.hedge_percentile * sorted.size()));
+            std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+            auto seconds = attempt.expected * std::max(sorted[index], 1.0);
+            result = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+        }
+        return std::max<Clock::duration>(result, options.min_hedge_delay);
+    }
+
+    /// Returns idle source that is expected to read `length` bytes fastest and is not excluded, or sources.size() when
+    /// there is none. Sources that failed recently are picked last, unmeasured sources are picked first.
+    size_t pick(int64_t length, const std::vector<bool>& excluded) const
+    {
+        auto best = sources.size();
+        for (size_t i = 0; i < sources.size(); i++)
+        {
+            if (sources[i].busy || excluded[i])
+                continue;
+            if (best == sources.size() || (sources[i].failures > 0) < (sources[best].failures > 0) ||
+                ((sources[i].failures > 0) == (sources[best].failures > 0) &&
+                 sources[i].expected(length) < sources[best].expected(length)))
+                best = i;
+        }
+        return best;
+    }
+
+    /// Join threads of finished attempts that are no longer used.
+    void reap(const std::vector<Attempt*>& used)
+    {
+        for (auto it = attempts.begin(); it != attempts.end();)
+        {
+            if ((*it)->finished && std::find(used.begin(), used.end(), it->get()) == used.end())
+            {
+                (*it)->thread.join();
+                it = attempts.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+};
+
+MultiSource::MultiSource(std::vector<RemoteSource*> sources, MultiSourceOptions options)
+    : state_(new State())
+{
+    state_->options = options;
+    state_->sources.resize(sources.size());
+    for (size_t i = 0; i < sources.size(); i++)
+        state_->sources[i].source = sources[i];
+}
+
+MultiSource::~MultiSource()
+{
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    for (const auto& attempt : state_->attempts)
+    {
+        if (!attempt->finished)
+            state_->sources[attempt->source].source->cancel();
+    }
+    state_->finished.wait(lock, [&]()
+    {
+        return std::all_of(state_->attempts.begin(), state_->attempts.end(),
+            [](const std::unique_ptr<Attempt>& attempt) { return attempt->finished; });
+    });
+    state_->reap({});
+}
+
+bool MultiSource::read(int64_t offset, uint8_t* buffer, size_t length)
+{
+    struct Request
+    {
+        int64_t offset;
+        uint8_t* buffer;
+        size_t length;
+        /// Source the request is planned for.
+        size_t preferred;
+        /// Sources that were already tried.
+        std::vector<bool> tried;
+        std::vector<Attempt*> attempts;
+        Clock::time_point deadline;
+        bool done;
+    };
+
+    auto& state = *state_;
+    std::unique_lock<std::mutex> lock(state.mutex);
+    if (state.sources.empty())
+        return false;
+    state.reap({});
+
+    // Large reads are split between healthy sources in proportion to their throughput.
+    std::vector<size_t> order;
+    for (size_t i = 0; i < state.sources.size(); i++)
+    {
+        if (state.sources[i].failures == 0)
+            order.push_back(i);
+    }
+    auto max_pieces = static_cast<size_t>(static_cast<int64_t>(length) /
+        std::max<int64_t>(state.options.min_piece_size, 1));
+    if (order.size() > max_pieces)
+    {
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+        {
+            auto piece = static_cast<int64_t>(length);
+            return state.sources[a].expected(piece) < state.sources[b].expected(piece);
+        });
+        order.resize(std::max<size_t>(max_pieces, 1));
+    }
+    if (order.empty())
+        order.push_back(0);
+
+    double known_throughput = 0;
+    size_t known = 0;
+    for (auto index : order)
+    {
+        if (state.sources[index].throughput > 0)
+        {
+            known_throughput += state.sources[index].throughput;
+            known++;
+        }
+    }
+    std::vector<double> weights;
+    double total_weight = 0;
+    for (auto index : order)
+    {
+        // Sources without measured throughput are assumed to be as fast as average source.
+        auto throughput = state.sources[index].throughput;
+        weights.push_back(throughput > 0 ? throughput : known > 0 ? known_throughput / known : 1);
+        total_weight += weights.back();
+    }
+
+    std::vector<Request> requests;
+    size_t done = 0;
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        auto piece = i + 1 == order.size() ? length - done :
+            static_cast<size_t>(static_cast<double>(length) * weights[i] / total_weight);
+        if (piece == 0)
+            continue;
+        requests.push_back(Request{offset + static_cast<int64_t>(done), buffer + done, piece, order[i],
+            std::vector<bool>(state.sources.size(), false), {}, Clock::time_point::max(), false});
+        done += piece;
+    }
+
+    auto abandon = [&]()
+    {
+        for (auto& request : requests)
+        {
+            for (auto* attempt : request.attempts)
+            {
+                if (!attempt->finished)
+                    state.sources[attempt->source].source->cancel();
+            }
+        }
+    };
+
+    for (;;)
+    {
+        auto now = Clock::now();
+        auto wake = Clock::time_point::max();
+        bool all_done = true;
+        for (auto& request : requests)
+        {
+            if (request.done)
+                continue;
+
+            // First attempt that succeeds wins, others are cancelled.
+            auto winner = std::find_if(request.attempts.begin(), request.attempts.end(),
+                [](const Attempt* attempt) { return attempt->finished && attempt->success; });
+            if (winner != request.attempts.end())
+            {
+                memcpy(request.buffer, (*winner)->data.data(), request.length);
+                state.sources[(*winner)->source].bytes += static_cast<int64_t>(request.length);
+                for (auto* attempt : request.attempts)
+                {
+                    if (!attempt->finished)
+                        state.sources[attempt->source].source->cancel();
+                }
+                request.done = true;
+                continue;
+            }
+            all_done = false;
+
+            bool active = std::any_of(request.attempts.begin(), request.attempts.end(),
+                [](const Attempt* attempt) { return !attempt->finished; });
+            if (!active || now >= request.deadline)
+            {
+                auto source = request.preferred;
+                if (request.tried[source] || state.sources[source].busy)
+                    source = state.pick(static_cast<int64_t>(request.length), request.tried);
+
+                if (source < state.sources.size())
+                {
+                    auto* attempt = state.start(source, request.offset, request.length);
+                    request.tried[source] = true;
+                    request.attempts.push_back(attempt);
+                    request.deadline = now + state.hedge_delay(*attempt);
+                    if (active)
+                        state.hedged_reads++;
+                    active = true;
+                }
+                else if (!active && std::find(request.tried.begin(), request.tried.end(), false) == request.tried.end())
+                {
+                    // Every source failed.
+                    abandon();
+                    return false;
+                }
+            }
+            // When no source is available for reissuing, it is reissued once a source finishes it's read.
+            if (active && request.deadline > now)
+                wake = std::min(wake, request.deadline);
+        }
+
+        if (all_done)
+            return true;
+
+        // Woken up when an attempt finishes or a deadline passes.
+        if (wake == Clock::time_point::max())
+            state.finished.wait(lock);
+        else
+            state.finished.wait_until(lock, wake);
+    }
+}
+
+std::vector<int64_t> MultiSource::source_bytes() const
+{
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    std::vector<int64_t> result;
+    for (const auto& source : state_->sources)
+        result.push_back(source.bytes);
+    return result;
+}
+
+int64_t MultiSource::hedged_reads() const
+{
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->hedged_reads;
+}
+
+}
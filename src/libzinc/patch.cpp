@@ -0,0 +1,743 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#if _WIN32
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "zinc/zinc.h"
+#include "file.h"
+
+namespace zinc
+{
+
+bool FileSource::read(int64_t offset, uint8_t* buffer, size_t length)
+{
+    return file_ != nullptr && read_at(file_, offset, buffer, length);
+}
+
+//////////////////////////////////////////////// patch building ////////////////////////////////////////////////////////
+
+/// Append operation to the patch, extending last operation when both ranges continue it in either direction.
+void append_operation(PatchOperationList& patch, const PatchOperation& operation)
+{
+    if (!patch.empty())
+    {
+        auto& last = patch.back();
+        if (last.type == operation.type)
+        {
+            if (last.source + last.length == operation.source &&
+                last.destination + last.length == operation.destination)
+            {
+                last.length += operation.length;
+                return;
+            }
+            // Operations copying blocks towards the end of file are ordered from last block to first.
+            if (operation.source + operation.length == last.source &&
+                operation.destination + operation.length == last.destination)
+            {
+                last.source = operation.source;
+                last.destination = operation.destination;
+                last.length += operation.length;
+                return;
+            }
+        }
+    }
+    patch.emplace_back(operation);
+}
+
+PatchOperationList build_patch(const SyncOperationList& operations, const Parameters* parameters)
+{
+    PatchOperationList patch;
+    for (const auto& operation : operations)
+    {
+        const auto& block = *operation.remote;
+        if (operation.local != nullptr)
+        {
+            append_operation(patch, PatchOperation{PatchOperation::Copy, operation.local->start, block.start,
+                block.length});
+        }
+        else if (is_zero_block(block, parameters))
+            append_operation(patch, PatchOperation{PatchOperation::Zero, block.start, block.start, block.length});
+        else
+            append_operation(patch, PatchOperation{PatchOperation::Download, block.start, block.start, block.length});
+    }
+    return patch;
+}
+
+PatchOperationList build_patch(const CompactSyncOperationList& operations, const CompactBoundaryList& local_file,
+    const CompactBoundaryList& remote_file, const Parameters* parameters)
+{
+    PatchOperationList patch;
+    for (const auto& operation : operations)
+    {
+        auto block = remote_file[operation.remote];
+        if (operation.local != CompactSyncOperation::npos)
+        {
+            const auto& source_file = operation.from_remote ? remote_file : local_file;
+            append_operation(patch, PatchOperation{PatchOperation::Copy, source_file.start(operation.local),
+                block.start, block.length});
+        }
+        else if (is_zero_block(block, parameters))
+            append_operation(patch, PatchOperation{PatchOperation::Zero, block.start, block.start, block.length});
+        else
+            append_operation(patch, PatchOperation{PatchOperation::Download, block.start, block.start, block.length});
+    }
+    return patch;
+}
+
+//////////////////////////////////////////////// patch journal /////////////////////////////////////////////////////////
+
+/// Journal file starts with this signature, followed by a header, recorded patch, checksum of them and two record
+/// slots.
+const char journal_signature[8] = {'Z', 'I', 'N', 'C', 'J', 'R', 'N', 'L'};
+
+/// Journal header.
+struct JournalHeader
+{
+    /// Identity of remote file.
+    uint64_t identity;
+    /// Number of recorded patch operations.
+    uint64_t count;
+    /// Size of a record slot. Limits amount of data a record may hold.
+    int64_t slot_size;
+};
+
+/// Record of progress applying the patch. Records are written to two slots in turns, therefore latest record survives
+/// an interrupted write of the next one and journal never grows. Record is followed by `length` bytes of data and a
+/// checksum of record and data.
+struct JournalRecord
+{
+    enum Kind : int64_t
+    {
+        /// Operations before `operation` and first `done` bytes of `operation` are applied.
+        Progress = 1,
+        /// Data about to be written to `destination`. After it's written progress is `operation` and `done`.
+        Redo = 2,
+    };
+
+    /// Number of record, latest valid record is used.
+    int64_t sequence;
+    Kind kind;
+    int64_t operation;
+    int64_t done;
+    int64_t destination;
+    int64_t length;
+};
+
+/// Position in the patch from which applying it continues.
+struct JournalPosition
+{
+    size_t operation = 0;
+    int64_t done = 0;
+};
+
+/// Returns checksum of journal header and patch operations serialized as `values`.
+uint64_t journal_checksum(const JournalHeader& header, const std::vector<int64_t>& values)
+{
+    auto hash = detail::fnv64a(reinterpret_cast<const uint8_t*>(journal_signature), sizeof(journal_signature));
+    hash = detail::fnv64a(reinterpret_cast<const uint8_t*>(&header), sizeof(header), hash);
+    return detail::fnv64a_combine(reinterpret_cast<const uint64_t*>(values.data()), values.size(), hash);
+}
+
+/// Read journal header and recorded patch. Returns false when journal is empty or damaged.
+bool read_journal_header(FILE* file, JournalHeader& header, PatchOperationList& patch, uint64_t& checksum)
+{
+    char signature[sizeof(journal_signature)];
+    if (!seek_file(file, 0) || fread(signature, 1, sizeof(signature), file) != sizeof(signature) ||
+        memcmp(signature, journal_signature, sizeof(signature)) != 0 || fread(&header, sizeof(header), 1, file) != 1 ||
+        header.count > static_cast<uint64_t>(get_file_size(file)))
+        return false;
+
+    std::vector<int64_t> values(header.count * 4);
+    if (fread(values.data(), sizeof(int64_t), values.size(), file) != values.size() ||
+        fread(&checksum, sizeof(checksum), 1, file) != 1 || checksum != journal_checksum(header, values))
+        return false;
+
+    patch.resize(header.count);
+    for (size_t i = 0; i < patch.size(); i++)
+    {
+        patch[i] = PatchOperation{static_cast<PatchOperation::Type>(values[i * 4]), values[i * 4 + 1],
+            values[i * 4 + 2], values[i * 4 + 3]};
+    }
+    return true;
+}
+
+/// Write journal header and recorded patch.
+/// \param checksum of written header and patch.
+/// \return true when everything was written.
+bool write_journal_header(FILE* file, const JournalHeader& header, const PatchOperationList& patch, uint64_t& checksum)
+{
+    std::vector<int64_t> values;
+    values.reserve(patch.size() * 4);
+    for (const auto& operation : patch)
+        values.insert(values.end(), {operation.type, operation.source, operation.destination, operation.length});
+
+    checksum = journal_checksum(header, values);
+    return fwrite(journal_signature, 1, sizeof(journal_signature), file) == sizeof(journal_signature) &&
+        fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(values.data(), sizeof(int64_t), values.size(), file) == values.size() &&
+        fwrite(&checksum, sizeof(checksum), 1, file) == 1;
+}
+
+bool same_patch(const PatchOperationList& a, const PatchOperationList& b)
+{
+    auto same_operation = [](const PatchOperation& x, const PatchOperation& y)
+    {
+        return x.type == y.type && x.source == y.source && x.destination == y.destination && x.length == y.length;
+    };
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), same_operation);
+}
+
+/// Writes records to the journal of a patch being applied. Does nothing when patch is applied without a journal.
+class JournalWriter
+{
+public:
+    /// Load progress recorded in the journal, or start a new journal when it was recorded for a different patch.
+    /// \param target file patch is applied to.
+    /// \param patch being applied.
+    /// \param journal to use, may be null.
+    /// \param max_redo_length largest amount of data redo() will be called with.
+    /// \param position from which applying patch continues.
+    bool open(FILE* target, const PatchOperationList& patch, const PatchJournal* journal, size_t max_redo_length,
+        JournalPosition& position)
+    {
+        if (journal == nullptr || journal->file == nullptr)
+            return true;
+
+        JournalHeader header{};
+        PatchOperationList recorded;
+        if (!read_journal_header(journal->file, header, recorded, seed_) || header.identity != journal->identity ||
+            !same_patch(recorded, patch))
+        {
+            header = JournalHeader{journal->identity, patch.size(),
+                static_cast<int64_t>(sizeof(JournalRecord) + max_redo_length + sizeof(uint64_t))};
+            // Streams without a descriptor can not be truncated and are overwritten in place. Records left behind
+            // are not valid because they are checked against checksum of the new header.
+            if ((fileno(journal->file) >= 0 && !truncate_file(journal->file, 0)) ||
+                !seek_file(journal->file, 0) ||
+                !write_journal_header(journal->file, header, patch, seed_))
+                return false;
+        }
+        file_ = journal->file;
+        slot_size_ = header.slot_size;
+        slots_offset_ = tell_file(file_);
+        if (slots_offset_ < 0 || fflush(file_) != 0)
+            return false;
+
+        // Latest valid record is used. Other slot may contain a record which was not fully written.
+        JournalRecord latest{};
+        std::vector<uint8_t> latest_data;
+        for (int64_t slot = 0; slot < 2; slot++)
+        {
+            JournalRecord record{};
+            std::vector<uint8_t> data;
+            if (read_record(slot, record, data) && record.sequence > latest.sequence &&
+                record.operation <= static_cast<int64_t>(patch.size()))
+            {
+                latest = record;
+                latest_data.swap(data);
+            }
+        }
+        sequence_ = latest.sequence;
+        if (sequence_ == 0)
+            return true;
+
+        position.operation = static_cast<size_t>(latest.operation);
+        position.done = latest.done;
+
+        // Interrupted write of data that can not be copied again is repeated.
+        return latest.kind != JournalRecord::Redo ||
+            write_at(target, latest.destination, latest_data.data(), latest_data.size());
+    }
+
+    /// Largest amount of data a record may hold.
+    int64_t max_redo_length() const
+    {
+        return file_ ? slot_size_ - static_cast<int64_t>(sizeof(JournalRecord) + sizeof(uint64_t)) : INT64_MAX;
+    }
+
+    /// Record that operations before `operation` and first `done` bytes of `operation` are applied.
+    bool progress(size_t operation, int64_t done)
+    {
+        return write_record(JournalRecord::Progress, operation, done, 0, nullptr, 0);
+    }
+
+    /// Record data about to be written to `destination`. Progress is `operation` and `done` once it's written.
+    bool redo(size_t operation, int64_t done, int64_t destination, const uint8_t* data, int64_t length)
+    {
+        return write_record(JournalRecord::Redo, operation, done, destination, data, length);
+    }
+
+protected:
+    /// Checksum of a record. Records left by a journal with a different header are never valid.
+    uint64_t record_checksum(const JournalRecord& record, const uint8_t* data) const
+    {
+        auto hash = detail::fnv64a(reinterpret_cast<const uint8_t*>(&record), sizeof(record), seed_);
+        return detail::fnv64a(data, static_cast<size_t>(record.length), hash);
+    }
+
+    bool read_record(int64_t slot, JournalRecord& record, std::vector<uint8_t>& data)
+    {
+        uint64_t checksum = 0;
+        if (!seek_file(file_, slots_offset_ + slot * slot_size_) || fread(&record, sizeof(record), 1, file_) != 1 ||
+            record.length < 0 || record.length > max_redo_length())
+            return false;
+
+        data.resize(static_cast<size_t>(record.length));
+        return fread(data.data(), 1, data.size(), file_) == data.size() &&
+            fread(&checksum, sizeof(checksum), 1, file_) == 1 && checksum == record_checksum(record, data.data());
+    }
+
+    bool write_record(JournalRecord::Kind kind, size_t operation, int64_t done, int64_t destination,
+        const uint8_t* data, int64_t length)
+    {
+        if (file_ == nullptr)
+            return true;
+
+        sequence_++;
+        JournalRecord record{sequence_, kind, static_cast<int64_t>(operation), done, destination, length};
+        auto checksum = record_checksum(record, data);
+        return seek_file(file_, slots_offset_ + (sequence_ % 2) * slot_size_) &&
+            fwrite(&record, sizeof(record), 1, file_) == 1 &&
+            (length == 0 || fwrite(data, 1, static_cast<size_t>(length), file_) == static_cast<size_t>(length)) &&
+            fwrite(&checksum, sizeof(checksum), 1, file_) == 1 && fflush(file_) == 0;
+    }
+
+    /// Journal file, null when patch is applied without a journal.
+    FILE* file_ = nullptr;
+    /// Checksum of journal header.
+    uint64_t seed_ = 0;
+    /// Offset of first record slot.
+    int64_t slots_offset_ = 0;
+    /// Size of record slot.
+    int64_t slot_size_ = 0;
+    /// Number of last written record.
+    int64_t sequence_ = 0;
+};
+
+bool read_journal(const PatchJournal& journal, PatchOperationList& patch)
+{
+    JournalHeader header{};
+    uint64_t checksum = 0;
+    return journal.file != nullptr && read_journal_header(journal.file, header, patch, checksum) &&
+        header.identity == journal.identity;
+}
+
+//////////////////////////////////////////////// patch application /////////////////////////////////////////////////////
+
+/// Parameters used when none are given.
+const Parameters default_parameters{};
+/// Limit of chunks fetched ahead, matters only when buffer is tiny.
+const size_t max_prefetch_chunks = 64;
+
+/// Let the kernel copy a range within the file. Only non-overlapping ranges are supported. Returns number of bytes
+/// copied, which may be less than requested when kernel is unable to do the copy.
+int64_t copy_range_in_kernel(FILE* file, int64_t source, int64_t destination, int64_t length)
+{
+    int64_t done = 0;
+#if __linux__
+    auto fd = fileno(file);
+    if (fd < 0)
+        return 0;
+
+    while (done < length)
+    {
+        loff_t source_offset = source + done;
+        loff_t destination_offset = destination + done;
+        auto remaining = static_cast<size_t>(length - done);
+        auto result = copy_file_range(fd, &source_offset, fd, &destination_offset, remaining, 0);
+
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            break;                  // Not supported by the file system or kernel, caller copies the rest.
+        done += result;
+    }
+#else
+    (void)file;
+    (void)source;
+    (void)destination;
+    (void)length;
+#endif
+    return done;
+}
+
+/// Maximal number of chunks fetched in one batch.
+const size_t max_batch_ranges = 64;
+
+/// Fetches data of download operations on a background thread, ahead of the operations being applied. Chunks are
+/// fetched in the order they are written, therefore network transfers overlap with copies and writes of earlier
+/// operations.
+class DownloadPrefetcher
+{
+public:
+    /// Fetched chunk of a download operation.
+    struct Chunk
+    {
+        /// Index of operation.
+        size_t operation = 0;
+        /// Offset of chunk in the operation.
+        int64_t done = 0;
+        /// Fetched data.
+        std::vector<uint8_t> data;
+        /// False when data could not be fetched.
+        bool success = false;
+    };
+
+    /// \param patch being applied.
+    /// \param position from which patch is applied.
+    /// \param remote source of downloaded data.
+    /// \param chunk_size maximal size of a chunk, same as size of buffer used when applying patch.
+    /// \param max_chunks number of chunks fetched ahead.
+    DownloadPrefetcher(const PatchOperationList& patch, const JournalPosition& position, RemoteSource* remote,
+        size_t chunk_size, size_t max_chunks)
+        : patch_(patch)
+        , position_(position)
+        , remote_(remote)
+        , chunk_size_(static_cast<int64_t>(chunk_size))
+        , max_chunks_(max_chunks)
+    {
+        thread_ = std::thread(&DownloadPrefetcher::run, this);
+    }
+
+    ~DownloadPrefetcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        changed_.notify_all();
+        thread_.join();
+    }
+
+    /// Wait for next fetched chunk. Data of previous chunk is reused for fetching following chunks.
+    void next(Chunk& chunk)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!chunk.data.empty())
+            free_.emplace_back(std::move(chunk.data));
+        changed_.wait(lock, [this]() { return !queue_.empty(); });
+        chunk = std::move(queue_.front());
+        queue_.pop_front();
+        changed_.notify_all();
+    }
+
+protected:
+    /// Fetch chunks of downloads in order they are applied, split to chunks same way download_range() does. Chunks of
+    /// small downloads are fetched in batches, which sources may fetch with a single request.
+    void run()
+    {
+        std::vector<Chunk> batch;
+        int64_t batch_size = 0;
+        for (auto i = position_.operation; i < patch_.size(); i++)
+        {
+            const auto& operation = patch_[i];
+            if (operation.type != PatchOperation::Download)
+                continue;
+
+            for (auto done = i == position_.operation ? position_.done : 0; done < operation.length;)
+            {
+                Chunk chunk;
+                chunk.operation = i;
+                chunk.done = done;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    if (!batch.empty() && queue_.size() + batch.size() >= max_chunks_)
+                    {
+                        // Chunks of the batch are needed before more of them fit into the queue.
+                        lock.unlock();
+                        if (!fetch(batch))
+                            return;
+                        batch_size = 0;
+                        lock.lock();
+                    }
+                    changed_.wait(lock, [this]() { return stop_ || queue_.size() < max_chunks_; });
+                    if (stop_)
+                        return;
+                    if (!free_.empty())
+                    {
+                        chunk.data = std::move(free_.back());
+                        free_.pop_back();
+                    }
+                }
+
+                auto length = std::min(operation.length - done, chunk_size_);
+                chunk.data.resize(static_cast<size_t>(length));
+                done += length;
+                batch_size += length;
+                batch.emplace_back(std::move(chunk));
+                if (batch_size >= chunk_size_ || batch.size() >= max_batch_ranges)
+                {
+                    if (!fetch(batch))
+                        return;
+                    batch_size = 0;
+                }
+            }
+        }
+        fetch(batch);
+    }
+
+    /// Fetch data of batched chunks and queue them. Returns false on failure.
+    bool fetch(std::vector<Chunk>& batch)
+    {
+        if (batch.empty())
+            return true;
+
+        std::vector<RemoteRange> ranges;
+        for (auto& chunk : batch)
+        {
+            auto offset = patch_[chunk.operation].source + chunk.done;
+            ranges.push_back(RemoteRange{offset, &chunk.data[0], chunk.data.size()});
+        }
+        auto success = ranges.size() == 1 ? remote_->read(ranges[0].offset, ranges[0].buffer, ranges[0].length) :
+            remote_->read_ranges(ranges);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& chunk : batch)
+        {
+            chunk.success = success;
+            queue_.emplace_back(std::move(chunk));
+        }
+        batch.clear();
+        changed_.notify_all();
+        return success;
+    }
+
+    const PatchOperationList& patch_;
+    JournalPosition position_;
+    RemoteSource* remote_;
+    int64_t chunk_size_;
+    size_t max_chunks_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    /// Fetched chunks waiting to be written.
+    std::deque<Chunk> queue_;
+    /// Buffers of written chunks.
+    std::vector<std::vector<uint8_t>> free_;
+    bool stop_ = false;
+};
+
+/// State shared by operations of a patch being applied.
+struct PatchContext
+{
+    /// Local file.
+    FILE* file;
+    /// Source of downloaded data.
+    RemoteSource* remote;
+    /// Buffer data passes through.
+    std::vector<uint8_t> buffer;
+    /// Records progress.
+    JournalWriter journal;
+    /// Hashes written data, may be null.
+    PatchVerifier* verifier;
+    /// Fetches downloaded data ahead, may be null.
+    std::unique_ptr<DownloadPrefetcher> prefetcher;
+    /// Last chunk returned by prefetcher.
+    DownloadPrefetcher::Chunk chunk;
+
+    /// Write data to local file.
+    bool write(int64_t destination, const uint8_t* data, int64_t length)
+    {
+        if (!write_at(file, destination, data, static_cast<size_t>(length)))
+            return false;
+        if (verifier != nullptr)
+            verifier->write(destination, data, static_cast<size_t>(length));
+        return true;
+    }
+};
+
+/// Copy a range within the file. Chunks are copied in the direction that never overwrites data yet to be read, like
+/// memmove() does. Copying continues after first `done` bytes, counted in the direction of copying.
+bool move_range(PatchContext& context, size_t index, const PatchOperation& operation, int64_t done)
+{
+    auto source = operation.source;
+    auto destination = operation.destination;
+    auto length = operation.length;
+    auto distance = destination > source ? destination - source : source - destination;
+    if (distance >= length && context.verifier == nullptr)
+    {
+        auto copied = copy_range_in_kernel(context.file, source + done, destination + done, length - done);
+        done += copied;
+        if (copied > 0 && !context.journal.progress(index, done))
+            return false;
+    }
+
+    // Overlapping chunks must fit into the journal.
+    auto chunk_size = std::min(static_cast<int64_t>(context.buffer.size()),
+        std::max(context.journal.max_redo_length(), distance));
+    auto backwards = destination > source && distance < length;
+    while (done < length)
+    {
+        auto chunk = std::min(length - done, chunk_size);
+        auto offset = backwards ? length - done - chunk : done;
+        if (!read_at(context.file, source + offset, &context.buffer[0], chunk))
+            return false;
+        done += chunk;
+
+        // Chunk overlapping its own source can not be copied again once it was partially written, therefore it's data
+        // is journaled before writing.
+        auto overlaps = distance < chunk;
+        if (overlaps && !context.journal.redo(index, done, destination + offset, &context.buffer[0], chunk))
+            return false;
+        if (!context.write(destination + offset, &context.buffer[0], chunk))
+            return false;
+        if (!overlaps && !context.journal.progress(index, done))
+            return false;
+    }
+    return true;
+}
+
+/// Fetch a range of remote file and write it to local file. Fetching continues after first `done` bytes.
+bool download_range(PatchContext& context, size_t index, const PatchOperation& operation, int64_t done)
+{
+    if (context.remote == nullptr)
+        return false;
+
+    auto chunk_size = static_cast<int64_t>(context.buffer.size());
+    while (done < operation.length)
+    {
+        auto chunk = std::min(operation.length - done, chunk_size);
+        const uint8_t* data = &context.buffer[0];
+        if (context.prefetcher)
+        {
+            context.prefetcher->next(context.chunk);
+            if (!context.chunk.success)
+                return false;
+            assert(context.chunk.operation == index && context.chunk.done == done);
+            data = &context.chunk.data[0];
+        }
+        else if (!context.remote->read(operation.source + done, &context.buffer[0], chunk))
+            return false;
+
+        if (!context.write(operation.destination + done, data, chunk))
+            return false;
+        done += chunk;
+        if (!context.journal.progress(index, done))
+            return false;
+    }
+    return true;
+}
+
+/// Fill a range of file with zeros. Range is deallocated when file system supports it, writing zeros otherwise.
+bool fill_zeros(FILE* file, int64_t destination, int64_t length, std::vector<uint8_t>& buffer)
+{
+#if __linux__
+    auto fd = fileno(file);
+    if (fd >= 0 && fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, destination, length) == 0)
+        return true;
+#endif
+    std::fill(buffer.begin(), buffer.end(), 0);
+    auto chunk_size = static_cast<int64_t>(buffer.size());
+    for (int64_t done = 0; done < length;)
+    {
+        auto chunk = std::min(length - done, chunk_size);
+        if (!write_at(file, destination + done, &buffer[0], chunk))
+            return false;
+        done += chunk;
+    }
+    return true;
+}
+
+/// Fill range of zero operation with zeros.
+bool zero_range(PatchContext& context, const PatchOperation& operation)
+{
+    if (!fill_zeros(context.file, operation.destination, operation.length, context.buffer))
+        return false;
+    if (context.verifier != nullptr)
+        context.verifier->zero(operation.destination, operation.length);
+    return true;
+}
+
+bool apply_patch(FILE* file, const PatchOperationList& patch, RemoteSource* remote, const Parameters* parameters,
+    const PatchJournal* journal, PatchVerifier* verifier)
+{
+    if (file == nullptr)
+        return false;
+
+    if (parameters == nullptr)
+        parameters = &default_parameters;
+    auto buffer_size = parameters->read_buffer_size;
+
+    // Data is accessed bypassing stream buffers.
+    if (fflush(file) != 0)
+        return false;
+
+    PatchContext context{file, remote, std::vector<uint8_t>(std::max<size_t>(buffer_size, 1)), JournalWriter{},
+        verifier, nullptr, DownloadPrefetcher::Chunk{}};
+
+    JournalPosition position;
+    if (!context.journal.open(file, patch, journal, context.buffer.size(), position))
+        return false;
+
+    // Downloads are fetched while preceding operations are applied.
+    auto has_downloads = std::any_of(patch.begin() + std::min(position.operation, patch.size()), patch.end(),
+        [](const PatchOperation& operation) { return operation.type == PatchOperation::Download; });
+    if (remote != nullptr && has_downloads && parameters->download_prefetch_size > 0)
+    {
+        auto max_chunks = std::min<size_t>(max_prefetch_chunks,
+            std::max<size_t>(1, parameters->download_prefetch_size / context.buffer.size()));
+        context.prefetcher.reset(new DownloadPrefetcher(patch, position, remote, context.buffer.size(), max_chunks));
+    }
+
+    for (auto i = position.operation; i < patch.size(); i++)
+    {
+        const auto& operation = patch[i];
+        auto done = i == position.operation ? position.done : 0;
+        bool success = false;
+        switch (operation.type)
+        {
+        case PatchOperation::Copy:
+            success = move_range(context, i, operation, done);
+            break;
+        case PatchOperation::Download:
+            success = download_range(context, i, operation, done);
+            break;
+        case PatchOperation::Zero:
+            success = zero_range(context, operation);
+            break;
+        }
+
+        if (!success || !context.journal.progress(i + 1, 0))
+            return false;
+    }
+
+    // Discard stale stream buffers.
+    return seek_file(file, 0);
+}
+
+}
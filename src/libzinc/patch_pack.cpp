@@ -0,0 +1,175 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <algorithm>
+#include <cstring>
+#include "zinc/zinc.h"
+#include "file.h"
+
+namespace zinc
+{
+
+/// Patch pack starts with this signature, followed by a header, stored patch, checksum of them and data of downloads.
+const char pack_signature[8] = {'Z', 'I', 'N', 'C', 'P', 'A', 'C', 'K'};
+
+/// Patch pack header.
+struct PackHeader
+{
+    /// Identity of file version patch applies to.
+    uint64_t source;
+    /// Identity of file version patch produces.
+    uint64_t target;
+    /// Number of stored patch operations.
+    uint64_t count;
+};
+
+/// Packs with more operations are considered damaged.
+const uint64_t max_pack_operations = 1ULL << 28U;
+/// Stored patch is read in chunks of this many operations, memory grows only as far as pack actually has data.
+const uint64_t pack_read_operations = 64 * 1024;
+
+/// Returns checksum of pack header and patch operations serialized as `count` int64_t values. Checksum of following
+/// values continues from returned one.
+uint64_t pack_checksum(const PackHeader& header, const int64_t* values, size_t count)
+{
+    auto hash = detail::fnv64a(reinterpret_cast<const uint8_t*>(pack_signature), sizeof(pack_signature));
+    hash = detail::fnv64a(reinterpret_cast<const uint8_t*>(&header), sizeof(header), hash);
+    return detail::fnv64a_combine(reinterpret_cast<const uint64_t*>(values), count, hash);
+}
+
+bool write_patch_pack(FILE* pack, const PatchOperationList& patch, RemoteSource* remote, uint64_t source,
+    uint64_t target)
+{
+    PackHeader header{source, target, patch.size()};
+    auto offset = static_cast<int64_t>(sizeof(pack_signature) + sizeof(header) + patch.size() * 4 * sizeof(int64_t) +
+        sizeof(uint64_t));
+    std::vector<int64_t> values;
+    values.reserve(patch.size() * 4);
+    for (const auto& operation : patch)
+    {
+        auto stored_source = operation.source;
+        if (operation.type == PatchOperation::Download)
+        {
+            stored_source = offset;
+            offset += operation.length;
+        }
+        values.insert(values.end(), {operation.type, stored_source, operation.destination, operation.length});
+    }
+
+    auto checksum = pack_checksum(header, values.data(), values.size());
+    if (fwrite(pack_signature, 1, sizeof(pack_signature), pack) != sizeof(pack_signature) ||
+        fwrite(&header, sizeof(header), 1, pack) != 1 ||
+        fwrite(values.data(), sizeof(int64_t), values.size(), pack) != values.size() ||
+        fwrite(&checksum, sizeof(checksum), 1, pack) != 1)
+        return false;
+
+    std::vector<uint8_t> buffer(1024 * 1024);
+    for (const auto& operation : patch)
+    {
+        if (operation.type != PatchOperation::Download)
+            continue;
+        for (int64_t done = 0; done < operation.length;)
+        {
+            auto length = static_cast<size_t>(std::min<int64_t>(operation.length - done, buffer.size()));
+            if (remote == nullptr || !remote->read(operation.source + done, buffer.data(), length) ||
+                fwrite(buffer.data(), 1, length, pack) != length)
+                return false;
+            done += length;
+        }
+    }
+    return fflush(pack) == 0;
+}
+
+bool read_patch_pack(RemoteSource* pack, uint64_t source, uint64_t target, PatchOperationList& patch)
+{
+    char signature[sizeof(pack_signature)];
+    PackHeader header{};
+    auto offset = static_cast<int64_t>(sizeof(signature) + sizeof(header));
+    if (!pack->read(0, reinterpret_cast<uint8_t*>(signature), sizeof(signature)) ||
+        memcmp(signature, pack_signature, sizeof(signature)) != 0 ||
+        !pack->read(sizeof(signature), reinterpret_cast<uint8_t*>(&header), sizeof(header)) ||
+        header.source != source || header.target != target || header.count > max_pack_operations)
+        return false;
+
+    // Count is not trusted until checksum is verified, operations are read in chunks that fail at the end of pack.
+    auto hash = pack_checksum(header, nullptr, 0);
+    std::vector<int64_t> values;
+    PatchOperationList result;
+    for (uint64_t done = 0; done < header.count;)
+    {
+        auto count = static_cast<size_t>(std::min(header.count - done, pack_read_operations));
+        values.resize(count * 4);
+        if (!pack->read(offset, reinterpret_cast<uint8_t*>(values.data()), values.size() * sizeof(int64_t)))
+            return false;
+        hash = detail::fnv64a_combine(reinterpret_cast<const uint64_t*>(values.data()), values.size(), hash);
+        for (size_t i = 0; i < count; i++)
+        {
+            result.emplace_back(PatchOperation{static_cast<PatchOperation::Type>(values[i * 4]), values[i * 4 + 1],
+                values[i * 4 + 2], values[i * 4 + 3]});
+        }
+        offset += static_cast<int64_t>(values.size() * sizeof(int64_t));
+        done += count;
+    }
+
+    uint64_t checksum = 0;
+    if (!pack->read(offset, reinterpret_cast<uint8_t*>(&checksum), sizeof(checksum)) || checksum != hash)
+        return false;
+    patch = std::move(result);
+    return true;
+}
+
+bool write_push_pack(FILE* pack, FILE* local_file, const CompactBoundaryList& local_blocks,
+    const CompactBoundaryList& stored_blocks, uint64_t source, uint64_t target, const Parameters* parameters)
+{
+    // Patch turns stored file into local file, it's downloads are blocks of local file missing in store.
+    auto delta = compare_files(stored_blocks, local_blocks, parameters);
+    auto patch = build_patch(delta, stored_blocks, local_blocks, parameters);
+    FileSource local(local_file);
+    return write_patch_pack(pack, patch, &local, source, target);
+}
+
+bool apply_push_pack(FILE* stored_file, RemoteSource* pack, const CompactBoundaryList& blocks, uint64_t source,
+    uint64_t target, FILE* journal_file, const Parameters* parameters)
+{
+    PatchOperationList patch;
+    if (!read_patch_pack(pack, source, target, patch))
+        return false;
+
+    PatchJournal journal;
+    journal.file = journal_file;
+    journal.identity = detail::fnv64a_combine(&source, 1, target);
+    PatchOperationList recorded;
+    auto resumed = journal_file != nullptr && read_journal(journal, recorded);
+
+    PatchVerifier verifier(blocks, parameters);
+    if (!apply_patch(stored_file, patch, pack, parameters, &journal, &verifier) ||
+        !truncate_file(stored_file, blocks.file_size()))
+        return false;
+
+    // Blocks written before patching was interrupted were not hashed.
+    if (resumed)
+        return verify_file(stored_file, blocks, 0, nullptr, nullptr, nullptr, parameters).get().empty();
+    return verifier.finish(stored_file) && verifier.digest() == file_digest(blocks);
+}
+
+}
@@ -0,0 +1,168 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2018 Rokas Kupstys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <algorithm>
+#include <cstring>
+#include "zinc/zinc.h"
+#include "file.h"
+
+namespace zinc
+{
+
+/// Hash file size and lengths and hashes of all blocks.
+template<typename Length, typename Hash>
+uint64_t compute_digest(size_t count, const Length& length, const Hash& hash)
+{
+    uint64_t file_size = 0;
+    for (size_t i = 0; i < count; i++)
+        file_size += static_cast<uint64_t>(length(i));
+
+    auto result = detail::fnv64a_combine(&file_size, 1);
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t block[] = {static_cast<uint64_t>(length(i)), hash(i)};
+        result = detail::fnv64a_combine(block, 2, result);
+    }
+    return result;
+}
+
+uint64_t file_digest(const CompactBoundaryList& blocks)
+{
+    return compute_digest(blocks.size(), [&](size_t i) { return blocks.length(i); },
+        [&](size_t i) { return blocks.hash(i); });
+}
+
+uint64_t file_digest(const BoundaryList& blocks)
+{
+    return compute_digest(blocks.size(), [&](size_t i) { return blocks[i].length; },
+        [&](size_t i) { return blocks[i].hash; });
+}
+
+PatchVerifier::PatchVerifier(const CompactBoundaryList& blocks, const Parameters* parameters)
+    : blocks_(blocks)
+    , leaf_size_(parameters ? parameters->hash_leaf_size : 0)
+    , hashes_(blocks.size())
+    , hashed_(blocks.size())
+{
+}
+
+void PatchVerifier::write(int64_t offset, const uint8_t* data, size_t length)
+{
+    for (auto end = offset + static_cast<int64_t>(length); offset < end;)
+    {
+        int64_t block_start = 0;
+        auto index = blocks_.find(offset, &block_start);
+        if (index >= blocks_.size())
+            return;                                     // Past the end of remote file
+
+        auto piece = std::min(end - offset, block_start + blocks_.length(index) - offset);
+        consume(index, block_start, offset, data, piece);
+        offset += piece;
+        if (data != nullptr)
+            data += piece;
+    }
+}
+
+void PatchVerifier::zero(int64_t offset, int64_t length)
+{
+    write(offset, nullptr, static_cast<size_t>(length));
+}
+
+bool PatchVerifier::finish(FILE* file)
+{
+    // Blocks that were not written completely do not have all of their data in place.
+    for (const auto& partial : partial_)
+    {
+        hashed_[partial.first] = true;
+        mismatched_.push_back(partial.first);
+    }
+    partial_.clear();
+
+    // Blocks that were not written at all are hashed from the file.
+    fflush(file);
+    std::vector<uint8_t> buffer;
+    int64_t block_start = 0;
+    for (size_t i = 0; i < blocks_.size(); block_start += blocks_.length(i), i++)
+    {
+        if (hashed_[i])
+            continue;
+        buffer.resize(static_cast<size_t>(blocks_.length(i)));
+        if (read_at(file, block_start, buffer.data(), buffer.size()))
+            complete(i, detail::block_hash(buffer.data(), buffer.size(), leaf_size_));
+        else
+        {
+            hashed_[i] = true;
+            mismatched_.push_back(i);
+        }
+    }
+    std::sort(mismatched_.begin(), mismatched_.end());
+    return mismatched_.empty();
+}
+
+uint64_t PatchVerifier::digest() const
+{
+    return compute_digest(blocks_.size(), [&](size_t i) { return blocks_.length(i); },
+        [&](size_t i) { return hashes_[i]; });
+}
+
+void PatchVerifier::consume(size_t index, int64_t block_start, int64_t offset, const uint8_t* data, int64_t length)
+{
+    auto block_length = blocks_.length(index);
+    if (length == block_length)
+    {
+        // Entire block is written at once, it's hashed in place.
+        auto block_size = static_cast<size_t>(block_length);
+        complete(index, data ? detail::block_hash(data, block_size, leaf_size_) :
+            detail::block_hash_zeros(block_size, leaf_size_));
+        return;
+    }
+
+    // Pieces of block are collected until all of them are written, they are not necessarily written in order.
+    auto& partial = partial_[index];
+    if (partial.data.empty())
+        partial.data.resize(static_cast<size_t>(block_length));
+    auto* target = &partial.data[static_cast<size_t>(offset - block_start)];
+    if (data != nullptr)
+        memcpy(target, data, static_cast<size_t>(length));
+    else
+        memset(target, 0, static_cast<size_t>(length));
+
+    partial.written += length;
+    if (partial.written >= block_length)
+    {
+        complete(index, detail::block_hash(partial.data.data(), partial.data.size(), leaf_size_));
+        partial_.erase(index);
+    }
+}
+
+void PatchVerifier::complete(size_t index, uint64_t hash)
+{
+    hashes_[index] = hash;
+    hashed_[index] = true;
+    if (hash == blocks_.hash(index))
+        verified_bytes_ += blocks_.length(index);
+    else
+        mismatched_.push_back(index);
+}
+
+}
@@ -29,10 +29,19 @@
 #   include <unistd.h>
 #endif
 #include <unordered_map>
+#include <memory>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <cstring>
+#include <thread>
+#include <cerrno>
 #include <algorithm>
 #include <functional>
 #include <cassert>
 #include "zinc/zinc.h"
+#include "file.h"
 
 using namespace zinc::detail;
 
@@ -43,58 +52,18 @@ using ByteArray = std::vector<uint8_t>;
 
 const Parameters default_parameters{};
 
-// Distance for integral types
-template<typename Iter>
-typename std::enable_if<std::is_integral<Iter>::value, long>::type
-distance(Iter start, Iter end) { return end - start; }
+/// Work unit size of first partitioning pass. Units are small enough to keep all threads busy until the end.
+const int64_t work_unit_size = 4 * 1024 * 1024;
 
-// Distance for iterators
-template<typename Iter>
-typename std::enable_if<!std::is_integral<Iter>::value, long>::type
-distance(Iter start, Iter end) { return std::distance(start, end); }
-
-template<typename Iter, typename... Args>
-void parallel_for(Iter start, Iter end, int num_threads, std::function<void(Iter start, Iter end, Args...)> functor, Args... args)
+/// Run `worker` on `num_threads` threads, calling thread included, and wait for them to finish. Workers are expected to
+/// pick up work items from a shared atomic counter.
+void run_parallel(size_t num_threads, const std::function<void()>& worker)
 {
-    if (num_threads == 0)
-        num_threads = std::thread::hardware_concurrency();
-
-    auto total_count = distance(start, end);
-    auto per_thread_count = total_count / num_threads;
-    auto remainder = total_count % num_threads;
-
-    if (num_threads > 0)
-    {
-        // Parallel execution
-        std::vector<std::thread> my_threads(static_cast<unsigned long>(num_threads));
-
-        auto i = 0;
-        for (; i < num_threads - 1; i++)
-        {
-            int part_start = start + i * per_thread_count;
-            my_threads[i] = std::thread(functor, part_start, part_start + per_thread_count, args...);
-        }
-
-        // Last thread handles remainder as well
-        int part_start = start + i * per_thread_count;
-        my_threads[i] = std::thread(functor, part_start, part_start + per_thread_count + remainder, args...);
-
-        std::for_each(my_threads.begin(), my_threads.end(), std::mem_fn(&std::thread::join));
-    }
-    else
-    {
-        // Sequential execution (pass -1 for number of threads)
-        auto i = 0;
-        for (; i < num_threads - 1; i++)
-        {
-            int part_start = start + i * per_thread_count;
-            functor(part_start, part_start + per_thread_count, args...);
-        }
-
-        // Last thread handles remainder as well
-        int part_start = start + i * per_thread_count;
-        functor(part_start, part_start + per_thread_count + remainder, args...);
-    }
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; i++)
+        threads.emplace_back(worker);
+    worker();
+    std::for_each(threads.begin(), threads.end(), std::mem_fn(&std::thread::join));
 }
 
 /// Tracks progress reporting when range of bytes needs to be processed multiple times.
@@ -102,70 +71,66 @@ struct DividedProgress
 {
     int64_t bytes_total = 0;
     std::atomic<int64_t> bytes_buffer{0};
+    std::atomic<int64_t> bytes_counter{0};
     std::atomic<int64_t>* bytes_done;
     unsigned times = 0;
+    const Parameters* parameters;
+    std::mutex report_lock;
+    std::chrono::steady_clock::time_point last_report{};
 
-    DividedProgress(int64_t bytes_total_, unsigned times_, std::atomic<int64_t>* progress_result)
+    DividedProgress(int64_t bytes_total_, unsigned times_, std::atomic<int64_t>* progress_result,
+        const Parameters* parameters_)
         : bytes_total(bytes_total_)
-        , bytes_done(progress_result)
+        , bytes_done(progress_result ? progress_result : &bytes_counter)
         , times(times_)
+        , parameters(parameters_)
     {
     }
 
     /// After consuming `bytes` * `times` amount of bytes, bytes_done() will return `bytes`.
     inline void consume(int64_t bytes)
     {
-        if (bytes_done == nullptr)
-            return;
-
         bytes += bytes_buffer.exchange(0);
         bytes_buffer.fetch_add(bytes % times);
         bytes_done->fetch_add(bytes / times);
+        report(false);
     }
 
     inline void flush()
     {
-        if (bytes_done == nullptr)
-            return;
-
         bytes_done->fetch_add(bytes_buffer);
         bytes_buffer = 0;
+        report(true);
     }
-};
 
-int64_t get_file_size(FILE* file)
-{
-    if (!file)
-        return 0;
+    /// Invoke progress callback if enough time passed since last call. Only one thread invokes callback at a time,
+    /// other threads skip reporting instead of waiting.
+    void report(bool force)
+    {
+        if (!parameters->on_progress)
+            return;
 
-    auto pos = ftell(file);
-    fseek(file, 0, SEEK_END);
+        std::unique_lock<std::mutex> lock(report_lock, std::defer_lock);
+        if (force)
+            lock.lock();
+        else if (!lock.try_lock())
+            return;
 
-    auto result = ftell(file);
-    fseek(file, pos, SEEK_SET);
+        auto now = std::chrono::steady_clock::now();
+        if (!force && now - last_report < parameters->progress_interval)
+            return;
 
-    return result;
-}
+        last_report = now;
+        parameters->on_progress(bytes_done->load(), bytes_total);
+    }
+};
 
+#if _WIN32
 FILE* duplicate_file(FILE* file, const char* access)
 {
     if (file == nullptr)
         return nullptr;
 
-#if __linux__
-    auto fd = fileno(file);
-    if (fd < 0)
-    {
-        // Chances are we are dealing with handle from fmemopen()
-        return fmemopen(file->_IO_buf_base, (uintptr_t)file->_IO_buf_end - (uintptr_t)file->_IO_buf_base, access);
-    }
-    else
-    {
-        char link[32];
-        snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
-        return fopen(link, access);
-    }
-#elif _WIN32
     if (HANDLE file_handle = reinterpret_cast<HANDLE>(_get_osfhandle(fileno(file))))
     {
         FILE_NAME_INFO info{ };
@@ -178,20 +143,386 @@ FILE* duplicate_file(FILE* file, const char* access)
         }
     }
     return nullptr;
-#else
-#   error TODO later
+}
 #endif
+
+/// Random access to data being partitioned. Every worker thread uses it's own reader.
+class DataReader
+{
+public:
+    virtual ~DataReader() = default;
+    /// Returns pointer to `length` bytes at `offset`. Data is either read into `buffer` or referenced in place. Returns
+    /// null on failure.
+    virtual const uint8_t* read(int64_t offset, size_t length, ByteArray& buffer) = 0;
+    /// Returns start of first hole at or after `offset`, or `end` if there is none before it. Holes are regions of
+    /// sparse file that are not stored on disk and read as zeros.
+    virtual int64_t next_hole(int64_t offset, int64_t end) { (void)offset; return end; }
+    /// Returns start of first data region at or after `offset`, or `end` if there is none before it.
+    virtual int64_t next_data(int64_t offset, int64_t end) { (void)end; return offset; }
+};
+using DataReaderFactory = std::function<std::unique_ptr<DataReader>()>;
+
+/// Reads data from a file.
+class FileReader : public DataReader
+{
+public:
+    explicit FileReader(FILE* file)
+        : file_(file)
+    {
+#if _WIN32
+        file_ = duplicate_file(file, "rb");
+#endif
+    }
+
+    ~FileReader() override
+    {
+#if _WIN32
+        if (file_ != nullptr)
+            fclose(file_);
+#endif
+    }
+
+    const uint8_t* read(int64_t offset, size_t length, ByteArray& buffer) override
+    {
+        if (file_ == nullptr)
+            return nullptr;
+
+        if (buffer.size() < length || buffer.empty())
+            buffer.resize(std::max<size_t>(length, 1));
+
+        return read_at(file_, offset, buffer.data(), length) ? buffer.data() : nullptr;
+    }
+
+#if defined(SEEK_HOLE) && defined(SEEK_DATA)
+    int64_t next_hole(int64_t offset, int64_t end) override
+    {
+        auto fd = file_ != nullptr ? fileno(file_) : -1;
+        if (fd < 0)
+            return end;
+        auto result = lseek(fd, static_cast<off_t>(offset), SEEK_HOLE);
+        return result < 0 ? end : std::min<int64_t>(result, end);
+    }
+
+    int64_t next_data(int64_t offset, int64_t end) override
+    {
+        auto fd = file_ != nullptr ? fileno(file_) : -1;
+        if (fd < 0)
+            return offset;
+        auto result = lseek(fd, static_cast<off_t>(offset), SEEK_DATA);
+        if (result < 0)
+            return errno == ENXIO ? end : offset;       // ENXIO: only a hole remains until the end of file
+        return std::min<int64_t>(result, end);
+    }
+#endif
+
+protected:
+    FILE* file_;
+};
+
+/// References data in memory without copying it.
+class MemoryReader : public DataReader
+{
+public:
+    MemoryReader(const uint8_t* data, size_t size)
+        : data_(data)
+        , size_(size)
+    {
+    }
+
+    const uint8_t* read(int64_t offset, size_t length, ByteArray&) override
+    {
+        if (offset < 0 || static_cast<size_t>(offset) + length > size_)
+            return nullptr;
+        return data_ + offset;
+    }
+
+protected:
+    const uint8_t* data_;
+    size_t size_;
+};
+
+/// Range of input copied to memory by a reader thread. Queries about holes are forwarded to the source reader, regions
+/// of large holes are not copied at all.
+class BufferReader : public DataReader
+{
+public:
+    /// Copy range [start, end) from `source`. Holes shorter than `min_hole` are zero-filled entirely, longer ones only
+    /// `hole_edge` bytes at both ends. Returns false on failure.
+    bool fill(DataReader* source, int64_t start, int64_t end, int64_t min_hole, int64_t hole_edge)
+    {
+        source_ = source;
+        start_ = start;
+        end_ = end;
+        auto size = static_cast<size_t>(end - start);
+        if (capacity_ < size)
+        {
+            data_.reset(new uint8_t[size]);                         // Not initialized, most of it is overwritten
+            capacity_ = size;
+        }
+
+        valid_ = true;
+        for (auto offset = start; offset < end;)
+        {
+            auto hole_start = source->next_hole(offset, end);
+            if (hole_start > offset)
+            {
+                auto* data = source->read(offset, static_cast<size_t>(hole_start - offset), scratch_);
+                if (data == nullptr)
+                    return valid_ = false;
+                memcpy(&data_[offset - start], data, static_cast<size_t>(hole_start - offset));
+            }
+            auto hole_end = std::max(source->next_data(hole_start, end), hole_start);
+            auto hole_length = hole_end - hole_start;
+            if (hole_length < min_hole)
+                memset(&data_[hole_start - start], 0, static_cast<size_t>(hole_length));
+            else
+            {
+                auto edge = std::min(hole_edge, hole_length);
+                memset(&data_[hole_start - start], 0, static_cast<size_t>(edge));
+                memset(&data_[hole_end - start - edge], 0, static_cast<size_t>(edge));
+            }
+            offset = hole_end;
+        }
+        return true;
+    }
+
+    const uint8_t* read(int64_t offset, size_t length, ByteArray&) override
+    {
+        if (!valid_ || offset < start_ || offset + static_cast<int64_t>(length) > end_)
+            return nullptr;
+        return &data_[offset - start_];
+    }
+
+    int64_t next_hole(int64_t offset, int64_t end) override { return source_->next_hole(offset, end); }
+    int64_t next_data(int64_t offset, int64_t end) override { return source_->next_data(offset, end); }
+
+protected:
+    DataReader* source_ = nullptr;
+    ByteArray scratch_;
+    std::unique_ptr<uint8_t[]> data_;
+    size_t capacity_ = 0;
+    int64_t start_ = 0;
+    int64_t end_ = 0;
+    bool valid_ = false;
+};
+
+/// Options of for_each_range().
+struct RangeOptions
+{
+    /// Number of processing threads.
+    size_t workers;
+    /// Number of threads that read ranges sequentially and pass them to processing threads through a pool of buffers.
+    /// When 0, processing threads read data themselves.
+    size_t readers;
+    /// Holes shorter than this are read.
+    int64_t min_hole;
+    /// Number of bytes read at both ends of longer holes.
+    int64_t hole_edge;
+};
+
+/// Invoke `process(worker, index, reader)` for every item in [0, count) on `options.workers` threads. `range(index)`
+/// returns range of data that processing of an item reads. `worker` is index of processing thread. Processing stops
+/// when `process` returns false.
+void for_each_range(const DataReaderFactory& open_reader, size_t count,
+    const std::function<std::pair<int64_t, int64_t>(size_t index)>& range, const RangeOptions& options,
+    const std::function<bool(size_t worker, size_t index, DataReader* reader)>& process)
+{
+    std::atomic<size_t> next_index{0};
+    std::atomic<size_t> next_worker{0};
+
+    if (options.readers == 0)
+    {
+        // Every thread reads data it processes.
+        run_parallel(options.workers, [&]()
+        {
+            auto worker = next_worker++;
+            auto reader = open_reader();
+            for (auto index = next_index++; index < count; index = next_index++)
+            {
+                if (!process(worker, index, reader.get()))
+                    break;
+            }
+        });
+        return;
+    }
+
+    // Reader threads fill buffers from the pool in order of items, processing threads consume them.
+    std::mutex lock;
+    std::condition_variable buffer_freed;
+    std::condition_variable buffer_filled;
+    std::vector<std::unique_ptr<BufferReader>> buffers(options.readers + options.workers + 1);
+    std::vector<BufferReader*> free_buffers;
+    std::deque<std::pair<size_t, BufferReader*>> filled_buffers;
+    size_t readers_done = 0;
+    bool stop = false;
+    for (auto& buffer : buffers)
+    {
+        buffer.reset(new BufferReader());
+        free_buffers.emplace_back(buffer.get());
+    }
+
+    // Buffers forward hole queries to their source, sources must outlive reader threads.
+    std::vector<std::unique_ptr<DataReader>> sources;
+    for (size_t i = 0; i < options.readers; i++)
+        sources.emplace_back(open_reader());
+
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < options.readers; i++)
+    {
+        readers.emplace_back([&](DataReader* reader)
+        {
+            for (;;)
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                buffer_freed.wait(guard, [&]() { return stop || !free_buffers.empty(); });
+                auto index = next_index++;
+                if (stop || index >= count)
+                    break;
+                auto* buffer = free_buffers.back();
+                free_buffers.pop_back();
+                guard.unlock();
+
+                auto item = range(index);
+                buffer->fill(reader, item.first, item.second, options.min_hole, options.hole_edge);
+
+                guard.lock();
+                filled_buffers.emplace_back(index, buffer);
+                buffer_filled.notify_one();
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            readers_done++;
+            buffer_filled.notify_all();
+        }, sources[i].get());
+    }
+
+    run_parallel(options.workers, [&]()
+    {
+        auto worker = next_worker++;
+        for (;;)
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            buffer_filled.wait(guard, [&]() { return !filled_buffers.empty() || readers_done == options.readers; });
+            if (filled_buffers.empty())
+                break;
+            auto item = filled_buffers.front();
+            filled_buffers.pop_front();
+            guard.unlock();
+
+            auto success = process(worker, item.first, item.second);
+
+            guard.lock();
+            free_buffers.emplace_back(item.second);
+            if (!success)
+                stop = true;
+            buffer_freed.notify_all();
+        }
+    });
+
+    std::for_each(readers.begin(), readers.end(), std::mem_fn(&std::thread::join));
 }
 
 //////////////////////////////////////////////// file partitioning /////////////////////////////////////////////////////
 
-BoundaryList partition_file_task(FILE* file, size_t max_threads, std::atomic<int64_t>* bytes_done,
-    std::atomic<bool>* cancel, const Parameters* parameters)
+/// Compute fnv64a hash of a range. Holes are hashed without reading them.
+bool hash_range(DataReader* reader, int64_t start, int64_t length, ByteArray& buffer, uint64_t& hash)
+{
+    hash = fnv64a(nullptr, 0);
+    for (auto offset = start, end = start + length; offset < end;)
+    {
+        auto hole_start = reader->next_hole(offset, end);
+        if (hole_start > offset)
+        {
+            auto* data = reader->read(offset, static_cast<size_t>(hole_start - offset), buffer);
+            if (data == nullptr)
+                return false;
+            hash = fnv64a(data, static_cast<size_t>(hole_start - offset), hash);
+        }
+        auto hole_end = std::max(reader->next_data(hole_start, end), hole_start);
+        hash = fnv64a_zeros(static_cast<uint64_t>(hole_end - hole_start), hash);
+        offset = hole_end;
+    }
+    return true;
+}
+
+/// Calculate hashes of `count` blocks on `max_threads` threads, `range(index)` returns range of a block. Large blocks
+/// are split into leaves hashed in parallel when `Parameters::hash_leaf_size` is set. Blocks that could not be read are
+/// marked in `failed`.
+void hash_blocks(const DataReaderFactory& open_reader, size_t count,
+    const std::function<std::pair<int64_t, int64_t>(size_t index)>& range, size_t max_threads, size_t readers,
+    DividedProgress& progress, std::atomic<bool>* cancel, const Parameters* parameters, std::vector<uint64_t>& hashes,
+    std::vector<char>& failed)
 {
-    if (!file)
-        return {};
+    RangeOptions options{max_threads, readers, 0, 0};               // Holes are hashed without reading them
+    std::vector<ByteArray> buffers(max_threads);
+    hashes.assign(count, 0);
+    failed.assign(count, 0);
+    auto leaf_size = static_cast<int64_t>(parameters->hash_leaf_size);
+    if (leaf_size == 0)
+    {
+        for_each_range(open_reader, count, range, options, [&](size_t worker, size_t index, DataReader* wreader)
+        {
+            auto block = range(index);
+            if (!hash_range(wreader, block.first, block.second - block.first, buffers[worker], hashes[index]))
+                failed[index] = 1;
+            progress.consume(block.second - block.first);
+            return cancel == nullptr || !cancel->load(std::memory_order_relaxed);
+        });
+        return;
+    }
 
-    auto file_size = get_file_size(file);
+    // Tree mode. Leaves are hashed independently, therefore even a single large block is hashed by all threads.
+    std::vector<size_t> first_leaf(count + 1, 0);
+    for (size_t i = 0; i < count; i++)
+    {
+        auto block = range(i);
+        auto leaves = (block.second - block.first + leaf_size - 1) / leaf_size;
+        first_leaf[i + 1] = first_leaf[i] + static_cast<size_t>(leaves);
+    }
+    std::vector<uint64_t> leaf_hashes(first_leaf.back());
+    std::vector<char> leaf_failed(first_leaf.back(), 0);
+
+    auto leaf_range = [&](size_t leaf)
+    {
+        auto index = std::upper_bound(first_leaf.begin(), first_leaf.end(), leaf) - first_leaf.begin() - 1;
+        auto block = range(index);
+        auto start = block.first + static_cast<int64_t>(leaf - first_leaf[index]) * leaf_size;
+        return std::make_pair(start, std::min(start + leaf_size, block.second));
+    };
+
+    for_each_range(open_reader, leaf_hashes.size(), leaf_range, options,
+        [&](size_t worker, size_t leaf, DataReader* wreader)
+    {
+        auto leaf_data = leaf_range(leaf);
+        auto length = leaf_data.second - leaf_data.first;
+        if (!hash_range(wreader, leaf_data.first, length, buffers[worker], leaf_hashes[leaf]))
+            leaf_failed[leaf] = 1;
+        progress.consume(length);
+        return cancel == nullptr || !cancel->load(std::memory_order_relaxed);
+    });
+
+    for (size_t i = 0; i < count; i++)
+    {
+        hashes[i] = fnv64a_combine(&leaf_hashes[first_leaf[i]], first_leaf[i + 1] - first_leaf[i]);
+        auto leaves_end = leaf_failed.begin() + first_leaf[i + 1];
+        failed[i] = std::find(leaf_failed.begin() + first_leaf[i], leaves_end, 1) != leaves_end;
+    }
+}
+
+BoundaryList partition_task(DataReaderFactory open_reader, int64_t file_size, size_t max_threads, size_t readers,
+    std::atomic<int64_t>* bytes_done, std::atomic<bool>* cancel, const Parameters* parameters)
+{
+    auto reader = open_reader();
+
+    // Notify user when task ends, no matter if it was completed or cancelled.
+    struct CompletionNotifier
+    {
+        const Parameters* parameters;
+        ~CompletionNotifier()
+        {
+            if (parameters->on_complete)
+                parameters->on_complete();
+        }
+    } notifier{parameters};
 
     if (max_threads == 0)
         max_threads = std::thread::hardware_concurrency();
@@ -203,87 +534,116 @@ BoundaryList partition_file_task(FILE* file, size_t max_threads, std::atomic<int
     BoundaryList result;
     result.resize(1);                                               // File start always contains a fake split point.
 
-    DividedProgress progress(file_size, 2, bytes_done);             // Will process file twice
+    DividedProgress progress(file_size, 2, bytes_done, parameters); // Will process file twice
+
+    // Holes are skipped only when fingerprint of zeros can not be a split point, otherwise every position in a hole
+    // would be one.
+    const int64_t min_hole_size = parameters->window_length + 64 * 1024;
+    uint32_t zero_fingerprint;
+    {
+        ByteArray zeros(parameters->window_length);
+        zero_fingerprint = buzhash(zeros.data(), parameters->window_length);
+    }
+    const bool can_skip_holes = (zero_fingerprint & ((1U << parameters->match_bits) - 1U)) != 0;
 
     // Partition file
     {
-        std::mutex result_lock{};
-        std::function<void(int64_t, int64_t, FILE*)> worker([&](int64_t start_offset, int64_t end_offset, FILE* wfile)
+        // File is scanned in small work units handed out to threads dynamically. Unit scans positions in it's own
+        // range, reading up to one window past it, therefore every position of the file is scanned exactly once no
+        // matter how many threads are used.
+        auto window_length = parameters->window_length;
+        const auto scan_limit = file_size - static_cast<int64_t>(window_length);  // Last window of file is not scanned
+        const auto unit_size = std::max<int64_t>(work_unit_size, 16 * window_length);
+        const auto unit_count = static_cast<size_t>((file_size + unit_size - 1) / unit_size);
+        const auto max_count = static_cast<int64_t>(parameters->read_buffer_size) - window_length;
+        std::vector<BoundaryList> local_results(max_threads);
+        std::vector<ByteArray> buffers(max_threads);
+
+        // Returns range of positions scanned by the unit and range of data it reads.
+        auto unit_range = [&](size_t unit, int64_t& unit_start, int64_t& unit_end, int64_t& scan_end, int64_t& data_end)
         {
-            BoundaryList local_result;
-            wfile = duplicate_file(wfile, "rb");
-            assert(wfile);
-
-            int64_t length = end_offset - start_offset;
-            std::vector<uint8_t> buffer;
-            buffer.resize(parameters->read_buffer_size, 0);
-            auto sz = buffer.size();
-            (void)(sz);
-
-            const auto mask = (1U << parameters->match_bits) - 1U;
-            auto buffer_size = std::min<int64_t>(length, parameters->read_buffer_size);
-
-            fseek(wfile, start_offset, SEEK_SET);
-            int64_t read = fread(&buffer[0], 1, static_cast<size_t>(buffer_size), wfile);
-            if (read != buffer_size)
+            unit_start = static_cast<int64_t>(unit) * unit_size;
+            unit_end = std::min(unit_start + unit_size, file_size);
+            scan_end = std::min(unit_end, scan_limit);
+            data_end = std::max(scan_end, unit_start) + window_length;
+        };
+
+        RangeOptions options{max_threads, readers, can_skip_holes ? min_hole_size : INT64_MAX, window_length};
+        std::atomic<bool> read_failed{false};
+        for_each_range(open_reader, unit_count, [&](size_t unit)
+        {
+            int64_t unit_start, unit_end, scan_end, data_end;
+            unit_range(unit, unit_start, unit_end, scan_end, data_end);
+            return std::make_pair(unit_start, std::min(data_end, file_size));
+        }, options, [&](size_t worker, size_t unit, DataReader* wreader)
+        {
+            int64_t unit_start, unit_end, scan_end, data_end;
+            unit_range(unit, unit_start, unit_end, scan_end, data_end);
+            auto position = unit_start;
+            uint32_t fingerprint = 0;
+            bool have_fingerprint = false;
+            int64_t hole_start = data_end;
+            int64_t hole_end = data_end;
+            auto& buffer = buffers[worker];
+
+            // Find next hole worth skipping.
+            auto find_hole = [&](int64_t offset)
             {
-                fclose(wfile);
-                return;
-            }
-
-            auto* data = &buffer[0];
-            auto* data_start = data;
-            auto window_length = parameters->window_length;
-            auto fingerprint = buzhash(data, window_length);
+                for (;;)
+                {
+                    hole_start = wreader->next_hole(offset, data_end);
+                    hole_end = std::max(wreader->next_data(hole_start, data_end), hole_start);
+                    if (hole_start >= data_end || hole_end - hole_start >= min_hole_size)
+                        return;
+                    offset = hole_end;
+                }
+            };
+            if (can_skip_holes && position < scan_end)
+                find_hole(position);
 
-            do
+            while (position < scan_end)
             {
-                for (auto* end = data_start + buffer_size - window_length; data < end;)
+                if (position >= hole_start)
                 {
-                    if ((fingerprint & mask) == 0)
+                    // Windows that fit into a hole all have same fingerprint which never matches. Resume scanning at
+                    // last such window.
+                    auto skip_to = std::min<int64_t>(hole_end - window_length, scan_end);
+                    if (skip_to > position)
                     {
-                        auto block_start = start_offset + (data - data_start);
-                        local_result.emplace_back(Boundary{.start = block_start, .fingerprint = fingerprint, .hash = 0, .length = 0});
+                        position = skip_to;
+                        fingerprint = zero_fingerprint;
+                        have_fingerprint = true;
                     }
-
-                    fingerprint = buzhash_update(fingerprint, data[0], data[window_length], window_length);
-                    data++;
+                    find_hole(hole_end);
+                    continue;
                 }
 
-                auto bytes_consumed = buffer_size - std::min<int64_t>(window_length, buffer_size);
-
-                progress.consume(bytes_consumed);
-
-                length -= bytes_consumed;
-                start_offset += bytes_consumed;
-
-                if (cancel != nullptr && cancel->load(std::memory_order_relaxed))
+                auto count = std::min(std::min(scan_end, hole_start) - position, max_count);
+                auto* data = wreader->read(position, static_cast<size_t>(count + window_length), buffer);
+                if (data == nullptr)
                 {
-                    fclose(wfile);
-                    return;
+                    read_failed = true;
+                    return false;
                 }
 
-                buffer_size = std::min<int64_t>(length, parameters->read_buffer_size);
-                fseek(wfile, start_offset, SEEK_SET);
-                read = fread(&buffer[0], 1, static_cast<size_t>(buffer_size), wfile);
-                if (read != buffer_size)
+                if (!have_fingerprint)
                 {
-                    fclose(wfile);
-                    return;
+                    fingerprint = buzhash(data, window_length);
+                    have_fingerprint = true;
                 }
-                data = data_start;
-            } while (length > window_length);
-
-            progress.consume(length);
+                fingerprint = find_split_points(data, static_cast<size_t>(count), fingerprint, position, *parameters,
+                    local_results[worker]);
+                position += count;
+            }
 
-            fclose(wfile);
+            progress.consume(unit_end - unit_start);
+            return cancel == nullptr || !cancel->load(std::memory_order_relaxed);
+        });
+        if (read_failed)
+            return BoundaryList{};
 
-            // Insert results to main collection. This is done at the end in order to reduce contention on result_lock.
-            result_lock.lock();
+        for (const auto& local_result : local_results)
             result.insert(result.end(), local_result.begin(), local_result.end());
-            result_lock.unlock();
-        });
-        parallel_for(0L, file_size, (int)max_threads, worker, file);
         // Results were appended out of order. We need them sorted.
         std::sort(result.begin(), result.end(), [](const Boundary& a, const Boundary& b) { return a.start < b.start; });
     }
@@ -306,10 +666,61 @@ BoundaryList partition_file_task(FILE* file, size_t max_threads, std::atomic<int
         }
     }
 
-    // Split big blocks into smaller ones
-    auto prev_offset = 0L;
-    std::vector<uint8_t> buffer;
-    buffer.resize(parameters->window_length);
+    ByteArray buffer;
+    if (parameters->archive_boundaries)
+    {
+        // Members long enough to have blocks of their own and the last member, which usually is a small index, start
+        // at forced boundaries. Split points closer than `min_block_size` to forced boundaries are removed, therefore
+        // blocks of a member do not depend on what precedes it.
+        auto members = detail::find_archive_members([&](int64_t offset, size_t length)
+        {
+            return reader->read(offset, length, buffer);
+        }, file_size);
+        std::vector<int64_t> forced;
+        for (size_t i = 0; i < members.size(); i++)
+        {
+            auto member_end = i + 1 < members.size() ? members[i + 1] : file_size;
+            if (members[i] > 0 && (member_end - members[i] >= parameters->min_block_size || i + 1 == members.size()))
+                forced.push_back(members[i]);
+        }
+
+        BoundaryList merged;
+        merged.reserve(result.size() + forced.size());
+        merged.push_back(result[0]);
+        size_t next_forced = 0;
+        auto push_forced = [&](int64_t start)
+        {
+            auto len = static_cast<uint32_t>(std::min<int64_t>(parameters->window_length, file_size - start));
+            auto* data = reader->read(start, len, buffer);
+            if (data == nullptr)
+                return false;
+            merged.emplace_back(Boundary{.start = start, .fingerprint = buzhash(data, len), .hash = 0, .length = 0});
+            return true;
+        };
+        for (size_t i = 1; i < result.size(); i++)
+        {
+            auto start = result[i].start;
+            for (; next_forced < forced.size() && forced[next_forced] < start; next_forced++)
+            {
+                if (!push_forced(forced[next_forced]))
+                    return BoundaryList{};
+            }
+            auto near_previous = next_forced > 0 && start - forced[next_forced - 1] < parameters->min_block_size;
+            auto near_next = next_forced < forced.size() && forced[next_forced] - start < parameters->min_block_size;
+            if (!near_previous && !near_next)
+                merged.push_back(result[i]);
+        }
+        for (; next_forced < forced.size(); next_forced++)
+        {
+            if (!push_forced(forced[next_forced]))
+                return BoundaryList{};
+        }
+        result = std::move(merged);
+    }
+
+    // Split big blocks into smaller ones. Fake split point at the end of file ensures last block is split as well.
+    int64_t prev_offset = 0;
+    result.emplace_back(Boundary{.start = file_size, .fingerprint = 0, .hash = 0, .length = 0});
 
     for (auto it = result.begin(); it != result.end(); it++)
     {
@@ -322,34 +733,32 @@ BoundaryList partition_file_task(FILE* file, size_t max_threads, std::atomic<int
             auto new_block_size = block_size / (new_blocks_count + 1);
             BoundaryList splits;
 
-            for (auto i = 1L; i < new_blocks_count + 1; i++)
+            for (int64_t i = 1; i < new_blocks_count + 1; i++)
             {
                 auto start = split.start - (i * new_block_size);
-                fseek(file, start, SEEK_SET);
-                auto len = fread(&buffer[0], 1, parameters->window_length, file);
-                auto fingerprint = buzhash(&buffer[0], static_cast<uint32_t>(len));
+                auto len = static_cast<uint32_t>(std::min<int64_t>(parameters->window_length, file_size - start));
+                auto* data = reader->read(start, len, buffer);
+                if (data == nullptr)
+                    return BoundaryList{};
+                auto fingerprint = buzhash(data, len);
                 splits.emplace_back(Boundary{.start = start, .fingerprint = fingerprint, .hash = 0, .length = 0});
             }
 
             it = result.insert(it, splits.rbegin(), splits.rend()) + splits.size();
         }
     }
+    result.pop_back();
 
-    // Finalize fake split point
+    // Finalize fake split point. Its hash is calculated along with other blocks.
     {
-        auto first_block_size = result.size() > 1 ? result[1].start : file_size;
-        if (buffer.size() < static_cast<size_t>(first_block_size))
-            buffer.resize(static_cast<unsigned long>(first_block_size));
-
         result[0] = Boundary{.start = 0, .fingerprint = 0, .hash = 0, .length = 0};
 
-        fseek(file, 0, SEEK_SET);
-        auto len = fread(&buffer[0], 1, parameters->window_length, file);
-        result[0].fingerprint = buzhash(&buffer[0], static_cast<uint32_t>(len));
-
-        fseek(file, 0, SEEK_SET);
-        len = fread(&buffer[0], 1, static_cast<size_t>(first_block_size), file);
-        result[0].hash = fnv64a(&buffer[0], len);
+        auto len = static_cast<uint32_t>(std::min<int64_t>(parameters->window_length, file_size));
+        auto* data = len > 0 ? reader->read(0, len, buffer) : nullptr;
+        if (data != nullptr)
+            result[0].fingerprint = buzhash(data, len);
+        else if (len > 0)
+            return BoundaryList{};
     }
 
     // Calculate block lengths
@@ -360,40 +769,140 @@ BoundaryList partition_file_task(FILE* file, size_t max_threads, std::atomic<int
         block.length = next_block_start - block.start;
     }
 
-    parallel_for(0UL, result.size(), (int)max_threads, std::function<void(unsigned long, unsigned long, FILE*)>(
-        [&](unsigned long item_start, unsigned long item_end, FILE* wfile)
+    // Calculate block hashes
+    std::vector<uint64_t> hashes;
+    std::vector<char> failed;
+    hash_blocks(open_reader, result.size(), [&](size_t index)
     {
-        wfile = duplicate_file(wfile, "rb");
-        assert(wfile);
+        return std::make_pair(result[index].start, result[index].start + result[index].length);
+    }, max_threads, readers, progress, cancel, parameters, hashes, failed);
+    for (size_t i = 0; i < result.size(); i++)
+    {
+        if (failed[i])
+            return BoundaryList{};
+        result[i].hash = hashes[i];
+    }
+
+    progress.flush();
+
+    return result;
+}
+
+std::future<BoundaryList> partition_file(FILE* file, size_t max_threads, std::atomic<int64_t>* bytes_done,
+    int64_t* bytes_to_process, std::atomic<bool>* cancel, const Parameters* parameters)
+{
+    if (bytes_done != nullptr)
+        bytes_done->exchange(0);
 
-        std::vector<uint8_t> wbuffer;
-        for (auto i = item_start; i < item_end; i++)
+    if (parameters == nullptr)
+        parameters = &default_parameters;
+
+    auto file_size = get_file_size(file);
+    if (bytes_to_process != nullptr)
+        *bytes_to_process = file_size;
+
+    if (file == nullptr)
+    {
+        return std::async(std::launch::deferred, [parameters]()
         {
-            auto& block = result[i];
-            fseek(wfile, block.start, SEEK_SET);
-            if (wbuffer.size() < static_cast<size_t>(block.length))
-                wbuffer.resize(static_cast<size_t>(block.length));
+            if (parameters->on_complete)
+                parameters->on_complete();
+            return BoundaryList{};
+        });
+    }
 
-            auto len = fread(&wbuffer[0], 1, static_cast<size_t>(block.length), wfile);
-            block.hash = fnv64a(&wbuffer[0], len);
-            progress.consume(block.length);
-            if (cancel != nullptr && cancel->load(std::memory_order_relaxed))
-            {
-                fclose(wfile);
-                break;
-            }
+    // Concurrent readers make rotational disks seek back and forth, file is read sequentially by a single thread then.
+    size_t readers = 0;
+    if (parameters->reader_threads >= 0)
+        readers = static_cast<size_t>(parameters->reader_threads);
+    else if (is_rotational(file))
+        readers = 1;
+
+    DataReaderFactory open_reader = [file]() { return std::unique_ptr<DataReader>(new FileReader(file)); };
+    return std::async(std::launch::async, &partition_task, open_reader, file_size, max_threads, readers, bytes_done,
+        cancel, parameters);
+}
+
+std::future<BoundaryList> partition_buffer(const uint8_t* data, size_t size, size_t max_threads,
+    std::atomic<int64_t>* bytes_done, int64_t* bytes_to_process, std::atomic<bool>* cancel,
+    const Parameters* parameters)
+{
+    if (bytes_done != nullptr)
+        bytes_done->exchange(0);
+
+    if (parameters == nullptr)
+        parameters = &default_parameters;
+
+    if (bytes_to_process != nullptr)
+        *bytes_to_process = static_cast<int64_t>(size);
+
+    if (data == nullptr)
+    {
+        return std::async(std::launch::deferred, [parameters]()
+        {
+            if (parameters->on_complete)
+                parameters->on_complete();
+            return BoundaryList{};
+        });
+    }
+
+    DataReaderFactory open_reader = [data, size]()
+    {
+        return std::unique_ptr<DataReader>(new MemoryReader(data, size));
+    };
+    return std::async(std::launch::async, &partition_task, open_reader, static_cast<int64_t>(size), max_threads,
+        static_cast<size_t>(std::max(parameters->reader_threads, 0)), bytes_done, cancel, parameters);
+}
+
+std::vector<size_t> verify_task(DataReaderFactory open_reader, int64_t file_size, const CompactBoundaryList* blocks,
+    size_t max_threads, size_t readers, std::atomic<int64_t>* bytes_done, std::atomic<bool>* cancel,
+    const Parameters* parameters)
+{
+    struct CompletionNotifier
+    {
+        const Parameters* parameters;
+        ~CompletionNotifier()
+        {
+            if (parameters->on_complete)
+                parameters->on_complete();
         }
+    } notifier{parameters};
 
-        fclose(wfile);
-    }), file);
+    if (max_threads == 0)
+        max_threads = std::thread::hardware_concurrency();
+    max_threads = std::max<size_t>(max_threads, 1);
 
+    // Blocks past the end of file do not match and are not read.
+    std::vector<int64_t> starts;
+    starts.reserve(blocks->size());
+    for (auto it = blocks->begin(); it != blocks->end(); ++it)
+        starts.push_back((*it).start);
+    auto present = static_cast<size_t>(std::lower_bound(starts.begin(), starts.end(), file_size) - starts.begin());
+    if (present > 0 && starts[present - 1] + blocks->length(present - 1) > file_size)
+        present--;
+
+    DividedProgress progress(present > 0 ? starts[present - 1] + blocks->length(present - 1) : 0, 1, bytes_done,
+        parameters);
+    std::vector<uint64_t> hashes;
+    std::vector<char> failed;
+    hash_blocks(open_reader, present, [&](size_t index)
+    {
+        return std::make_pair(starts[index], starts[index] + blocks->length(index));
+    }, max_threads, readers, progress, cancel, parameters, hashes, failed);
     progress.flush();
 
+    std::vector<size_t> result;
+    for (size_t i = 0; i < blocks->size(); i++)
+    {
+        if (i >= present || failed[i] || hashes[i] != blocks->hash(i))
+            result.push_back(i);
+    }
     return result;
 }
 
-std::future<BoundaryList> partition_file(FILE* file, size_t max_threads, std::atomic<int64_t>* bytes_done,
-    int64_t* bytes_to_process, std::atomic<bool>* cancel, const Parameters* parameters)
+std::future<std::vector<size_t>> verify_file(FILE* file, const CompactBoundaryList& blocks, size_t max_threads,
+    std::atomic<int64_t>* bytes_done, int64_t* bytes_to_process, std::atomic<bool>* cancel,
+    const Parameters* parameters)
 {
     if (bytes_done != nullptr)
         bytes_done->exchange(0);
@@ -401,19 +910,164 @@ std::future<BoundaryList> partition_file(FILE* file, size_t max_threads, std::at
     if (parameters == nullptr)
         parameters = &default_parameters;
 
+    auto file_size = get_file_size(file);
     if (bytes_to_process != nullptr)
-        *bytes_to_process = get_file_size(file);
+        *bytes_to_process = std::min(file_size, blocks.file_size());
+
+    size_t readers = 0;
+    if (parameters->reader_threads >= 0)
+        readers = static_cast<size_t>(parameters->reader_threads);
+    else if (file != nullptr && is_rotational(file))
+        readers = 1;
 
-    return std::async(std::launch::async, &partition_file_task, file, max_threads, bytes_done, cancel, parameters);
+    DataReaderFactory open_reader = [file]() { return std::unique_ptr<DataReader>(new FileReader(file)); };
+    return std::async(std::launch::async, &verify_task, open_reader, file != nullptr ? file_size : 0, &blocks,
+        max_threads, readers, bytes_done, cancel, parameters);
+}
+
+std::vector<BlockSketch> sketch_task(DataReaderFactory open_reader, const CompactBoundaryList* blocks,
+    size_t max_threads, size_t readers, std::atomic<int64_t>* bytes_done, std::atomic<bool>* cancel,
+    const Parameters* parameters)
+{
+    struct CompletionNotifier
+    {
+        const Parameters* parameters;
+        ~CompletionNotifier()
+        {
+            if (parameters->on_complete)
+                parameters->on_complete();
+        }
+    } notifier{parameters};
+
+    if (max_threads == 0)
+        max_threads = std::thread::hardware_concurrency();
+    max_threads = std::max<size_t>(max_threads, 1);
+
+    std::vector<int64_t> starts;
+    starts.reserve(blocks->size());
+    for (auto it = blocks->begin(); it != blocks->end(); ++it)
+        starts.push_back((*it).start);
+
+    DividedProgress progress(blocks->file_size(), 1, bytes_done, parameters);
+    std::vector<BlockSketch> result(blocks->size(), BlockSketch{});
+    std::vector<ByteArray> buffers(max_threads);
+    auto range = [&](size_t index) { return std::make_pair(starts[index], starts[index] + blocks->length(index)); };
+    RangeOptions options{max_threads, readers, INT64_MAX, 0};
+    for_each_range(open_reader, blocks->size(), range, options, [&](size_t worker, size_t index, DataReader* reader)
+    {
+        auto length = static_cast<size_t>(blocks->length(index));
+        if (const auto* data = reader->read(starts[index], length, buffers[worker]))
+            result[index] = block_sketch(data, length);
+        progress.consume(blocks->length(index));
+        return cancel == nullptr || !cancel->load(std::memory_order_relaxed);
+    });
+    progress.flush();
+    return result;
+}
+
+std::future<std::vector<BlockSketch>> sketch_file(FILE* file, const CompactBoundaryList& blocks, size_t max_threads,
+    std::atomic<int64_t>* bytes_done, int64_t* bytes_to_process, std::atomic<bool>* cancel,
+    const Parameters* parameters)
+{
+    if (bytes_done != nullptr)
+        bytes_done->exchange(0);
+
+    if (parameters == nullptr)
+        parameters = &default_parameters;
+
+    if (bytes_to_process != nullptr)
+        *bytes_to_process = blocks.file_size();
+
+    size_t readers = 0;
+    if (parameters->reader_threads >= 0)
+        readers = static_cast<size_t>(parameters->reader_threads);
+    else if (file != nullptr && is_rotational(file))
+        readers = 1;
+
+    DataReaderFactory open_reader = [file]() { return std::unique_ptr<DataReader>(new FileReader(file)); };
+    return std::async(std::launch::async, &sketch_task, open_reader, &blocks, max_threads, readers, bytes_done, cancel,
+        parameters);
 }
 
 //////////////////////////////////////////////// file comparison ///////////////////////////////////////////////////////
 
-std::unordered_map<int64_t, std::vector<const Boundary*>> create_boundary_lookup_table(const BoundaryList& boundary_list)
+/// Lists with fewer blocks are compared on a single thread.
+const size_t min_parallel_compare_blocks = 16 * 1024;
+/// Number of remote blocks a thread looks up at once.
+const size_t compare_batch_size = 1024;
+
+/// Returns number of threads used for comparing `count` blocks.
+size_t compare_threads(size_t count, size_t max_threads)
 {
-    std::unordered_map<int64_t, std::vector<const Boundary*>> result;
+    if (count < min_parallel_compare_blocks)
+        return 1;
+    if (max_threads == 0)
+        max_threads = std::thread::hardware_concurrency();
+    return std::max<size_t>(max_threads, 1);
+}
+
+/// Returns number of top hash bits selecting a shard, so that there are at least as many shards as threads.
+unsigned shard_bits(size_t num_threads)
+{
+    unsigned bits = 0;
+    while ((1ULL << bits) < num_threads)
+        bits++;
+    return bits;
+}
+
+/// Returns shard of the block with `hash`.
+inline size_t shard_of(uint64_t hash, unsigned bits)
+{
+    return bits == 0 ? 0 : static_cast<size_t>(hash >> (64U - bits));
+}
+
+/// Run `worker(first, last)` for batches of `count` items on `num_threads` threads.
+void for_each_batch(size_t count, size_t num_threads, const std::function<void(size_t first, size_t last)>& worker)
+{
+    std::atomic<size_t> next{0};
+    run_parallel(num_threads, [&]()
+    {
+        for (auto first = next.fetch_add(compare_batch_size); first < count; first = next.fetch_add(compare_batch_size))
+            worker(first, std::min(count, first + compare_batch_size));
+    });
+}
+
+/// Local blocks indexed by hash. Index is split into shards by top bits of hash, every shard is built by one thread.
+/// Blocks with equal hashes are listed in their order in local file.
+using BoundaryLookupShard = std::unordered_map<uint64_t, std::vector<const Boundary*>>;
+
+std::vector<BoundaryLookupShard> create_boundary_lookup_table(const BoundaryList& boundary_list, size_t num_threads,
+    unsigned bits)
+{
+    // Blocks are distributed to shards once, in their order in local file. Every thread then indexes blocks of its own
+    // shard only.
+    std::vector<size_t> shard_ends(1ULL << bits);
     for (const auto& boundary : boundary_list)
-        result[boundary.hash].emplace_back(&boundary);
+        shard_ends[shard_of(boundary.hash, bits)]++;
+    for (size_t shard = 1; shard < shard_ends.size(); shard++)
+        shard_ends[shard] += shard_ends[shard - 1];
+
+    std::vector<const Boundary*> sharded(boundary_list.size());
+    {
+        std::vector<size_t> positions(shard_ends.size());
+        for (size_t shard = 1; shard < shard_ends.size(); shard++)
+            positions[shard] = shard_ends[shard - 1];
+        for (const auto& boundary : boundary_list)
+            sharded[positions[shard_of(boundary.hash, bits)]++] = &boundary;
+    }
+
+    std::vector<BoundaryLookupShard> result(shard_ends.size());
+    std::atomic<size_t> next{0};
+    run_parallel(num_threads, [&]()
+    {
+        for (auto shard = next++; shard < result.size(); shard = next++)
+        {
+            auto first = shard > 0 ? shard_ends[shard - 1] : 0;
+            result[shard].reserve(shard_ends[shard] - first);
+            for (auto i = first; i < shard_ends[shard]; i++)
+                result[shard][sharded[i]->hash].emplace_back(sharded[i]);
+        }
+    });
     return result;
 }
 
@@ -424,27 +1078,229 @@ bool intersects(const Boundary& a, const Boundary& b)
     return (b.start <= a.start && a.start < b_end) || (a.start <= b.start && b.start < a_end);
 }
 
-SyncOperationList compare_files(const BoundaryList& local_file, const BoundaryList& remote_file)
+/// Status of remote block after looking it up in local file.
+enum BlockStatus
 {
-    SyncOperationList result;
-    result.reserve(remote_file.size());
+    NotFound,               // Block is not present in local file
+    Copied,                 // Block is present in local file and can be copied
+    Present,                // Block is present in local file at required location, no action needed
+};
 
-    auto local_file_table = create_boundary_lookup_table(local_file);
+/// Result of looking up remote block in local file.
+struct BlockMatch
+{
+    BlockStatus status;
+    /// Local block to copy from when status is `Copied`.
+    size_t local;
+};
 
-    // Iterate remote file and produce instructions to reassemble remote file from pieces available locally.
-    for (const auto& block : remote_file)
+/// Operation on blocks of CompactBoundaryList with resolved block positions.
+struct CompactOperationRanges
+{
+    CompactSyncOperation operation;
+    int64_t remote_start;
+    int64_t local_start;
+    int64_t length;
+    uint64_t hash;
+    uint64_t fingerprint;
+};
+
+inline int64_t destination_of(const SyncOperation& operation) { return operation.remote->start; }
+inline int64_t source_of(const SyncOperation& operation) { return operation.local->start; }
+inline int64_t length_of(const SyncOperation& operation) { return operation.remote->length; }
+inline bool has_source(const SyncOperation& operation) { return operation.local != nullptr; }
+inline void drop_source(SyncOperation& operation) { operation.local = nullptr; }
+inline bool overwrites_source(const SyncOperation& writer, const SyncOperation& reader)
+{
+    return intersects(*writer.remote, *reader.local);
+}
+
+inline int64_t destination_of(const CompactOperationRanges& operation) { return operation.remote_start; }
+inline int64_t source_of(const CompactOperationRanges& operation) { return operation.local_start; }
+inline int64_t length_of(const CompactOperationRanges& operation) { return operation.length; }
+inline bool has_source(const CompactOperationRanges& operation)
+{
+    return operation.operation.local != CompactSyncOperation::npos;
+}
+inline void drop_source(CompactOperationRanges& operation) { operation.operation.local = CompactSyncOperation::npos; }
+inline bool overwrites_source(const CompactOperationRanges& writer, const CompactOperationRanges& reader)
+{
+    return intersects(Boundary{.start = writer.remote_start, .fingerprint = 0, .hash = 0, .length = writer.length},
+                      Boundary{.start = reader.local_start, .fingerprint = 0, .hash = 0, .length = reader.length});
+}
+
+inline bool is_zero_block(const SyncOperation& operation, const Parameters* parameters)
+{
+    return is_zero_block(*operation.remote, parameters);
+}
+inline uint64_t block_hash(const SyncOperation& operation) { return operation.remote->hash; }
+inline bool same_block(const SyncOperation& a, const SyncOperation& b)
+{
+    return a.remote->hash == b.remote->hash && a.remote->fingerprint == b.remote->fingerprint &&
+        a.remote->length == b.remote->length;
+}
+inline void copy_from_remote(SyncOperation& operation, const SyncOperation& source)
+{
+    operation.local = source.remote;
+    operation.from_remote = true;
+}
+
+inline bool is_zero_block(const CompactOperationRanges& operation, const Parameters* parameters)
+{
+    return is_zero_block(Boundary{.start = operation.remote_start, .fingerprint = operation.fingerprint,
+        .hash = operation.hash, .length = operation.length}, parameters);
+}
+inline uint64_t block_hash(const CompactOperationRanges& operation) { return operation.hash; }
+inline bool same_block(const CompactOperationRanges& a, const CompactOperationRanges& b)
+{
+    return a.hash == b.hash && a.fingerprint == b.fingerprint && a.length == b.length;
+}
+inline void copy_from_remote(CompactOperationRanges& operation, const CompactOperationRanges& source)
+{
+    operation.operation.local = source.operation.remote;
+    operation.operation.from_remote = true;
+    operation.local_start = source.remote_start;
+}
+
+/// Reorder operations so that data is copied from local file before it is overwritten. Operations must be ordered by
+/// destination, like compare_files() produces them, therefore operations overwriting a source are found by binary
+/// search. Every operation is emitted after operations reading its destination, which are pulled in front of it by a
+/// depth first search. Circular dependencies are solved by downloading a block instead of copying it.
+template<typename Operation>
+void sort_operations(std::vector<Operation>& result)
+{
+    // Operations reading destination of operation `i` are readers[reader_begin[i]] to readers[reader_begin[i + 1]].
+    std::vector<std::pair<size_t, size_t>> edges;    // Writer and reader.
+    for (size_t i = 0; i < result.size(); i++)
+    {
+        if (!has_source(result[i]))
+            continue;
+        auto source = source_of(result[i]);
+        auto compare = [](const Operation& operation, int64_t offset)
+        {
+            return destination_of(operation) + length_of(operation) <= offset;
+        };
+        auto writer = std::lower_bound(result.begin(), result.end(), source, compare);
+        for (; writer != result.end() && destination_of(*writer) < source + length_of(result[i]); ++writer)
+        {
+            auto index = static_cast<size_t>(writer - result.begin());
+            if (index != i && overwrites_source(*writer, result[i]))
+                edges.emplace_back(index, i);
+        }
+    }
+    std::vector<size_t> reader_begin(result.size() + 1);
+    for (const auto& edge : edges)
+        reader_begin[edge.first + 1]++;
+    for (size_t i = 1; i < reader_begin.size(); i++)
+        reader_begin[i] += reader_begin[i - 1];
+    std::vector<size_t> readers(edges.size());
+    {
+        auto positions = reader_begin;
+        for (const auto& edge : edges)
+            readers[positions[edge.first]++] = edge.second;
+    }
+
+    enum Visit : uint8_t { Unvisited, Visiting, Visited };
+    std::vector<Visit> visits(result.size(), Unvisited);
+    std::vector<std::pair<size_t, size_t>> stack;    // Operation and its next reader.
+    std::vector<Operation> sorted;
+    sorted.reserve(result.size());
+    for (size_t root = 0; root < result.size(); root++)
+    {
+        if (visits[root] != Unvisited)
+            continue;
+        visits[root] = Visiting;
+        stack.emplace_back(root, reader_begin[root]);
+        while (!stack.empty())
+        {
+            auto operation = stack.back().first;
+            auto edge = stack.back().second++;
+            if (edge == reader_begin[operation + 1])
+            {
+                visits[operation] = Visited;
+                sorted.push_back(result[operation]);
+                stack.pop_back();
+                continue;
+            }
+
+            auto reader = readers[edge];
+            if (!has_source(result[reader]))
+                continue;
+            if (visits[reader] == Visiting)
+            {
+                // Reader comes after this operation already, yet it reads destination of this operation. Force block
+                // download.
+
+                drop_source(result[reader]);
+            }
+            else if (visits[reader] == Unvisited)
+            {
+                visits[reader] = Visiting;
+                stack.emplace_back(reader, reader_begin[reader]);
+            }
+        }
+    }
+    result.swap(sorted);
+}
+
+/// Download every distinct block only once. Zero blocks are not downloaded at all, therefore they are left alone.
+/// Repeated downloads are replaced with copies from location written by first download and moved to the end of the
+/// list. At that point all other operations are done reading local data, and locations written by downloads are never
+/// written again.
+template<typename Operation>
+void deduplicate_downloads(std::vector<Operation>& operations, const Parameters* parameters)
+{
+    std::unordered_map<uint64_t, std::vector<size_t>> downloads;    // Block hash -> indices of first downloads
+    std::vector<Operation> duplicates;
+    size_t kept = 0;
+    for (size_t i = 0; i < operations.size(); i++)
     {
-        enum Status
+        auto operation = operations[i];
+        if (!has_source(operation) && !is_zero_block(operation, parameters))
         {
-            NotFound,               // Block is not present in local file
-            Copied,                 // Block is present in local file and can be copied
-            Present,                // Block is present in local file at required location, no action needed
-        } status = NotFound;
+            auto& candidates = downloads[block_hash(operation)];
+            auto it = std::find_if(candidates.begin(), candidates.end(), [&](size_t index)
+            {
+                return same_block(operations[index], operation);
+            });
+
+            if (it != candidates.end())
+            {
+                copy_from_remote(operation, operations[*it]);
+                duplicates.emplace_back(operation);
+                continue;
+            }
+            candidates.emplace_back(kept);
+        }
+        operations[kept++] = operation;
+    }
+    operations.resize(kept);
+    operations.insert(operations.end(), duplicates.begin(), duplicates.end());
+}
 
-        auto it_local_blocks = local_file_table.find(block.hash);
-        if (it_local_blocks != local_file_table.end())
+SyncOperationList compare_files(const BoundaryList& local_file, const BoundaryList& remote_file,
+    const Parameters* parameters, size_t max_threads)
+{
+    auto num_threads = compare_threads(std::max(local_file.size(), remote_file.size()), max_threads);
+    auto bits = shard_bits(num_threads);
+    auto local_file_table = create_boundary_lookup_table(local_file, num_threads, bits);
+
+    // Look up remote blocks in parallel. Matches are stored by remote block index, therefore result does not depend on
+    // number of threads.
+    std::vector<BlockMatch> matches(remote_file.size());
+    for_each_batch(remote_file.size(), num_threads, [&](size_t first, size_t last)
+    {
+        for (auto i = first; i < last; i++)
         {
-            const Boundary* found = nullptr;
+            const auto& block = remote_file[i];
+            auto& match = matches[i];
+            match.status = NotFound;
+
+            const auto& shard = local_file_table[shard_of(block.hash, bits)];
+            auto it_local_blocks = shard.find(block.hash);
+            if (it_local_blocks == shard.end())
+                continue;
+
             for (const auto& local_block : it_local_blocks->second)
             {
                 if (local_block->fingerprint == block.fingerprint && local_block->hash == block.hash && local_block->length == block.length)
@@ -453,57 +1309,157 @@ SyncOperationList compare_files(const BoundaryList& local_file, const BoundaryLi
                     if (local_block->start != block.start)
                     {
                         // Block was moved
-                        found = local_block;
-                        status = Copied;
+                        match.local = static_cast<size_t>(local_block - &local_file[0]);
+                        match.status = Copied;
                     }
                     else
                     {
                         // Exactly same block at required position exists in a local file. No need to do anything.
-                        status = Present;
+                        match.status = Present;
                         break;
                     }
                 }
             }
 
-            if (status == Copied)
-                result.emplace_back(SyncOperation{.remote = &block, .local = found});
+            // Filling with zeros is cheaper than copying zeros.
+            if (match.status == Copied && is_zero_block(block, parameters))
+                match.status = NotFound;
         }
+    });
 
-        if (status == NotFound)
+    // Produce instructions to reassemble remote file from pieces available locally.
+    SyncOperationList result;
+    result.reserve(remote_file.size());
+    for (size_t i = 0; i < remote_file.size(); i++)
+    {
+        if (matches[i].status == Copied)
+        {
+            result.emplace_back(SyncOperation{.remote = &remote_file[i], .local = &local_file[matches[i].local],
+                .from_remote = false});
+        }
+        else if (matches[i].status == NotFound)
         {
-            // Block does not exist in local file. Download.
-            result.emplace_back(SyncOperation{.remote = &block, .local = nullptr});
+            // Block does not exist in local file. Download, or fill with zeros when it is a zero block.
+            result.emplace_back(SyncOperation{.remote = &remote_file[i], .local = nullptr, .from_remote = false});
         }
     }
 
-    // Sort operations list
-    for (auto i = 0UL; i < result.size(); i++)
+    sort_operations(result);
+    deduplicate_downloads(result, parameters);
+
+    return result;
+}
+
+CompactSyncOperationList compare_files(const CompactBoundaryList& local_file, const CompactBoundaryList& remote_file,
+    const Parameters* parameters, size_t max_threads)
+{
+    auto num_threads = compare_threads(std::max(local_file.size(), remote_file.size()), max_threads);
+    auto bits = shard_bits(num_threads);
+
+    // Local block indices sorted by hash. Blocks with equal hashes retain their order in local file. Indices are
+    // distributed to shards by top bits of hash, therefore sorted shards laid out one after another form a sorted
+    // table.
+    std::vector<size_t> shard_ends(1ULL << bits);
+    for (size_t i = 0; i < local_file.size(); i++)
+        shard_ends[shard_of(local_file.hash(i), bits)]++;
+    for (size_t shard = 1; shard < shard_ends.size(); shard++)
+        shard_ends[shard] += shard_ends[shard - 1];
+
+    std::vector<uint32_t> local_file_table(local_file.size());
+    {
+        std::vector<size_t> positions(shard_ends.size());
+        for (size_t shard = 1; shard < shard_ends.size(); shard++)
+            positions[shard] = shard_ends[shard - 1];
+        for (size_t i = 0; i < local_file.size(); i++)
+            local_file_table[positions[shard_of(local_file.hash(i), bits)]++] = static_cast<uint32_t>(i);
+    }
+
+    std::atomic<size_t> next_shard{0};
+    run_parallel(num_threads, [&]()
     {
-        for (auto j = i + 1; j < result.size(); j++)
+        for (auto shard = next_shard++; shard < shard_ends.size(); shard = next_shard++)
         {
-            auto& a = result[i];
-            auto& b = result[j];
+            auto first = local_file_table.begin() + (shard > 0 ? shard_ends[shard - 1] : 0);
+            std::stable_sort(first, local_file_table.begin() + shard_ends[shard], [&](uint32_t a, uint32_t b)
+            {
+                return local_file.hash(a) < local_file.hash(b);
+            });
+        }
+    });
+
+    // Look up remote blocks in parallel. Matches are stored by remote block index, therefore result does not depend on
+    // number of threads.
+    std::vector<BlockMatch> matches(remote_file.size());
+    for_each_batch(remote_file.size(), num_threads, [&](size_t first, size_t last)
+    {
+        auto start = remote_file.start(first);
+        for (auto i = first; i < last; start += remote_file.length(i++))
+        {
+            auto block = Boundary{.start = start, .fingerprint = remote_file.fingerprint(i),
+                .hash = remote_file.hash(i), .length = remote_file.length(i)};
+            auto& match = matches[i];
+            match.status = NotFound;
+
+            auto first_candidate = std::lower_bound(local_file_table.begin(), local_file_table.end(), block.hash,
+                [&](uint32_t index, uint64_t hash) { return local_file.hash(index) < hash; });
 
-            // Solve circular dependencies, two blocks depending on each other's local data.
-            if (a.local != nullptr && b.local != nullptr)
+            for (auto candidate = first_candidate;
+                candidate != local_file_table.end() && local_file.hash(*candidate) == block.hash; ++candidate)
             {
-                if (intersects(*a.remote, *b.local) && intersects(*b.remote, *a.local))
+                auto local_index = *candidate;
+                if (local_file.fingerprint(local_index) == block.fingerprint &&
+                    local_file.length(local_index) == block.length)
                 {
-                    // Force next block download
-                    b.local = nullptr;
+                    // Block was found in local file
+                    if (local_file.start(local_index) != block.start)
+                    {
+                        // Block was moved
+                        match.local = local_index;
+                        match.status = Copied;
+                    }
+                    else
+                    {
+                        // Exactly same block at required position exists in a local file. No need to do anything.
+                        match.status = Present;
+                        break;
+                    }
                 }
             }
 
-            // Make blocks with local source come before blocks that write to local source position
-            if (b.local != nullptr && intersects(*a.remote, *b.local))
-            {
-                result.insert(result.begin() + i, b);
-                result.erase(result.begin() + j + 1);
-            }
+            // Filling with zeros is cheaper than copying zeros.
+            if (match.status == Copied && is_zero_block(block, parameters))
+                match.status = NotFound;
+        }
+    });
+
+    // Produce instructions to reassemble remote file from pieces available locally.
+    std::vector<CompactOperationRanges> result;
+    for (auto it = remote_file.begin(); it != remote_file.end(); ++it)
+    {
+        auto block = *it;
+        auto remote_index = static_cast<uint32_t>(it.index());
+        const auto& match = matches[remote_index];
+        if (match.status == Copied)
+        {
+            result.emplace_back(CompactOperationRanges{{remote_index, static_cast<uint32_t>(match.local), false},
+                block.start, local_file.start(match.local), block.length, block.hash, block.fingerprint});
+        }
+        else if (match.status == NotFound)
+        {
+            // Block does not exist in local file. Download, or fill with zeros when it is a zero block.
+            result.emplace_back(CompactOperationRanges{{remote_index, CompactSyncOperation::npos, false}, block.start,
+                0, block.length, block.hash, block.fingerprint});
         }
     }
 
-    return result;
+    sort_operations(result);
+    deduplicate_downloads(result, parameters);
+
+    CompactSyncOperationList operations;
+    operations.reserve(result.size());
+    for (const auto& operation : result)
+        operations.emplace_back(operation.operation);
+    return operations;
 }
 
 }
@@ -22,9 +22,15 @@
  * SOFTWARE.
  */
 #include <zinc/zinc.h>
+#include <zinc/http.h>
 #include <json.hpp>
 #include <CLI11.hpp>
+#include <cinttypes>
+#include <memory>
+#include <unordered_set>
+#include <sys/stat.h>
 #if !_WIN32
+#   include <sys/resource.h>
 #   include <unistd.h>
 #endif
 
@@ -88,7 +94,8 @@ bool intersects(const zinc::Boundary& a, const zinc::Boundary& b)
 
 #if _DEBUG
 /// Ensure that offsets are not overwritten before they are read.
-void verify_operations_list(zinc::SyncOperationList& delta)
+void verify_operations_list(const zinc::CompactSyncOperationList& delta, const zinc::CompactBoundaryList& local_hashes,
+    const zinc::CompactBoundaryList& remote_hashes)
 {
     for (auto i = 0UL; i < delta.size(); i++)
     {
@@ -97,14 +104,506 @@ void verify_operations_list(zinc::SyncOperationList& delta)
         {
             const auto& b = delta[j];                   // later operation that might copy from earlier spot
 
-            if (b.local != nullptr)
+            // Blocks copied from remote file locations are read after they were written by earlier operations.
+            if (b.local != zinc::CompactSyncOperation::npos && !b.from_remote)
             {
-                assert(!intersects(*b.local, *a.remote));
+                assert(!intersects(local_hashes[b.local], remote_hashes[a.remote]));
             }
         }
     }
 }
+
+/// Ensure that local blocks used by operations have the same content as remote blocks.
+void verify_local_blocks(const std::string& local_file, const zinc::CompactSyncOperationList& delta,
+    const zinc::CompactBoundaryList& local_hashes, const zinc::CompactBoundaryList& remote_hashes,
+    const zinc::Parameters& parameters)
+{
+    FILE* local = fopen(local_file.c_str(), "rb");
+    std::vector<uint8_t> buffer;
+    for (const auto& op : delta)
+    {
+        if (op.local != zinc::CompactSyncOperation::npos && !op.from_remote)
+        {
+            auto local_block = local_hashes[op.local];
+            if (buffer.size() < static_cast<size_t>(local_block.length))
+                buffer.resize(local_block.length);
+
+            fseek(local, local_block.start, SEEK_SET);
+            fread(&buffer.front(), 1, local_block.length, local);
+            assert(zinc::detail::block_hash(&buffer[0], local_block.length, parameters.hash_leaf_size) ==
+                remote_hashes.hash(op.remote));
+        }
+    }
+    fclose(local);
+}
+#endif
+
+/// File hashes and information how they were computed.
+struct Manifest
+{
+    /// Blocks of remote file.
+    zinc::CompactBoundaryList blocks;
+    /// Leaf size used for hashing blocks.
+    size_t leaf_size = 0;
+    /// Whether archives were split at starts of their members.
+    bool archive_boundaries = false;
+    /// Sketches of blocks, may be empty.
+    std::vector<zinc::BlockSketch> sketches;
+    /// Deltas of blocks against blocks of older file versions, stored in a delta pack.
+    std::vector<zinc::BlockDelta> deltas;
+    /// Identities of older file versions that have a patch pack.
+    std::vector<uint64_t> patches;
+};
+
+/// Write file hashes to a json file. Leaf size used for hashing blocks and digest of the file are stored along with
+/// them.
+void write_manifest(const std::string& file_path, const Manifest& manifest)
+{
+    json blocks = json::array();
+    for (auto it = manifest.blocks.begin(); it != manifest.blocks.end(); ++it)
+    {
+        auto block = *it;
+        json value = {
+            {"start", block.start},
+            {"length", block.length},
+            {"fingerprint", block.fingerprint},
+            {"hash", block.hash},
+        };
+        if (!manifest.sketches.empty())
+        {
+            const auto& features = manifest.sketches[it.index()].features;
+            value["sketch"] = std::vector<uint64_t>(features, features + zinc::BlockSketch::size);
+        }
+        blocks.push_back(value);
+    }
+    for (const auto& delta : manifest.deltas)
+    {
+        blocks[delta.block]["delta"] = {
+            {"reference_hash", delta.reference_hash},
+            {"reference_length", delta.reference_length},
+            {"offset", delta.offset},
+            {"length", delta.length},
+        };
+    }
+    json doc = {
+        {"version", 1},
+        {"leaf_size", manifest.leaf_size},
+        {"digest", zinc::file_digest(manifest.blocks)},
+        {"blocks", blocks},
+    };
+    if (manifest.archive_boundaries)
+        doc["archive_boundaries"] = true;
+    if (!manifest.patches.empty())
+        doc["patches"] = manifest.patches;
+    std::ofstream out(file_path);
+    out << doc.dump(4) << std::endl;
+}
+
+/// Remote file opened for reading, either a local file or a file served over http.
+struct RemoteFile
+{
+    std::unique_ptr<FILE, int(*)(FILE*)> file{nullptr, &fclose};
+    std::unique_ptr<zinc::RemoteSource> source;
+};
+
+/// Open remote file at `url` for reading. Returns false when it can not be opened.
+bool open_remote(const std::string& url, size_t connections, RemoteFile& remote)
+{
+    if (zinc::is_http_url(url))
+    {
+        auto* source = new zinc::HttpSource(url, connections);
+        remote.source.reset(source);
+        return source->valid();
+    }
+    remote.file.reset(fopen(url.c_str(), "rb"));
+    if (!remote.file)
+        return false;
+    remote.source.reset(new zinc::FileSource(remote.file.get()));
+    return true;
+}
+
+/// Read file hashes from a json file. Manifests without a header are plain arrays of blocks hashed as a whole. Returns
+/// false when blocks are not contiguous or do not match digest of the file.
+bool read_manifest(const std::string& file_path, Manifest& manifest)
+{
+    json doc;
+    if (zinc::is_http_url(file_path))
+    {
+        std::string text;
+        if (!zinc::HttpSource(file_path).get(text))
+            return false;
+        doc = json::parse(text);
+    }
+    else
+        doc = json::parse(std::ifstream(file_path));
+    json digest;
+    manifest.leaf_size = 0;
+    manifest.archive_boundaries = false;
+    if (doc.is_object())
+    {
+        manifest.leaf_size = doc.value("leaf_size", size_t(0));
+        manifest.archive_boundaries = doc.value("archive_boundaries", false);
+        manifest.patches = doc.value("patches", std::vector<uint64_t>());
+        digest = doc["digest"];
+        doc = doc["blocks"];
+    }
+    manifest.blocks.clear();
+    manifest.blocks.reserve(doc.size());
+    manifest.sketches.clear();
+    manifest.deltas.clear();
+    for (auto& value : doc)
+    {
+        auto added = manifest.blocks.push_back(zinc::Boundary{
+            .start = value["start"].get<int64_t>(),
+            .fingerprint = value["fingerprint"].get<uint64_t>(),
+            .hash = value["hash"].get<uint64_t>(),
+            .length = value["length"].get<int64_t>(),
+        });
+        if (!added)
+            return false;
+
+        auto sketch = value.find("sketch");
+        if (sketch != value.end() && sketch->size() == zinc::BlockSketch::size)
+        {
+            zinc::BlockSketch block_sketch{};
+            for (size_t i = 0; i < zinc::BlockSketch::size; i++)
+                block_sketch.features[i] = (*sketch)[i].get<uint64_t>();
+            manifest.sketches.resize(manifest.blocks.size() - 1);
+            manifest.sketches.push_back(block_sketch);
+        }
+
+        auto delta = value.find("delta");
+        if (delta != value.end())
+        {
+            manifest.deltas.push_back(zinc::BlockDelta{
+                manifest.blocks.size() - 1,
+                (*delta)["reference_hash"].get<uint64_t>(),
+                (*delta)["reference_length"].get<int64_t>(),
+                (*delta)["offset"].get<int64_t>(),
+                (*delta)["length"].get<int64_t>(),
+            });
+        }
+    }
+    if (!manifest.sketches.empty())
+        manifest.sketches.resize(manifest.blocks.size());
+    return digest.is_null() || digest.get<uint64_t>() == zinc::file_digest(manifest.blocks);
+}
+
+/// Returns a value identifying remote file described by manifest.
+uint64_t manifest_identity(const Manifest& manifest)
+{
+    uint64_t leaf_size = manifest.leaf_size;
+    return zinc::detail::fnv64a_combine(&leaf_size, 1, zinc::file_digest(manifest.blocks));
+}
+
+/// Returns path of patch pack from file version with `identity` to current version of `file`.
+std::string patch_pack_path(const std::string& file, uint64_t identity)
+{
+    char name[32];
+    snprintf(name, sizeof(name), ".%016" PRIx64 ".patch", identity);
+    return file + name;
+}
+
+/// Returns attributes of file that change when it is modified or replaced: size, inode and modification and status
+/// change times in nanoseconds.
+json get_file_stamp(const struct stat& info)
+{
+#if _WIN32
+    int64_t modified = static_cast<int64_t>(info.st_mtime) * 1000000000;
+    int64_t changed = static_cast<int64_t>(info.st_ctime) * 1000000000;
+#elif __APPLE__
+    int64_t modified = static_cast<int64_t>(info.st_mtimespec.tv_sec) * 1000000000 + info.st_mtimespec.tv_nsec;
+    int64_t changed = static_cast<int64_t>(info.st_ctimespec.tv_sec) * 1000000000 + info.st_ctimespec.tv_nsec;
+#else
+    int64_t modified = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    int64_t changed = static_cast<int64_t>(info.st_ctim.tv_sec) * 1000000000 + info.st_ctim.tv_nsec;
+#endif
+    return {
+        {"size", static_cast<int64_t>(info.st_size)},
+        {"inode", static_cast<uint64_t>(info.st_ino)},
+        {"modified", modified},
+        {"changed", changed},
+    };
+}
+
+/// Record identity of remote file version local file matches, along with attributes of local file that change when it
+/// is modified.
+void write_local_version(const std::string& local_file, uint64_t identity)
+{
+    struct stat info{};
+    if (stat(local_file.c_str(), &info) != 0)
+        return;
+    json doc = {
+        {"identity", identity},
+        {"stamp", get_file_stamp(info)},
+    };
+    std::ofstream out(local_file + ".version");
+    out << doc.dump(4) << std::endl;
+}
+
+/// Read identity of file version recorded by write_local_version(). `unchanged` is set to true when local file was not
+/// modified since. Returns false when no version was recorded.
+bool read_local_version(const std::string& local_file, uint64_t& identity, bool& unchanged)
+{
+    std::ifstream in(local_file + ".version");
+    struct stat info{};
+    if (!in.good() || stat(local_file.c_str(), &info) != 0)
+        return false;
+    json doc;
+    try
+    {
+        doc = json::parse(in);
+    }
+    catch (const std::exception&)
+    {
+        return false;
+    }
+    if (!doc.is_object() || !doc["identity"].is_number())
+        return false;
+    identity = doc["identity"].get<uint64_t>();
+    unchanged = doc["stamp"] == get_file_stamp(info);
+    return true;
+}
+
+/// Write a patch pack from an older version of hashed file. Clients holding the older version apply it without
+/// hashing their file. Returns false on failure.
+bool write_version_patch(const std::string& input_file, FILE* in, Manifest& manifest, const std::string& previous_file,
+    const zinc::Parameters& parameters)
+{
+    FILE* previous_fp = fopen(previous_file.c_str(), "rb");
+    if (previous_fp == nullptr)
+    {
+        std::cerr << "Failed to open file\n";
+        return false;
+    }
+
+    // Clients identify previous version by it's published manifest, which may use a different leaf size.
+    Manifest previous;
+    auto published = std::ifstream(previous_file + ".json").good() && read_manifest(previous_file + ".json", previous);
+    auto identity = manifest_identity(previous);
+    if (!published || previous.leaf_size != manifest.leaf_size ||
+        previous.archive_boundaries != manifest.archive_boundaries)
+    {
+        previous.leaf_size = manifest.leaf_size;
+        previous.archive_boundaries = manifest.archive_boundaries;
+        previous.blocks = zinc::CompactBoundaryList(
+            zinc::partition_file(previous_fp, 0, nullptr, nullptr, nullptr, &parameters).get());
+        print_progressbar(100);
+        std::cout << std::endl;
+        if (previous.blocks.empty())
+        {
+            std::cerr << "Failed to read file\n";
+            fclose(previous_fp);
+            return false;
+        }
+        if (!published)
+            identity = manifest_identity(previous);
+    }
+    fclose(previous_fp);
+
+    auto target = manifest_identity(manifest);
+    if (identity == target ||
+        std::find(manifest.patches.begin(), manifest.patches.end(), identity) != manifest.patches.end())
+        return true;
+
+    auto delta = zinc::compare_files(previous.blocks, manifest.blocks, &parameters);
+    auto patch = zinc::build_patch(delta, previous.blocks, manifest.blocks, &parameters);
+    zinc::FileSource source(in);
+    FILE* pack = fopen(patch_pack_path(input_file, identity).c_str(), "wb");
+    auto success = pack != nullptr && zinc::write_patch_pack(pack, patch, &source, identity, target);
+    if (pack != nullptr)
+        fclose(pack);
+    if (!success)
+    {
+        std::cerr << "Failed to write patch pack\n";
+        return false;
+    }
+    manifest.patches.push_back(identity);
+    return true;
+}
+
+/// Verify entire local file against manifest, printing blocks that do not match. Returns true when file matches.
+bool verify_local_file(const std::string& local_file, const Manifest& manifest, zinc::Parameters parameters)
+{
+    FILE* local = fopen(local_file.c_str(), "rb");
+    if (local == nullptr)
+    {
+        std::cerr << "Failed to open file\n";
+        return false;
+    }
+
+    parameters.hash_leaf_size = manifest.leaf_size;
+    auto mismatched = zinc::verify_file(local, manifest.blocks, 0, nullptr, nullptr, nullptr, &parameters).get();
+    print_progressbar(100);
+    std::cout << std::endl;
+    fclose(local);
+    auto local_size = std::ifstream(local_file, std::ios::binary | std::ios::ate).tellg();
+    auto size_matches = local_size == manifest.blocks.file_size();
+
+    for (auto index : mismatched)
+        std::cerr << "Block " << index << " at " << manifest.blocks.start(index) << " does not match\n";
+    if (!size_matches)
+        std::cerr << "File size does not match\n";
+    return mismatched.empty() && size_matches;
+}
+
+/// Encode blocks of input file that do not exist in base file as deltas against similar blocks of base file and store
+/// them in a delta pack. Deltas are recorded in the manifest. Returns false on failure.
+bool write_delta_pack(const std::string& pack_path, FILE* input, Manifest& manifest, const std::string& base_file,
+    zinc::Parameters parameters)
+{
+    // Sketches of base file blocks are taken from it's manifest, they are computed when manifest has none.
+    Manifest base;
+    FILE* base_fp = fopen(base_file.c_str(), "rb");
+    if (base_fp == nullptr || !std::ifstream(base_file + ".json").good() || !read_manifest(base_file + ".json", base))
+    {
+        std::cerr << "Base file must be hashed first\n";
+        if (base_fp != nullptr)
+            fclose(base_fp);
+        return false;
+    }
+    if (base.sketches.empty())
+        base.sketches = zinc::sketch_file(base_fp, base.blocks, 0, nullptr, nullptr, nullptr, &parameters).get();
+
+    std::unordered_set<uint64_t> base_hashes;
+    for (size_t i = 0; i < base.blocks.size(); i++)
+        base_hashes.insert(base.blocks.hash(i));
+    zinc::SimilarityIndex index(base.sketches);
+
+    FILE* pack = fopen(pack_path.c_str(), "wb");
+    if (pack == nullptr)
+    {
+        fclose(base_fp);
+        std::cerr << "Failed to open file\n";
+        return false;
+    }
+
+    // Blocks are read at their offsets without seeking shared file position.
+    zinc::FileSource base_source(base_fp);
+    zinc::FileSource input_source(input);
+    int64_t pack_size = 0;
+    int64_t encoded_bytes = 0;
+    auto success = true;
+    std::vector<uint8_t> reference, target;
+    parameters.hash_leaf_size = manifest.leaf_size;
+    for (auto it = manifest.blocks.begin(); it != manifest.blocks.end(); ++it)
+    {
+        // Blocks present in base file are copied by clients that have it, zero blocks are never downloaded.
+        auto block = *it;
+        if (base_hashes.count(block.hash) || zinc::is_zero_block(block, &parameters))
+            continue;
+
+        auto similar = index.find(manifest.sketches[it.index()]);
+        if (similar == zinc::SimilarityIndex::npos)
+            continue;
+
+        auto base_block = base.blocks[similar];
+        reference.resize(static_cast<size_t>(base_block.length));
+        target.resize(static_cast<size_t>(block.length));
+        if (!base_source.read(base_block.start, reference.data(), reference.size()) ||
+            !input_source.read(block.start, target.data(), target.size()))
+        {
+            std::cerr << "Failed to read file\n";
+            success = false;
+            break;
+        }
+
+        // Delta must be considerably smaller than block to be worth it.
+        auto delta = zinc::encode_delta(reference.data(), reference.size(), target.data(), target.size());
+        if (delta.size() * 2 > target.size())
+            continue;
+
+        if (fwrite(delta.data(), 1, delta.size(), pack) != delta.size())
+        {
+            std::cerr << "Failed to write file\n";
+            success = false;
+            break;
+        }
+        manifest.deltas.push_back(zinc::BlockDelta{it.index(), base_block.hash, base_block.length, pack_size,
+            static_cast<int64_t>(delta.size())});
+        pack_size += delta.size();
+        encoded_bytes += block.length;
+    }
+    fclose(base_fp);
+    if (fclose(pack) != 0 && success)
+    {
+        std::cerr << "Failed to write file\n";
+        success = false;
+    }
+    if (!success)
+    {
+        manifest.deltas.clear();
+        return false;
+    }
+
+    std::cout << "Delta encoded bytes: " << encoded_bytes << " in " << pack_size << " bytes\n";
+    return true;
+}
+
+/// Move file `from` over file `to` in a single step, so `to` always exists in either version.
+bool replace_file(const std::string& from, const std::string& to)
+{
+#if _WIN32
+    return MoveFileExW(to_wstring(from).c_str(), to_wstring(to).c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
 #endif
+}
+
+/// Apply patch pack uploaded by push to a stored file. Pack and manifest of new version are uploaded next to stored
+/// file, manifest of stored file is replaced once file is patched. Interrupted patching is resumed. Returns false on
+/// failure.
+bool apply_push(const std::string& stored_file, zinc::Parameters parameters)
+{
+    Manifest previous;
+    Manifest manifest;
+    if ((std::ifstream(stored_file + ".json").good() && !read_manifest(stored_file + ".json", previous)) ||
+        !std::ifstream(stored_file + ".push.json").good() || !read_manifest(stored_file + ".push.json", manifest))
+    {
+        std::cerr << "Manifest is damaged\n";
+        return false;
+    }
+    parameters.hash_leaf_size = manifest.leaf_size;
+    parameters.archive_boundaries = manifest.archive_boundaries;
+
+    // Journal is created only when patch pack is applied.
+    auto journal_path = stored_file + ".journal";
+    FILE* journal = nullptr;
+    FILE* pack_fp = fopen((stored_file + ".push").c_str(), "rb");
+    FILE* out = fopen(stored_file.c_str(), "r+b");
+    if (out == nullptr)
+        out = fopen(stored_file.c_str(), "w+b");
+
+    auto success = false;
+    if (pack_fp != nullptr && out != nullptr)
+    {
+        journal = fopen(journal_path.c_str(), "r+b");
+        if (journal == nullptr)
+            journal = fopen(journal_path.c_str(), "w+b");
+        zinc::FileSource pack(pack_fp);
+        success = zinc::apply_push_pack(out, &pack, manifest.blocks, manifest_identity(previous),
+            manifest_identity(manifest), journal, &parameters);
+    }
+    for (auto* file : {journal, pack_fp, out})
+    {
+        if (file != nullptr)
+            fclose(file);
+    }
+    if (!success)
+    {
+        std::cerr << "Failed to apply patch pack, run apply again to resume\n";
+        return false;
+    }
+
+    remove(journal_path.c_str());
+    if (!replace_file(stored_file + ".push.json", stored_file + ".json"))
+    {
+        std::cerr << "Failed to replace manifest\n";
+        return false;
+    }
+    remove((stored_file + ".push").c_str());
+    return true;
+}
 
 int main(int argc, char* argv[])
 {
@@ -112,165 +611,469 @@ int main(int argc, char* argv[])
     std::string output_file;
     std::string local_file;
     std::string remote_url;
-    std::atomic<int64_t> bytes_done{0};
-    int64_t bytes_total = 0;
+    size_t leaf_size = 0;
+    bool archive_boundaries = false;
+    std::string store_directory;
+    std::vector<std::string> mirrors;
+    size_t connections = 4;
+    double min_reuse = 10;
+    int64_t store_size = 1024;
+    std::string base_file;
+    std::vector<std::string> previous_files;
+    bool sketch = false;
+    std::string serve_directory;
+    std::string stored_file;
+    std::string serve_address = "0.0.0.0";
+    uint16_t serve_port = 8080;
 
     CLI::App parser{"File synchronization utility."};
 
     auto* hash_command = parser.add_subcommand("hash", "Build file hashes instead of synchronizing files.");
     hash_command->add_option("input", input_file, "Input file (binary).")->check(CLI::ExistingFile);
     hash_command->add_option("output", output_file, "Output file (json).");
+    hash_command->add_option("--leaf-size", leaf_size,
+        "Hash blocks as a tree of leaves of this size, 0 hashes blocks as a whole.");
+    hash_command->add_flag("--archive", archive_boundaries, "Split tar and zip archives at starts of their members.");
+    hash_command->add_flag("--sketch", sketch,
+        "Store block sketches in manifest, so file can later be a delta base without reading it again.");
+    hash_command->add_option("--base", base_file,
+        "Older version of input file, deltas of changed blocks against similar blocks of it are stored in a "
+        "delta pack.")
+        ->check(CLI::ExistingFile);
+    hash_command->add_option("--previous", previous_files,
+        "Previously published version of input file, a patch pack is written for clients holding it.")
+        ->check(CLI::ExistingFile);
 
     auto* sync_command = parser.add_subcommand("sync", "Synchronize local file with remote file.");
     sync_command->add_option("local_file", local_file, "Local file (binary).")->check(CLI::ExistingFile);
-    sync_command->add_option("remote_url", remote_url, "Remote file url.")->check(CLI::ExistingFile);
+    sync_command->add_option("remote_url", remote_url, "Remote file path or http url.")->required();
+    sync_command->add_option("--mirror", mirrors,
+        "Other copy of remote file, blocks are downloaded from the fastest copies.");
+    sync_command->add_option("--connections", connections, "Number of parallel connections to every http server.",
+        true);
+    sync_command->add_option("--min-reuse", min_reuse,
+        "Download whole file when sampling predicts that less than this percentage of it can be reused, "
+        "0 always synchronizes.", true);
+    sync_command->add_option("--store", store_directory,
+        "Directory of a block store shared by syncs, downloaded and replaced blocks are kept in it for reuse.");
+    sync_command->add_option("--store-size", store_size, "Maximum size of block store in megabytes.", true);
+
+    auto* verify_command = parser.add_subcommand("verify", "Verify local file against hashes of remote file.");
+    verify_command->add_option("local_file", local_file, "Local file (binary).")->check(CLI::ExistingFile);
+    verify_command->add_option("remote_url", remote_url, "Remote file path or http url.")->required();
+
+    auto* push_command = parser.add_subcommand("push", "Upload changed blocks of local file to a file in a store.");
+    push_command->add_option("local_file", local_file, "Local file (binary).")->check(CLI::ExistingFile);
+    push_command->add_option("stored_file", stored_file,
+        "File in store, a patch pack and manifest are written next to it.")->required();
+    push_command->add_option("--leaf-size", leaf_size,
+        "Hash blocks as a tree of leaves of this size when file is pushed first time, 0 hashes blocks as a whole.");
+    push_command->add_flag("--archive", archive_boundaries,
+        "Split tar and zip archives at starts of their members when file is pushed first time.");
+
+    auto* apply_command = parser.add_subcommand("apply", "Apply patch pack uploaded by push to a file in a store.");
+    apply_command->add_option("stored_file", stored_file, "File in store.")->required();
+
+    auto* serve_command = parser.add_subcommand("serve", "Serve files and their manifests over http.");
+    serve_command->add_option("directory", serve_directory, "Directory of served files.")
+        ->check(CLI::ExistingDirectory);
+    serve_command->add_option("--address", serve_address, "Address to listen on.", true);
+    serve_command->add_option("--port", serve_port, "Port to listen on.", true);
 
     CLI11_PARSE(parser, argc, argv);
 
+    zinc::Parameters parameters;
+    parameters.on_progress = [](int64_t bytes_done, int64_t bytes_total)
+    {
+        print_progressbar(bytes_total > 0 ? static_cast<int>(100 * bytes_done / bytes_total) : 100);
+    };
+
     if (hash_command->parsed())
     {
         if (output_file.empty())
             output_file = input_file + ".json";
 
+        parameters.hash_leaf_size = leaf_size;
+        parameters.archive_boundaries = archive_boundaries;
         FILE* in = fopen(input_file.c_str(), "rb");
-        auto boundary_future = zinc::partition_file(in, 0, &bytes_done, &bytes_total);
-
-        auto percent_per_byte = 100.f / bytes_total;
-        while (bytes_done < bytes_total)
-            print_progressbar(static_cast<int>(percent_per_byte * bytes_done));
+        auto boundary_future = zinc::partition_file(in, 0, nullptr, nullptr, nullptr, &parameters);
+        Manifest manifest;
+        manifest.blocks = zinc::CompactBoundaryList(boundary_future.get());
+        if (manifest.blocks.empty())
+        {
+            std::cerr << "Failed to read file\n";
+            if (in != nullptr)
+                fclose(in);
+            return -1;
+        }
+        manifest.leaf_size = leaf_size;
+        manifest.archive_boundaries = archive_boundaries;
+        // Sketches need another pass over the file, they are computed only when they are used.
+        if (sketch || !base_file.empty())
+            manifest.sketches = zinc::sketch_file(in, manifest.blocks, 0, nullptr, nullptr, nullptr, &parameters).get();
         print_progressbar(100);
+        std::cout << std::endl;
 
-        auto boundaries = boundary_future.get();
-        json doc;
-        for (const auto& block : boundaries)
+        if (!base_file.empty() && !write_delta_pack(input_file + ".deltas", in, manifest, base_file, parameters))
         {
-            doc.push_back({
-                {"start", block.start},
-                {"length", block.length},
-                {"fingerprint", block.fingerprint},
-                {"hash", block.hash},
-            });
+            fclose(in);
+            return -1;
+        }
+        if (!sketch)
+            manifest.sketches.clear();
+
+        for (const auto& previous_file : previous_files)
+        {
+            if (!write_version_patch(input_file, in, manifest, previous_file, parameters))
+            {
+                fclose(in);
+                return -1;
+            }
         }
-        std::ofstream out(output_file);
-        out << doc.dump(4) << std::endl;
+
+        write_manifest(output_file, manifest);
         fclose(in);
     }
     else if (sync_command->parsed())
     {
-        zinc::BoundaryList local_hashes;
-        zinc::BoundaryList remote_hashes;
+        zinc::CompactBoundaryList local_hashes;
 
-        // Hash local file
-        FILE* local = fopen(local_file.c_str(), "rb");
-        auto boundary_future = zinc::partition_file(local, 0, &bytes_done, &bytes_total);
+        // Get remote file hashes. Local file must be hashed the same way.
+        Manifest manifest;
+        if (!read_manifest(remote_url + ".json", manifest))
+        {
+            std::cerr << "Manifest is damaged\n";
+            return -1;
+        }
+        const auto& remote_hashes = manifest.blocks;
+        parameters.hash_leaf_size = manifest.leaf_size;
+        parameters.archive_boundaries = manifest.archive_boundaries;
 
-        // Print progress
-        auto percent_per_byte = 100.f / bytes_total;
-        while (bytes_done < bytes_total)
-            print_progressbar(static_cast<int>(percent_per_byte * bytes_done));
-        print_progressbar(100);
+        // Patch pack that does not produce remote file is followed by a sync without packs.
+        for (auto use_packs : {true, false})
+        {
+            // Interrupted sync of the same remote file is resumed from the journal, without hashing local file again.
+            // Journal is created only when patch is applied.
+            auto journal_path = local_file + ".journal";
+            zinc::PatchJournal journal;
+            journal.file = fopen(journal_path.c_str(), "rb");
 
-        local_hashes = boundary_future.get();
-        fclose(local);
+            // Local file holding a published older version is patched from a precomputed patch pack without hashing it.
+            // Patching from a pack is resumed from the same pack.
+            zinc::PatchOperationList patch;
+            RemoteFile patch_pack;
+            uint64_t local_version = 0;
+            bool unchanged = false;
+            bool from_pack = false;
+            bool resumed = false;
+            auto remote_identity = manifest_identity(manifest);
+            if (use_packs && read_local_version(local_file, local_version, unchanged) &&
+                std::find(manifest.patches.begin(), manifest.patches.end(), local_version) != manifest.patches.end() &&
+                open_remote(patch_pack_path(remote_url, local_version), connections, patch_pack))
+            {
+                journal.identity = zinc::detail::fnv64a_combine(&local_version, 1, remote_identity);
+                resumed = zinc::read_journal(journal, patch);
+                from_pack = resumed || (unchanged &&
+                    zinc::read_patch_pack(patch_pack.source.get(), local_version, remote_identity, patch));
+            }
+            if (!from_pack)
+            {
+                journal.identity = remote_identity;
+                resumed = zinc::read_journal(journal, patch);
+            }
+            if (journal.file != nullptr)
+            {
+                fclose(journal.file);
+                journal.file = nullptr;
+            }
 
-        // Get remote file hashes
-        json doc = json::parse(std::ifstream(remote_url + ".json"));
-        remote_hashes.reserve(doc.size());
-        for (auto& value : doc)
-        {
-            remote_hashes.emplace_back(zinc::Boundary{
-                .start = value["start"].get<int64_t>(),
-                .fingerprint = value["fingerprint"].get<uint64_t>(),
-                .hash = value["hash"].get<uint64_t>(),
-                .length = value["length"].get<int64_t>(),
-            });
-        }
+            if (resumed)
+                std::cout << "Resuming interrupted sync\n";
+            else if (from_pack)
+                std::cout << "Applying patch pack\n";
+            else
+            {
+                // Local file is not hashed when it has too little in common with remote file, all of it is downloaded.
+                FILE* local = fopen(local_file.c_str(), "rb");
+                zinc::ReuseEstimate estimate;
+                if (min_reuse > 0)
+                    estimate = zinc::estimate_reuse(local, remote_hashes, zinc::ReuseEstimateOptions(), &parameters);
+                if (estimate.valid && estimate.high * 100 < min_reuse)
+                {
+                    std::cout << "Estimated reuse: " << static_cast<int>(estimate.reuse * 100)
+                              << "%, downloading whole file\n";
+                    fclose(local);
+                }
+                else
+                {
+                    // Hash local file
+                    auto boundary_future = zinc::partition_file(local, 0, nullptr, nullptr, nullptr, &parameters);
+
+                    // Progress is printed from on_progress while waiting
+                    local_hashes = zinc::CompactBoundaryList(boundary_future.get());
+                    print_progressbar(100);
+                    fclose(local);
+                    if (local_hashes.empty())
+                    {
+                        std::cerr << "Failed to read local file\n";
+                        return -1;
+                    }
+                }
 
-        // Calculate delta
-        auto delta = zinc::compare_files(local_hashes, remote_hashes);
+                // Calculate delta
+                auto delta = zinc::compare_files(local_hashes, remote_hashes, &parameters);
 #if _DEBUG
-        verify_operations_list(delta);
+                verify_operations_list(delta, local_hashes, remote_hashes);
+                verify_local_blocks(local_file, delta, local_hashes, remote_hashes, parameters);
 #endif
+                // Consecutive blocks that moved together are copied as a single range.
+                patch = zinc::build_patch(delta, local_hashes, remote_hashes, &parameters);
+            }
 
-        std::ifstream in(remote_url.c_str(), std::ios::binary | std::ios::in);
-        std::fstream out(local_file.c_str(), std::ios::binary | std::ios::in | std::ios::out);
+            RemoteFile remote_file;
+            FILE* out = fopen(local_file.c_str(), "r+b");
 
-        if (!in.is_open() || !out.is_open())
-        {
-            std::cerr << "Failed to open file\n";
-            return -1;
-        }
+            if (!open_remote(remote_url, connections, remote_file) || out == nullptr)
+            {
+                std::cerr << "Failed to open file\n";
+                return -1;
+            }
 
-        std::vector<char> buffer;
-#if _DEBUG
-        std::vector<char> buffer2;
-        for (const auto& op : delta)
-        {
-            if (op.local != nullptr)
+            int64_t bytes_downloaded = 0;
+            int64_t bytes_copied = 0;
+            int64_t bytes_zeroed = 0;
+            for (const auto& operation : patch)
             {
-                if (buffer.size() < static_cast<size_t>(op.remote->length))
-                    buffer.resize(op.local->length);
+                if (operation.type == zinc::PatchOperation::Download)
+                    bytes_downloaded += operation.length;
+                else if (operation.type == zinc::PatchOperation::Zero)
+                    bytes_zeroed += operation.length;
+                else
+                    bytes_copied += operation.length;
+            }
 
-                out.seekg(op.local->start, std::ios_base::beg);
-                out.read(&buffer.front(), op.local->length);
-                assert(zinc::detail::fnv64a((uint8_t*)&buffer[0], op.local->length) == op.remote->hash);
+            // Downloads are spread between remote file and it's mirrors.
+            std::vector<RemoteFile> mirror_files(mirrors.size());
+            std::vector<zinc::RemoteSource*> sources{remote_file.source.get()};
+            for (size_t i = 0; i < mirrors.size(); i++)
+            {
+                if (!open_remote(mirrors[i], connections, mirror_files[i]))
+                {
+                    std::cerr << "Failed to open file\n";
+                    return -1;
+                }
+                sources.push_back(mirror_files[i].source.get());
             }
-        }
-#endif
-        int64_t bytes_downloaded = 0;
-        int64_t bytes_copied = 0;
-        for (auto i = 0UL; i < delta.size(); i++)
-        {
-            auto& op = delta[i];
-            if (op.local == nullptr)
+            std::unique_ptr<zinc::MultiSource> multi_source(new zinc::MultiSource(sources));
+            zinc::RemoteSource& remote = from_pack ? *patch_pack.source :
+                mirrors.empty() ? *remote_file.source : *multi_source;
+
+            // Blocks kept in a store are not downloaded. Replaced local blocks are stored before they are overwritten.
+            std::unique_ptr<zinc::BlockStore> store;
+            std::unique_ptr<zinc::StoreSource> store_source;
+            if (!store_directory.empty() && !from_pack)
             {
-                // Download operation
-                if (buffer.size() < static_cast<size_t>(op.remote->length))
-                    buffer.resize(op.remote->length);
+                store.reset(new zinc::BlockStore(store_directory, store_size * 1024 * 1024));
+                if (!resumed)
+                    zinc::retain_blocks(*store, out, local_hashes, remote_hashes, &parameters);
+                store_source.reset(new zinc::StoreSource(&remote, *store, remote_hashes, &parameters));
+            }
 
-                in.seekg(op.remote->start, std::ios_base::beg);
-                in.read(&buffer.front(), op.remote->length);
-                bytes_downloaded += op.remote->length;
+            // Changed blocks are rebuilt from deltas against similar local blocks before local file is modified.
+            zinc::DeltaSource delta_source(store_source ? static_cast<zinc::RemoteSource*>(store_source.get()) :
+                &remote);
+            int64_t delta_bytes = 0;
+            RemoteFile pack;
+            if (!manifest.deltas.empty() && !resumed && !from_pack &&
+                open_remote(remote_url + ".deltas", connections, pack))
+            {
+                zinc::reconstruct_blocks(out, local_hashes, remote_hashes, patch, manifest.deltas, pack.source.get(),
+                    delta_source, &delta_bytes, &parameters);
+                bytes_downloaded += delta_bytes - delta_source.reconstructed_bytes();
+            }
 
-#if _DEBUG
-                assert(zinc::detail::fnv64a((uint8_t*)&buffer[0], op.remote->length) == op.remote->hash);
-#endif
+            // Resumed patch continues the journal it was read from, new patch starts a new one.
+            journal.file = fopen(journal_path.c_str(), resumed ? "r+b" : "w+b");
+            if (journal.file == nullptr)
+            {
+                std::cerr << "Failed to open journal\n";
+                fclose(out);
+                return -1;
             }
-            else
+
+            // Written blocks are hashed as they are written.
+            zinc::PatchVerifier verifier(remote_hashes, &parameters);
+            bool success = zinc::apply_patch(out, patch, &delta_source, &parameters, &journal, &verifier);
+            if (store_source)
+                bytes_downloaded -= store_source->stored_bytes();
+            multi_source.reset();                           // Waits for reads of mirrors that lost to finish
+            fclose(out);
+            fclose(journal.file);
+
+            if (!success)
             {
-                // Copy operation
-                if (buffer.size() < static_cast<size_t>(op.remote->length))
-                    buffer.resize(op.local->length);
+                // Journal is kept only when patch was recorded in it and sync can be resumed.
+                zinc::PatchOperationList recorded;
+                journal.file = fopen(journal_path.c_str(), "rb");
+                auto resumable = journal.file != nullptr && zinc::read_journal(journal, recorded);
+                if (journal.file != nullptr)
+                    fclose(journal.file);
+                if (!resumable)
+                {
+                    remove(journal_path.c_str());
+                    std::cerr << "Failed to apply patch\n";
+                    return -1;
+                }
+                std::cerr << "Failed to apply patch, run sync again to resume\n";
+                return -1;
+            }
 
-                out.seekg(op.local->start, std::ios_base::beg);
-                out.read(&buffer.front(), op.local->length);
-                bytes_copied += op.remote->length;
+            auto file_size = remote_hashes.file_size();
+            truncate(local_file.c_str(), file_size);
+            remove(journal_path.c_str());
 
-#if _DEBUG
-                assert(op.local->length == op.remote->length);
-                if (buffer2.size() < static_cast<size_t>(op.remote->length))
-                    buffer2.resize(op.remote->length);
+            std::cout << std::endl;
+            std::cout << "Copied bytes: " << bytes_copied << "\n";
+            std::cout << "Downloaded bytes: " << bytes_downloaded << "\n";
+            if (store_source)
+                std::cout << "Bytes from store: " << store_source->stored_bytes() << "\n";
+            if (delta_source.reconstructed_bytes() > 0)
+            {
+                std::cout << "Reconstructed bytes: " << delta_source.reconstructed_bytes() << " from " << delta_bytes
+                          << " bytes of deltas\n";
+            }
+            std::cout << "Zeroed bytes: " << bytes_zeroed << "\n";
+            std::cout << "Download savings: " << 100 - int(100.0 / file_size * bytes_downloaded) << "%\n";
 
-                in.seekg(op.remote->start, std::ios_base::beg);
-                in.read(&buffer2.front(), op.remote->length);
-                assert(memcmp(&buffer[0], &buffer2[0], op.remote->length) == 0);
-#endif
+            // Blocks written before sync was interrupted were not hashed, entire file is verified instead.
+            bool verified = false;
+            if (resumed)
+                verified = verify_local_file(local_file, manifest, parameters);
+            else
+            {
+                // Blocks that patch did not write are hashed from the file.
+                FILE* in = fopen(local_file.c_str(), "rb");
+                verified = in != nullptr && verifier.finish(in) &&
+                    verifier.digest() == zinc::file_digest(remote_hashes);
+                if (in != nullptr)
+                    fclose(in);
+                for (auto index : verifier.mismatched())
+                    std::cerr << "Block " << index << " at " << remote_hashes.start(index) << " does not match\n";
+                if (verified)
+                    std::cout << "Verified bytes: " << verifier.verified_bytes() << "\n";
+                else
+                    std::cerr << "Verification failed\n";
             }
 
-            out.seekp(op.remote->start, std::ios_base::beg);
-            out.write(&buffer.front(), op.remote->length);
-        }
+            if (!verified)
+            {
+                // Local file did not hold the version patch pack was built for, it is synced again without packs.
+                if (!from_pack)
+                    return -1;
+                std::cout << "Patch pack did not produce remote file, syncing whole file\n";
+                remove((local_file + ".version").c_str());
+                continue;
+            }
 
-        in.close();
-        out.close();
+            // Next sync of local file may use a patch pack built for this version.
+            write_local_version(local_file, remote_identity);
+            break;
+        }
+    }
+    else if (push_command->parsed())
+    {
+        // Store holds manifest of last uploaded version, blocks of stored file are not read. File pushed for the first
+        // time is partitioned with parameters given on command line.
+        Manifest previous;
+        previous.leaf_size = leaf_size;
+        previous.archive_boundaries = archive_boundaries;
+        auto stored = std::ifstream(stored_file + ".json").good();
+        if (stored && !read_manifest(stored_file + ".json", previous))
+        {
+            std::cerr << "Manifest is damaged\n";
+            return -1;
+        }
+        parameters.hash_leaf_size = previous.leaf_size;
+        parameters.archive_boundaries = previous.archive_boundaries;
 
-        auto file_size = remote_hashes.back().start + remote_hashes.back().length;
-        truncate(local_file.c_str(), file_size);
+        FILE* in = fopen(local_file.c_str(), "rb");
+        Manifest manifest;
+        manifest.leaf_size = previous.leaf_size;
+        manifest.archive_boundaries = previous.archive_boundaries;
+        auto blocks = zinc::partition_file(in, 0, nullptr, nullptr, nullptr, &parameters).get();
+        manifest.blocks = zinc::CompactBoundaryList(blocks);
 
+        print_progressbar(100);
         std::cout << std::endl;
-        std::cout << "Copied bytes: " << bytes_copied << "\n";
-        std::cout << "Downloaded bytes: " << bytes_downloaded << "\n";
-        std::cout << "Download savings: " << 100 - int(100.0 / file_size * bytes_downloaded) << "%\n";
+        if (manifest.blocks.empty())
+        {
+            std::cerr << "Failed to read file\n";
+            if (in != nullptr)
+                fclose(in);
+            return -1;
+        }
+
+        FILE* pack = fopen((stored_file + ".push").c_str(), "wb");
+        auto success = pack != nullptr && zinc::write_push_pack(pack, in, manifest.blocks, previous.blocks,
+            manifest_identity(stored ? previous : Manifest()), manifest_identity(manifest), &parameters);
+        if (pack != nullptr)
+            fclose(pack);
+        fclose(in);
+        if (!success)
+        {
+            std::cerr << "Failed to write patch pack\n";
+            return -1;
+        }
+        write_manifest(stored_file + ".push.json", manifest);
+        int64_t bytes_uploaded = std::ifstream(stored_file + ".push", std::ios::binary | std::ios::ate).tellg();
+
+        // Store is a local directory, patch is applied right away.
+        if (!apply_push(stored_file, parameters))
+            return -1;
+
+        auto file_size = manifest.blocks.file_size();
+        std::cout << "Uploaded bytes: " << bytes_uploaded << "\n";
+        std::cout << "Upload savings: " << (file_size > 0 ? 100 - int(100.0 / file_size * bytes_uploaded) : 0) << "%\n";
+    }
+    else if (apply_command->parsed())
+    {
+        if (!apply_push(stored_file, parameters))
+            return -1;
+        std::cout << "File applied\n";
+    }
+    else if (serve_command->parsed())
+    {
+#if !_WIN32
+        // Every client uses a descriptor.
+        rlimit limit{};
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+        {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+#endif
+        zinc::HttpServer server(serve_directory);
+        if (!server.listen(serve_address, serve_port))
+        {
+            std::cerr << "Failed to listen on " << serve_address << ":" << serve_port << "\n";
+            return -1;
+        }
+        std::cout << "Serving " << serve_directory << " on " << serve_address << ":" << server.port() << "\n";
+        if (!server.run())
+            return -1;
+    }
+    else if (verify_command->parsed())
+    {
+        Manifest manifest;
+        if (!read_manifest(remote_url + ".json", manifest))
+        {
+            std::cerr << "Manifest is damaged\n";
+            return -1;
+        }
+        if (!verify_local_file(local_file, manifest, parameters))
+            return -1;
+        write_local_version(local_file, manifest_identity(manifest));
+        std::cout << "File matches\n";
     }
     else
         std::cout << parser.help();
@@ -1,6 +1,7 @@
 #define CATCH_CONFIG_MAIN
 #include <catch.hpp>
 #include <zinc/zinc.h>
+#include <memory>
 
 TEST_CASE("identical files")
 {
@@ -94,3 +95,377 @@ TEST_CASE("reorder intersecting")
     REQUIRE(result[1].local == nullptr);
     REQUIRE(result[1].remote->start == 0);
 }
+
+void require_same_operations(const zinc::BoundaryList& local, const zinc::BoundaryList& remote)
+{
+    auto expected = zinc::compare_files(local, remote);
+    auto result = zinc::compare_files(zinc::CompactBoundaryList(local), zinc::CompactBoundaryList(remote));
+
+    REQUIRE(result.size() == expected.size());
+    for (size_t i = 0; i < result.size(); i++)
+    {
+        REQUIRE(result[i].remote == expected[i].remote - &remote[0]);
+        REQUIRE(result[i].from_remote == expected[i].from_remote);
+        if (expected[i].local == nullptr)
+            REQUIRE(result[i].local == zinc::CompactSyncOperation::npos);
+        else if (expected[i].from_remote)
+            REQUIRE(result[i].local == expected[i].local - &remote[0]);
+        else
+            REQUIRE(result[i].local == expected[i].local - &local[0]);
+    }
+
+    auto expected_patch = zinc::build_patch(expected);
+    auto patch = zinc::build_patch(result, zinc::CompactBoundaryList(local), zinc::CompactBoundaryList(remote));
+    REQUIRE(patch.size() == expected_patch.size());
+    for (size_t i = 0; i < patch.size(); i++)
+    {
+        REQUIRE(patch[i].type == expected_patch[i].type);
+        REQUIRE(patch[i].source == expected_patch[i].source);
+        REQUIRE(patch[i].destination == expected_patch[i].destination);
+        REQUIRE(patch[i].length == expected_patch[i].length);
+    }
+}
+
+zinc::BoundaryList make_boundary_list(const std::vector<uint64_t>& hashes)
+{
+    zinc::BoundaryList result;
+    int64_t start = 0;
+    for (auto hash : hashes)
+    {
+        auto length = static_cast<int64_t>(hash % 7 + 1);
+        result.emplace_back(zinc::Boundary{.start = start, .fingerprint = hash * 3, .hash = hash, .length = length});
+        start += length;
+    }
+    return result;
+}
+
+TEST_CASE("compact boundary list")
+{
+    std::vector<uint64_t> hashes;
+    uint32_t seed = 1;
+    for (auto i = 0; i < 5000; i++)
+    {
+        seed = seed * 1103515245U + 12345U;
+        hashes.emplace_back(seed >> 8U);
+    }
+    auto boundaries = make_boundary_list(hashes);
+    zinc::CompactBoundaryList compact(boundaries);
+
+    REQUIRE(compact.size() == boundaries.size());
+    REQUIRE(compact.file_size() == boundaries.back().start + boundaries.back().length);
+    for (size_t i = 0; i < boundaries.size(); i++)
+    {
+        REQUIRE(compact.start(i) == boundaries[i].start);
+        REQUIRE(compact[i].length == boundaries[i].length);
+        REQUIRE(compact[i].hash == boundaries[i].hash);
+        REQUIRE(compact[i].fingerprint == boundaries[i].fingerprint);
+    }
+
+    for (size_t i = 0; i < boundaries.size(); i += 7)
+    {
+        int64_t start = -1;
+        REQUIRE(compact.find(boundaries[i].start) == i);
+        REQUIRE(compact.find(boundaries[i].start + boundaries[i].length - 1, &start) == i);
+        REQUIRE(start == boundaries[i].start);
+    }
+    REQUIRE(compact.find(-1) == compact.size());
+    REQUIRE(compact.find(compact.file_size()) == compact.size());
+
+    auto converted = compact.to_boundary_list();
+    REQUIRE(converted.size() == boundaries.size());
+    for (size_t i = 0; i < boundaries.size(); i++)
+        REQUIRE(converted[i].start == boundaries[i].start);
+
+    // 16 bytes per block and a start offset per checkpoint
+    auto checkpoints = boundaries.size() / zinc::CompactBoundaryList::checkpoint_interval + 1;
+    REQUIRE(compact.memory_usage() <= boundaries.size() * sizeof(zinc::Boundary) / 2 + checkpoints * sizeof(int64_t));
+
+    // Blocks that do not continue the list are rejected.
+    auto block = boundaries.back();
+    REQUIRE(!compact.push_back(block));
+    block.start += block.length + 1;
+    REQUIRE(!compact.push_back(block));
+    block.start = compact.file_size();
+    block.length = -1;
+    REQUIRE(!compact.push_back(block));
+    REQUIRE(compact.size() == boundaries.size());
+    block.length = 10;
+    REQUIRE(compact.push_back(block));
+    REQUIRE(compact.size() == boundaries.size() + 1);
+
+    std::swap(boundaries[10], boundaries[11]);
+    REQUIRE(zinc::CompactBoundaryList(boundaries).empty());
+}
+
+TEST_CASE("compact compare")
+{
+    zinc::BoundaryList a {
+        {.start = 0, .fingerprint = 10, .hash = 11, .length = 5},
+        {.start = 5, .fingerprint = 20, .hash = 22, .length = 5},
+        {.start = 10, .fingerprint = 30, .hash = 33, .length = 5},
+    };
+    zinc::BoundaryList b {
+        {.start = 0, .fingerprint = 100, .hash = 110, .length = 5},
+        {.start = 5, .fingerprint = 20, .hash = 22, .length = 5},
+        {.start = 10, .fingerprint = 10, .hash = 11, .length = 5},
+    };
+    zinc::BoundaryList c {
+        {.start = 0, .fingerprint = 100, .hash = 110, .length = 10},
+        {.start = 10, .fingerprint = 10, .hash = 11, .length = 5},
+    };
+    require_same_operations(a, a);
+    require_same_operations(a, b);
+    require_same_operations(b, a);
+    require_same_operations(a, c);
+
+    // Shuffled blocks, some of them new and some repeated
+    std::vector<uint64_t> local_hashes, remote_hashes;
+    uint32_t seed = 7;
+    for (uint64_t i = 0; i < 300; i++)
+    {
+        seed = seed * 1103515245U + 12345U;
+        local_hashes.emplace_back(i % 250);
+        remote_hashes.emplace_back((seed >> 16U) % 400);
+    }
+    require_same_operations(make_boundary_list(local_hashes), make_boundary_list(remote_hashes));
+}
+
+TEST_CASE("patch merges contiguous runs")
+{
+    // Data inserted at the front shifts all local blocks towards the end of file.
+    auto local = make_boundary_list({1, 2, 3, 4, 5, 6});
+    auto remote = make_boundary_list({100, 1, 2, 3, 4, 5, 6});
+    auto delta = zinc::compare_files(local, remote);
+    REQUIRE(delta.size() == 7);
+
+    auto patch = zinc::build_patch(delta);
+    REQUIRE(patch.size() == 2);
+    REQUIRE(patch[0].type == zinc::PatchOperation::Copy);
+    REQUIRE(patch[0].source == 0);
+    REQUIRE(patch[0].destination == remote[1].start);
+    REQUIRE(patch[0].length == local.back().start + local.back().length);
+    REQUIRE(patch[1].type == zinc::PatchOperation::Download);
+    REQUIRE(patch[1].source == 0);
+    REQUIRE(patch[1].destination == 0);
+    REQUIRE(patch[1].length == remote[0].length);
+}
+
+TEST_CASE("repeated blocks are downloaded once")
+{
+    auto local = make_boundary_list({1, 2, 3});
+    auto remote = make_boundary_list({100, 1, 100, 2, 100, 3});
+    auto result = zinc::compare_files(local, remote);
+
+    int downloads = 0;
+    const zinc::Boundary* downloaded = nullptr;
+    for (const auto& operation : result)
+    {
+        if (operation.local == nullptr)
+        {
+            downloads++;
+            downloaded = operation.remote;
+        }
+    }
+    REQUIRE(downloads == 1);
+    REQUIRE(downloaded == &remote[0]);
+
+    // Copies of downloaded block come last
+    REQUIRE(result.size() >= 2);
+    for (auto i = result.size() - 2; i < result.size(); i++)
+    {
+        REQUIRE(result[i].from_remote);
+        REQUIRE(result[i].local == downloaded);
+        REQUIRE(result[i].remote->hash == 100);
+    }
+
+    require_same_operations(local, remote);
+}
+
+/// Returns a reader of blocks in the list.
+zinc::BoundaryReader read_boundaries(const zinc::BoundaryList& list)
+{
+    auto index = std::make_shared<size_t>(0);
+    return [&list, index](zinc::Boundary& boundary)
+    {
+        if (*index >= list.size())
+            return false;
+        boundary = list[(*index)++];
+        return true;
+    };
+}
+
+/// Apply patch to simulated file content, where every byte identifies the block and it's position in the block.
+std::vector<uint64_t> simulate_patch(const zinc::BoundaryList& local, const zinc::BoundaryList& remote,
+    const zinc::PatchOperationList& patch, int64_t* downloaded)
+{
+    auto content = [](const zinc::BoundaryList& blocks)
+    {
+        std::vector<uint64_t> result;
+        for (const auto& block : blocks)
+        {
+            for (int64_t i = 0; i < block.length; i++)
+                result.emplace_back(block.hash * 8 + i);
+        }
+        return result;
+    };
+    auto file = content(local);
+    auto expected = content(remote);
+    file.resize(std::max(file.size(), expected.size()));
+    *downloaded = 0;
+    for (const auto& operation : patch)
+    {
+        if (operation.type == zinc::PatchOperation::Copy)
+        {
+            auto source = file.begin() + operation.source;
+            std::vector<uint64_t> data(source, source + operation.length);
+
+            std::copy(data.begin(), data.end(), file.begin() + operation.destination);
+        }
+        else
+        {
+            REQUIRE(operation.type == zinc::PatchOperation::Download);
+            std::copy(expected.begin() + operation.source, expected.begin() + operation.source + operation.length,
+                file.begin() + operation.destination);
+            *downloaded += operation.length;
+        }
+    }
+    file.resize(expected.size());
+    REQUIRE(file == expected);
+    return file;
+}
+
+TEST_CASE("external compare")
+{
+    // Data inserted at the front and data removed from the front produce same patch as in-memory comparison.
+    auto a = make_boundary_list({1, 2, 3, 4, 5, 6});
+    auto b = make_boundary_list({100, 1, 2, 3, 4, 5, 6});
+    auto c = make_boundary_list({3, 4, 5, 6, 200, 200, 200});
+    for (auto files : {std::make_pair(&a, &b), std::make_pair(&b, &a), std::make_pair(&a, &c), std::make_pair(&a, &a)})
+    {
+        const auto& local = *files.first;
+        const auto& remote = *files.second;
+        zinc::PatchOperationList patch;
+        REQUIRE(zinc::compare_files_external(read_boundaries(local), read_boundaries(remote), patch, 1024 * 1024));
+
+        auto expected = zinc::build_patch(zinc::compare_files(local, remote));
+        int64_t downloaded = 0, expected_downloaded = 0;
+        simulate_patch(local, remote, patch, &downloaded);
+        simulate_patch(local, remote, expected, &expected_downloaded);
+        REQUIRE(patch.size() == expected.size());
+        REQUIRE(downloaded == expected_downloaded);
+    }
+
+    // Shuffled blocks, some of them new and some repeated. Small memory limit forces runs to be merged in several
+    // passes.
+    std::vector<uint64_t> local_hashes, remote_hashes;
+    uint32_t seed = 3;
+    for (uint64_t i = 0; i < 20000; i++)
+    {
+        seed = seed * 1103515245U + 12345U;
+        local_hashes.emplace_back(i % 15000);
+        remote_hashes.emplace_back((seed >> 8U) % 20000);
+    }
+    auto local = make_boundary_list(local_hashes);
+    auto remote = make_boundary_list(remote_hashes);
+
+    zinc::PatchOperationList in_memory, on_disk;
+    REQUIRE(zinc::compare_files_external(read_boundaries(local), read_boundaries(remote), in_memory, 64 * 1024 * 1024));
+    REQUIRE(zinc::compare_files_external(read_boundaries(local), read_boundaries(remote), on_disk, 48 * 1024));
+    REQUIRE(on_disk.size() == in_memory.size());
+    for (size_t i = 0; i < on_disk.size(); i++)
+    {
+        REQUIRE(on_disk[i].type == in_memory[i].type);
+        REQUIRE(on_disk[i].source == in_memory[i].source);
+        REQUIRE(on_disk[i].destination == in_memory[i].destination);
+        REQUIRE(on_disk[i].length == in_memory[i].length);
+    }
+
+    int64_t downloaded = 0;
+    simulate_patch(local, remote, on_disk, &downloaded);
+    REQUIRE(downloaded < remote.back().start + remote.back().length);
+}
+
+TEST_CASE("shuffled compare")
+{
+    // Every block is moved, copies read data written by other copies in long chains and cycles.
+    std::vector<uint64_t> hashes;
+    for (uint64_t i = 0; i < 20000; i++)
+        hashes.emplace_back(i);
+    auto local = make_boundary_list(hashes);
+    uint32_t seed = 5;
+    for (size_t i = hashes.size() - 1; i > 0; i--)
+    {
+        seed = seed * 1103515245U + 12345U;
+        std::swap(hashes[i], hashes[(seed >> 8U) % (i + 1)]);
+    }
+    auto remote = make_boundary_list(hashes);
+
+    int64_t downloaded = 0;
+    simulate_patch(local, remote, zinc::build_patch(zinc::compare_files(local, remote)), &downloaded);
+    REQUIRE(downloaded < remote.back().start + remote.back().length);
+    require_same_operations(local, remote);
+}
+
+TEST_CASE("parallel compare")
+{
+    // Mostly unchanged file with some blocks replaced and some moved, large enough to be compared on many threads.
+    std::vector<uint64_t> local_hashes, remote_hashes;
+    uint32_t seed = 11;
+    for (uint64_t i = 0; i < 40000; i++)
+    {
+        seed = seed * 1103515245U + 12345U;
+        local_hashes.emplace_back(static_cast<uint64_t>(seed) << 32U | i);      // Top bits select a shard
+    }
+    // Block lengths are preserved, therefore other blocks stay in place.
+    remote_hashes = local_hashes;
+    for (size_t i = 0; i < remote_hashes.size() - 100; i += 97)
+    {
+        if (i % 2)
+            remote_hashes[i] += 7;
+        else
+        {
+            auto j = i + 1;
+            while (remote_hashes[j] % 7 != remote_hashes[i] % 7)
+                j++;
+            std::swap(remote_hashes[i], remote_hashes[j]);
+        }
+    }
+    auto to_boundary_list = [](const std::vector<uint64_t>& hashes)
+    {
+        auto result = make_boundary_list(hashes);
+        for (auto& boundary : result)
+            boundary.fingerprint = boundary.hash >> 40U;
+        return result;
+    };
+    auto local = to_boundary_list(local_hashes);
+    auto remote = to_boundary_list(remote_hashes);
+
+    auto expected = zinc::compare_files(local, remote, nullptr, 1);
+    REQUIRE(expected.size() > 400);
+    for (size_t threads : {2, 3, 8})
+    {
+        auto result = zinc::compare_files(local, remote, nullptr, threads);
+        REQUIRE(result.size() == expected.size());
+        for (size_t i = 0; i < result.size(); i++)
+        {
+            REQUIRE(result[i].remote == expected[i].remote);
+            REQUIRE(result[i].local == expected[i].local);
+            REQUIRE(result[i].from_remote == expected[i].from_remote);
+        }
+    }
+
+    zinc::CompactBoundaryList compact_local(local), compact_remote(remote);
+    auto compact_expected = zinc::compare_files(compact_local, compact_remote, nullptr, 1);
+    REQUIRE(compact_expected.size() == expected.size());
+    for (size_t threads : {2, 3, 8})
+    {
+        auto result = zinc::compare_files(compact_local, compact_remote, nullptr, threads);
+        REQUIRE(result.size() == compact_expected.size());
+        for (size_t i = 0; i < result.size(); i++)
+        {
+            REQUIRE(result[i].remote == compact_expected[i].remote);
+            REQUIRE(result[i].local == compact_expected[i].local);
+            REQUIRE(result[i].from_remote == compact_expected[i].from_remote);
+        }
+    }
+}
@@ -14,6 +14,92 @@ TEST_CASE("buzhash")
     REQUIRE(hash_rotated == hash_expected);
 }
 
+void test_buzhash_kernels(unsigned match_bits)
+{
+    zinc::Parameters parameters;
+    parameters.match_bits = match_bits;
+
+    std::vector<uint8_t> data(4 * 1024 * 1024 + 12345 + parameters.window_length);
+    uint32_t seed = 1;
+    for (auto& value : data)
+    {
+        seed = seed * 1103515245U + 12345U;
+        value = static_cast<uint8_t>(seed >> 16U);
+    }
+    auto count = data.size() - parameters.window_length;
+    auto fingerprint = zinc::detail::buzhash(&data[0], parameters.window_length);
+
+    // Reference loop rolling one byte at a time.
+    zinc::BoundaryList expected;
+    auto expected_fingerprint = fingerprint;
+    const auto mask = (1U << parameters.match_bits) - 1U;
+    for (size_t i = 0; i < count; i++)
+    {
+        if ((expected_fingerprint & mask) == 0)
+        {
+            expected.emplace_back(zinc::Boundary{.start = static_cast<int64_t>(i), .fingerprint = expected_fingerprint,
+                .hash = 0, .length = 0});
+        }
+        expected_fingerprint = zinc::detail::buzhash_update(expected_fingerprint, data[i],
+            data[i + parameters.window_length], parameters.window_length);
+    }
+    REQUIRE(expected.size() > 0);
+    REQUIRE(expected_fingerprint == zinc::detail::buzhash(&data[count], parameters.window_length));
+
+    // Kernel selected for running CPU
+    zinc::BoundaryList selected;
+    auto selected_fingerprint = zinc::detail::find_split_points(&data[0], count, fingerprint, 0, parameters,
+        selected);
+    REQUIRE(selected_fingerprint == expected_fingerprint);
+
+    // Generic kernel
+    zinc::BoundaryList generic;
+    zinc::detail::GenericRollingHash kernel(parameters.window_length, parameters.match_bits);
+    auto add_generic = [&](size_t position, uint32_t match)
+    {
+        generic.emplace_back(zinc::Boundary{.start = static_cast<int64_t>(position), .fingerprint = match, .hash = 0,
+            .length = 0});
+    };
+    auto generic_fingerprint = zinc::detail::buzhash_scan(kernel, &data[0], count, fingerprint, add_generic);
+    REQUIRE(generic_fingerprint == expected_fingerprint);
+
+    REQUIRE(selected.size() == expected.size());
+    REQUIRE(generic.size() == expected.size());
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+        REQUIRE(selected[i].start == expected[i].start);
+        REQUIRE(selected[i].fingerprint == expected[i].fingerprint);
+        REQUIRE(generic[i].start == expected[i].start);
+        REQUIRE(generic[i].fingerprint == expected[i].fingerprint);
+    }
+
+    // Every kernel must produce identical results
+    for (auto scan_kernel : {zinc::detail::ScanKernel::Serial, zinc::detail::ScanKernel::Lanes,
+                             zinc::detail::ScanKernel::AVX2, zinc::detail::ScanKernel::AVX512,
+                             zinc::detail::ScanKernel::Auto})
+    {
+        if (!zinc::detail::is_scan_kernel_supported(scan_kernel))
+            continue;
+
+        zinc::BoundaryList lanes;
+        auto lanes_fingerprint = zinc::detail::find_split_points(&data[0], count, fingerprint, 100, parameters, lanes,
+            scan_kernel);
+        REQUIRE(lanes_fingerprint == expected_fingerprint);
+        REQUIRE(lanes.size() == expected.size());
+        for (size_t i = 0; i < expected.size(); i++)
+        {
+            REQUIRE(lanes[i].start == expected[i].start + 100);
+            REQUIRE(lanes[i].fingerprint == expected[i].fingerprint);
+        }
+    }
+}
+
+TEST_CASE("buzhash kernels")
+{
+    test_buzhash_kernels(19);
+    test_buzhash_kernels(12);       // Many matches
+}
+
 // From http://www.isthe.com/chongo/src/fnv/test_fnv.c
 #define LEN(x) (sizeof(x)-1)
 /* TEST macro does not include trailing NUL byte in the test vector */
@@ -440,3 +526,279 @@ TEST_CASE("fnv64a")
         REQUIRE(zinc::detail::fnv64a(reinterpret_cast<const uint8_t*>(fnv1a_64_vector[i].str->value), fnv1a_64_vector[i].str->length) == fnv1a_64_vector[i].hash);
     }
 }
+
+TEST_CASE("fnv64a zeros")
+{
+    std::vector<uint8_t> zeros(100000, 0);
+    for (size_t length : {0, 1, 2, 3, 64, 4095, 4096, 99999, 100000})
+    {
+        REQUIRE(zinc::detail::fnv64a_zeros(length) == zinc::detail::fnv64a(zeros.data(), length));
+        REQUIRE(zinc::detail::fnv64a_zeros(length, 12345) == zinc::detail::fnv64a(zeros.data(), length, 12345));
+    }
+
+    auto block = zinc::Boundary{.start = 0, .fingerprint = 0, .hash = zinc::detail::fnv64a(zeros.data(), 5000),
+        .length = 5000};
+    REQUIRE(zinc::is_zero_block(block));
+    block.length = 4999;
+    REQUIRE(!zinc::is_zero_block(block));
+}
+
+TEST_CASE("tree block hashes")
+{
+    std::vector<uint8_t> data(100000);
+    uint32_t seed = 9;
+    for (auto& value : data)
+    {
+        seed = seed * 1103515245U + 12345U;
+        value = static_cast<uint8_t>(seed >> 16U);
+    }
+
+    for (size_t length : {0, 1, 999, 1000, 1001, 100000})
+    {
+        REQUIRE(zinc::detail::block_hash(data.data(), length) == zinc::detail::fnv64a(data.data(), length));
+
+        // Hash of leaf hashes
+        std::vector<uint64_t> leaves;
+        for (size_t offset = 0; offset < length; offset += 1000)
+            leaves.push_back(zinc::detail::fnv64a(data.data() + offset, std::min<size_t>(1000, length - offset)));
+        auto expected = zinc::detail::fnv64a_combine(leaves.data(), leaves.size());
+        REQUIRE(zinc::detail::block_hash(data.data(), length, 1000) == expected);
+    }
+
+    std::vector<uint8_t> zeros(100000, 0);
+    for (size_t length : {0, 1, 999, 1000, 1001, 100000})
+        REQUIRE(zinc::detail::block_hash_zeros(length, 1000) == zinc::detail::block_hash(zeros.data(), length, 1000));
+
+    zinc::Parameters parameters;
+    parameters.hash_leaf_size = 1000;
+    auto block = zinc::Boundary{.start = 0, .fingerprint = 0,
+        .hash = zinc::detail::block_hash(zeros.data(), 5000, 1000), .length = 5000};
+    REQUIRE(zinc::is_zero_block(block, &parameters));
+    REQUIRE(!zinc::is_zero_block(block));
+}
+
+/// Pseudo-random data identical on every run.
+std::vector<uint8_t> random_data(size_t size, uint32_t seed)
+{
+    std::vector<uint8_t> data(size);
+    for (auto& value : data)
+    {
+        seed = seed * 1103515245U + 12345U;
+        value = static_cast<uint8_t>(seed >> 16U);
+    }
+    return data;
+}
+
+TEST_CASE("block sketches")
+{
+    auto block = random_data(256 * 1024, 1);
+    auto edited = block;
+    for (size_t i = 0; i < 10; i++)
+        edited[i * 20000 + 7] ^= 0xff;
+    auto unrelated = random_data(256 * 1024, 2);
+
+    std::vector<zinc::BlockSketch> sketches{
+        zinc::detail::block_sketch(unrelated.data(), unrelated.size()),
+        zinc::detail::block_sketch(block.data(), block.size()),
+        zinc::detail::block_sketch(block.data(), 8),                     // Too short to be sketched
+    };
+    for (auto feature : sketches[2].features)
+        REQUIRE(feature == 0);
+
+    zinc::SimilarityIndex index(sketches);
+    REQUIRE(index.find(zinc::detail::block_sketch(edited.data(), edited.size())) == 1);
+    REQUIRE(index.find(sketches[2]) == zinc::SimilarityIndex::npos);
+}
+
+TEST_CASE("delta encoding")
+{
+    auto reference = random_data(100000, 3);
+    auto target = reference;
+    target.erase(target.begin() + 5000, target.begin() + 5100);                     // Removed
+    target.insert(target.begin() + 20000, reference.begin() + 90000, reference.end()); // Repeated
+    for (size_t i = 30000; i < 30010; i++)
+        target[i] = 0;                                                               // Overwritten
+    auto appended = random_data(123, 4);
+    target.insert(target.end(), appended.begin(), appended.end());                  // New
+
+    auto delta = zinc::encode_delta(reference.data(), reference.size(), target.data(), target.size());
+    REQUIRE(delta.size() < 300);
+    std::vector<uint8_t> decoded;
+    REQUIRE(zinc::decode_delta(reference.data(), reference.size(), delta.data(), delta.size(), decoded));
+    REQUIRE(decoded == target);
+
+    // Nothing in common and nothing to refer to.
+    auto unrelated = zinc::encode_delta(reference.data(), reference.size(), appended.data(), appended.size());
+    REQUIRE(zinc::decode_delta(reference.data(), reference.size(), unrelated.data(), unrelated.size(), decoded));
+    REQUIRE(decoded == appended);
+    auto empty = zinc::encode_delta(nullptr, 0, appended.data(), appended.size());
+    REQUIRE(zinc::decode_delta(nullptr, 0, empty.data(), empty.size(), decoded));
+    REQUIRE(decoded == appended);
+
+    // Malformed deltas.
+    REQUIRE(!zinc::decode_delta(reference.data(), 1000, delta.data(), delta.size(), decoded));
+    REQUIRE(!zinc::decode_delta(reference.data(), reference.size(), delta.data(), delta.size() - 1, decoded));
+}
+
+/// Returns tar member with a ustar header and data padded to 512 bytes.
+std::vector<uint8_t> tar_member(const std::string& name, const std::vector<uint8_t>& data)
+{
+    std::vector<uint8_t> member(512, 0);
+    auto put = [&](size_t offset, const std::string& value)
+    {
+        std::copy(value.begin(), value.end(), member.begin() + offset);
+    };
+    char field[16];
+    put(0, name);
+    put(100, "0000644");
+    put(108, "0000000");
+    put(116, "0000000");
+    snprintf(field, sizeof(field), "%011o", static_cast<unsigned>(data.size()));
+    put(124, field);
+    put(136, "00000000000");
+    member[156] = '0';
+    put(257, "ustar");
+    put(263, "00");
+    put(148, "        ");
+    unsigned checksum = 0;
+    for (auto value : member)
+        checksum += value;
+    snprintf(field, sizeof(field), "%06o", checksum);
+    put(148, field);
+    member[155] = ' ';
+    member.insert(member.end(), data.begin(), data.end());
+    member.resize((member.size() + 511) / 512 * 512, 0);
+    return member;
+}
+
+/// Returns zip archive storing members without compression.
+std::vector<uint8_t> zip_archive(const std::vector<std::vector<uint8_t>>& members)
+{
+    std::vector<uint8_t> archive;
+    std::vector<uint8_t> directory;
+    auto put = [](std::vector<uint8_t>& output, uint32_t value, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+            output.push_back(static_cast<uint8_t>(value >> (i * 8)));
+    };
+    for (size_t i = 0; i < members.size(); i++)
+    {
+        auto offset = static_cast<uint32_t>(archive.size());
+        auto size = static_cast<uint32_t>(members[i].size());
+        put(archive, 0x04034b50, 4);
+        put(archive, 20, 2);
+        put(archive, 0, 2 + 2 + 4 + 4);                 // Flags, method, time, date, crc
+        put(archive, size, 4);
+        put(archive, size, 4);
+        put(archive, 1, 2);
+        put(archive, 0, 2);
+        archive.push_back(static_cast<uint8_t>('a' + i));
+        archive.insert(archive.end(), members[i].begin(), members[i].end());
+
+        put(directory, 0x02014b50, 4);
+        put(directory, 20, 2);
+        put(directory, 20, 2);
+        put(directory, 0, 2 + 2 + 4 + 4);
+        put(directory, size, 4);
+        put(directory, size, 4);
+        put(directory, 1, 2);
+        put(directory, 0, 2 + 2 + 2 + 2 + 4);           // Extra, comment, disk, attributes
+        put(directory, offset, 4);
+        directory.push_back(static_cast<uint8_t>('a' + i));
+    }
+    auto directory_offset = static_cast<uint32_t>(archive.size());
+    archive.insert(archive.end(), directory.begin(), directory.end());
+    put(archive, 0x06054b50, 4);
+    put(archive, 0, 4);
+    put(archive, static_cast<uint32_t>(members.size()), 2);
+    put(archive, static_cast<uint32_t>(members.size()), 2);
+    put(archive, static_cast<uint32_t>(directory.size()), 4);
+    put(archive, directory_offset, 4);
+    put(archive, 0, 2);
+    return archive;
+}
+
+TEST_CASE("archive boundaries")
+{
+    zinc::Parameters parameters;
+    parameters.window_length = 64;
+    parameters.min_block_size = 2048;
+    parameters.max_block_size = 16384;
+    parameters.match_bits = 12;
+    parameters.archive_boundaries = true;
+
+    std::vector<std::vector<uint8_t>> members{random_data(20000, 1), random_data(100, 2), random_data(15000, 3),
+        random_data(30000, 4)};
+    auto members_of = [](const std::vector<uint8_t>& archive)
+    {
+        auto read = [&](int64_t offset, size_t length) -> const uint8_t*
+        {
+            if (offset < 0 || static_cast<uint64_t>(offset) + length > archive.size())
+                return nullptr;
+            return &archive[static_cast<size_t>(offset)];
+        };
+        return zinc::detail::find_archive_members(read, static_cast<int64_t>(archive.size()));
+    };
+    auto partition = [&](const std::vector<uint8_t>& archive)
+    {
+        return zinc::partition_buffer(archive.data(), archive.size(), 1, nullptr, nullptr, nullptr, &parameters).get();
+    };
+
+    SECTION("tar")
+    {
+        std::vector<uint8_t> archive;
+        std::vector<int64_t> expected;
+        for (size_t i = 0; i < members.size(); i++)
+        {
+            expected.push_back(static_cast<int64_t>(archive.size()));
+            auto member = tar_member("file" + std::to_string(i), members[i]);
+            archive.insert(archive.end(), member.begin(), member.end());
+        }
+        archive.resize(archive.size() + 1024, 0);                       // End of archive
+        REQUIRE(members_of(archive) == expected);
+
+        // Member long enough to have blocks of it's own starts at a block boundary.
+        auto blocks = partition(archive);
+        auto starts_block = [&](int64_t offset)
+        {
+            auto at_offset = [&](const zinc::Boundary& b) { return b.start == offset; };
+            return std::find_if(blocks.begin(), blocks.end(), at_offset) != blocks.end();
+        };
+        REQUIRE(starts_block(expected[2]));
+        REQUIRE(starts_block(expected[3]));
+        REQUIRE(!starts_block(expected[1]));
+
+        // Adding a member in front does not change blocks of following members.
+        auto added = tar_member("added", random_data(7777, 5));
+        archive.insert(archive.begin(), added.begin(), added.end());
+        auto shifted = partition(archive);
+        std::vector<uint64_t> hashes;
+        for (const auto& block : shifted)
+            hashes.push_back(block.hash);
+        for (const auto& block : blocks)
+        {
+            if (block.start >= expected[2])
+                REQUIRE(std::find(hashes.begin(), hashes.end(), block.hash) != hashes.end());
+        }
+    }
+    SECTION("zip")
+    {
+        auto archive = zip_archive(members);
+        auto found = members_of(archive);
+        REQUIRE(found.size() == members.size() + 1);
+        REQUIRE(found[0] == 0);
+        for (size_t i = 1; i < found.size(); i++)
+            REQUIRE(found[i] == found[i - 1] + 31 + static_cast<int64_t>(members[i - 1].size()));
+    }
+    SECTION("not an archive")
+    {
+        auto data = random_data(100000, 6);
+        REQUIRE(members_of(data).empty());
+        auto blocks = partition(data);
+        parameters.archive_boundaries = false;
+        auto expected = partition(data);
+        REQUIRE(blocks.size() == expected.size());
+        for (size_t i = 0; i < blocks.size(); i++)
+            REQUIRE(blocks[i].hash == expected[i].hash);
+    }
+}
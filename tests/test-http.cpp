@@ -0,0 +1,345 @@
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+#include <zinc/http.h>
+#include <zinc/zinc.h>
+#if __linux__
+#   include <sys/socket.h>
+#   include <sys/stat.h>
+#   include <netinet/in.h>
+#   include <arpa/inet.h>
+#   include <unistd.h>
+#endif
+#include <cstring>
+#include <map>
+#include <thread>
+#include <vector>
+
+#if __linux__
+/// Directory with a served file, removed at the end of a test.
+struct ServedDirectory
+{
+    explicit ServedDirectory(size_t size = 100000)
+    {
+        REQUIRE(mkdtemp(path) != nullptr);
+        data.resize(size);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = static_cast<char>(i * 31 + i / 251);
+        FILE* file = fopen((std::string(path) + "/file.bin").c_str(), "wb");
+        fwrite(data.data(), 1, data.size(), file);
+        fclose(file);
+    }
+
+    ~ServedDirectory()
+    {
+        remove((std::string(path) + "/file.bin").c_str());
+        rmdir(path);
+    }
+
+    char path[32] = "/tmp/zinc-http-XXXXXX";
+    std::string data;
+};
+
+struct Response
+{
+    int status = 0;
+    std::map<std::string, std::string> headers;
+    std::string body;
+};
+
+int connect_to(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool send_text(int fd, const std::string& text)
+{
+    return send(fd, text.data(), text.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(text.size());
+}
+
+/// Read one response, `pending` keeps data received past it's end.
+bool read_response(int fd, Response& response, std::string& pending, bool head = false)
+{
+    char buffer[4096];
+    size_t header_end;
+    while ((header_end = pending.find("\r\n\r\n")) == std::string::npos)
+    {
+        auto received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+            return false;
+        pending.append(buffer, static_cast<size_t>(received));
+    }
+
+    response = Response();
+    auto headers = pending.substr(0, header_end);
+    pending.erase(0, header_end + 4);
+    response.status = std::stoi(headers.substr(9, 3));
+    for (auto position = headers.find("\r\n"); position != std::string::npos;)
+    {
+        auto next = headers.find("\r\n", position + 2);
+        auto line = headers.substr(position + 2, next == std::string::npos ? std::string::npos : next - position - 2);
+        auto colon = line.find(':');
+        response.headers[line.substr(0, colon)] = line.substr(colon + 2);
+        position = next;
+    }
+
+    auto length = head ? 0 : std::stoul(response.headers["Content-Length"]);
+    while (pending.size() < length)
+    {
+        auto received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+            return false;
+        pending.append(buffer, static_cast<size_t>(received));
+    }
+    response.body = pending.substr(0, length);
+    pending.erase(0, length);
+    return true;
+}
+
+Response request(uint16_t port, const std::string& text)
+{
+    Response response;
+    std::string pending;
+    int fd = connect_to(port);
+    REQUIRE(fd >= 0);
+    REQUIRE(send_text(fd, text));
+    REQUIRE(read_response(fd, response, pending, text.compare(0, 4, "HEAD") == 0));
+    close(fd);
+    return response;
+}
+
+TEST_CASE("HttpServer")
+{
+    ServedDirectory directory;
+    zinc::HttpServer server(directory.path);
+    REQUIRE(server.listen("127.0.0.1", 0));
+    REQUIRE(server.port() != 0);
+    std::thread thread([&]() { server.run(); });
+    const auto& data = directory.data;
+
+    SECTION("Whole file")
+    {
+        auto response = request(server.port(), "GET /file.bin HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        REQUIRE(response.status == 200);
+        REQUIRE(response.body == data);
+
+        response = request(server.port(), "HEAD /file.bin HTTP/1.1\r\n\r\n");
+        REQUIRE(response.status == 200);
+        REQUIRE(response.headers["Content-Length"] == "100000");
+        REQUIRE(response.body.empty());
+    }
+
+    SECTION("Single range")
+    {
+        auto response = request(server.port(), "GET /file.bin HTTP/1.1\r\nRange: bytes=1000-1999\r\n\r\n");
+        REQUIRE(response.status == 206);
+        REQUIRE(response.headers["Content-Range"] == "bytes 1000-1999/100000");
+        REQUIRE(response.body == data.substr(1000, 1000));
+
+        response = request(server.port(), "GET /file.bin HTTP/1.1\r\nRange: bytes=-10\r\n\r\n");
+        REQUIRE(response.body == data.substr(data.size() - 10));
+        response = request(server.port(), "GET /file.bin HTTP/1.1\r\nRange: bytes=99990-200000\r\n\r\n");
+        REQUIRE(response.body == data.substr(99990));
+    }
+
+    SECTION("Multiple ranges")
+    {
+        auto response = request(server.port(),
+            "GET /file.bin HTTP/1.1\r\nRange: bytes=0-9, 50000-50099,99999-\r\n\r\n");
+        REQUIRE(response.status == 206);
+        const std::string boundary = "boundary=";
+        auto type = response.headers["Content-Type"];
+        REQUIRE(type.compare(0, 21, "multipart/byteranges;") == 0);
+        auto separator = "--" + type.substr(type.find(boundary) + boundary.size());
+
+        std::vector<std::string> parts;
+        std::vector<std::string> ranges;
+        for (auto position = response.body.find(separator); position != std::string::npos;)
+        {
+            auto headers_end = response.body.find("\r\n\r\n", position);
+            auto next = response.body.find("\r\n" + separator, position + 1);
+            if (response.body.compare(position + separator.size(), 2, "--") == 0)
+                break;
+            auto range = response.body.find("Content-Range: ", position);
+            ranges.push_back(response.body.substr(range + 15, response.body.find("\r\n", range) - range - 15));
+            parts.push_back(response.body.substr(headers_end + 4, next - headers_end - 4));
+            position = next + 2;
+        }
+        REQUIRE(ranges == std::vector<std::string>({"bytes 0-9/100000", "bytes 50000-50099/100000",
+            "bytes 99999-99999/100000"}));
+
+        REQUIRE(parts == std::vector<std::string>({data.substr(0, 10), data.substr(50000, 100), data.substr(99999)}));
+
+        // Overlapping and adjacent ranges are sent once.
+        response = request(server.port(), "GET /file.bin HTTP/1.1\r\nRange: bytes=0-,0-,500-999,100-499\r\n\r\n");
+        REQUIRE(response.status == 206);
+        REQUIRE(response.headers["Content-Range"] == "bytes 0-99999/100000");
+        REQUIRE(response.body == data);
+
+        // Too many ranges are answered with entire file.
+        std::string many = "bytes=0-0";
+        for (int i = 1; i <= 64; i++)
+            many += "," + std::to_string(i * 10) + "-" + std::to_string(i * 10);
+        response = request(server.port(), "GET /file.bin HTTP/1.1\r\nRange: " + many + "\r\n\r\n");
+        REQUIRE(response.status == 200);
+        REQUIRE(response.body == data);
+    }
+
+    SECTION("Errors")
+    {
+        REQUIRE(request(server.port(), "GET /missing HTTP/1.1\r\n\r\n").status == 404);
+        REQUIRE(request(server.port(), "GET /../etc/passwd HTTP/1.1\r\n\r\n").status == 400);
+        REQUIRE(request(server.port(), "GET /%2e%2e/etc/passwd HTTP/1.1\r\n\r\n").status == 400);
+        REQUIRE(request(server.port(), "POST /file.bin HTTP/1.1\r\n\r\n").status == 405);
+        auto response = request(server.port(), "GET /file.bin HTTP/1.1\r\nRange: bytes=100000-\r\n\r\n");
+        REQUIRE(response.status == 416);
+        REQUIRE(response.headers["Content-Range"] == "bytes */100000");
+        // Invalid range header is ignored.
+        REQUIRE(request(server.port(), "GET /file.bin HTTP/1.1\r\nRange: lines=1-2\r\n\r\n").status == 200);
+    }
+
+    SECTION("Keep-alive and pipelining")
+    {
+        int fd = connect_to(server.port());
+        std::string pending;
+        Response response;
+        for (int i = 0; i < 3; i++)
+        {
+            REQUIRE(send_text(fd, "GET /file.bin HTTP/1.1\r\nRange: bytes=" + std::to_string(i * 10) + "-" +
+                std::to_string(i * 10 + 9) + "\r\n\r\n"));
+            REQUIRE(read_response(fd, response, pending));
+            REQUIRE(response.body == data.substr(i * 10, 10));
+        }
+
+        // Pipelined requests, connection is closed after the last one.
+        REQUIRE(send_text(fd, "GET /file.bin HTTP/1.1\r\nRange: bytes=0-0\r\n\r\nGET /file.bin HTTP/1.1\r\n"
+            "Range: bytes=1-1\r\nConnection: close\r\n\r\n"));
+        REQUIRE(read_response(fd, response, pending));
+        REQUIRE(response.body == data.substr(0, 1));
+        REQUIRE(read_response(fd, response, pending));
+        REQUIRE(response.body == data.substr(1, 1));
+        char byte;
+        REQUIRE(recv(fd, &byte, 1, 0) == 0);
+        close(fd);
+    }
+
+    SECTION("Many concurrent clients")
+    {
+        const int num_clients = 1000;
+        std::vector<int> clients;
+        for (int i = 0; i < num_clients; i++)
+        {
+            clients.push_back(connect_to(server.port()));
+            REQUIRE(clients.back() >= 0);
+        }
+        for (int i = 0; i < num_clients; i++)
+        {
+            REQUIRE(send_text(clients[i], "GET /file.bin HTTP/1.1\r\nRange: bytes=" + std::to_string(i * 50) + "-" +
+                std::to_string(i * 50 + 49) + "\r\n\r\n"));
+        }
+        for (int i = 0; i < num_clients; i++)
+        {
+            Response response;
+            std::string pending;
+            REQUIRE(read_response(clients[i], response, pending));
+            REQUIRE(response.body == data.substr(static_cast<size_t>(i) * 50, 50));
+            close(clients[i]);
+        }
+    }
+
+    server.stop();
+    thread.join();
+}
+
+TEST_CASE("HttpSource")
+{
+    ServedDirectory directory(3 * 1024 * 1024);
+    zinc::HttpServer server(directory.path);
+    REQUIRE(server.listen("127.0.0.1", 0));
+    std::thread thread([&]() { server.run(); });
+    const auto& data = directory.data;
+    auto url = "http://127.0.0.1:" + std::to_string(server.port()) + "/file.bin";
+
+    zinc::HttpSource source(url, 4);
+    REQUIRE(source.valid());
+    std::string result(data.size(), 0);
+    auto* buffer = (uint8_t*)&result[0];
+
+    SECTION("Reads")
+    {
+        REQUIRE(source.read(1000, buffer, 100));
+        REQUIRE(result.substr(0, 100) == data.substr(1000, 100));
+
+        // Large read is split between connections.
+        REQUIRE(source.read(0, buffer, data.size()));
+        REQUIRE(result == data);
+
+        std::string file;
+        REQUIRE(source.get(file));
+        REQUIRE(file == data);
+    }
+
+    SECTION("Multiple ranges")
+    {
+        // Ranges are scattered, adjacent, overlapping and duplicated.
+        std::vector<zinc::RemoteRange> ranges;
+        std::vector<std::string> buffers;
+        std::vector<std::pair<int64_t, size_t>> specs{{0, 10}, {10, 10}, {15, 30}, {15, 30}};
+        for (int i = 0; i < 200; i++)
+            specs.emplace_back(100000 + i * 12345, 100 + i);
+        for (const auto& spec : specs)
+            buffers.emplace_back(spec.second, 0);
+        for (size_t i = 0; i < specs.size(); i++)
+            ranges.push_back(zinc::RemoteRange{specs[i].first, (uint8_t*)&buffers[i][0], specs[i].second});
+        REQUIRE(source.read_ranges(ranges));
+        for (size_t i = 0; i < specs.size(); i++)
+            REQUIRE(buffers[i] == data.substr(static_cast<size_t>(specs[i].first), specs[i].second));
+    }
+
+    SECTION("Failures")
+    {
+        REQUIRE(!source.read(data.size(), buffer, 10));
+        zinc::HttpSource missing("http://127.0.0.1:" + std::to_string(server.port()) + "/missing.bin");
+        REQUIRE(!missing.read(0, buffer, 10));
+        std::string file;
+        REQUIRE(!missing.get(file));
+        REQUIRE(!zinc::HttpSource("ftp://127.0.0.1/file.bin").valid());
+
+        // Source keeps working after a failed request.
+        REQUIRE(source.read(5, buffer, 5));
+        REQUIRE(result.substr(0, 5) == data.substr(5, 5));
+    }
+
+    SECTION("Patch")
+    {
+        // Many small downloads are fetched in batches of ranges.
+        std::string old_data(data.size(), 'a');
+        zinc::PatchOperationList patch;
+        for (int64_t offset = 0; offset < static_cast<int64_t>(data.size()); offset += 4096)
+            patch.push_back(zinc::PatchOperation{zinc::PatchOperation::Download, offset, offset, 1000});
+        auto expected = old_data;
+        for (const auto& operation : patch)
+            expected.replace(operation.destination, operation.length, data, operation.source, operation.length);
+
+        FILE* file = tmpfile();
+        fwrite(old_data.data(), 1, old_data.size(), file);
+        REQUIRE(zinc::apply_patch(file, patch, &source));
+        fseek(file, 0, SEEK_SET);
+        REQUIRE(fread(&result[0], 1, result.size(), file) == result.size());
+        REQUIRE(result == expected);
+        fclose(file);
+    }
+
+    server.stop();
+    thread.join();
+}
+#endif
@@ -1,4 +1,10 @@
 #include <stdio.h>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#if !_WIN32
+#   include <unistd.h>
+#endif
 #define CATCH_CONFIG_MAIN
 #include <catch.hpp>
 #include <zinc/zinc.h>
@@ -32,6 +38,33 @@ void fclose(FILE* fp, void* data, size_t len)
 }
 #endif
 
+/// Apply patch to a copy of `old_data` stored in `file` and return resulting file contents. Written data is verified
+/// against `new_parts`. Downloads are fetched `prefetch_size` bytes ahead.
+std::string apply_patch_test(FILE* file, const std::string& old_data, const std::string& new_data,
+    const zinc::PatchOperationList& patch, const zinc::BoundaryList& new_parts, size_t prefetch_size)
+{
+    auto parameters = get_parameters();
+    parameters.read_buffer_size = 7;    // Force moves to be split into many chunks
+    parameters.download_prefetch_size = prefetch_size;
+    fseek(file, 0, SEEK_SET);
+    fwrite(old_data.data(), 1, old_data.size(), file);
+
+    FILE* new_fp = fmemopen((void*)new_data.data(), new_data.length(), "rb");
+    zinc::FileSource remote(new_fp);
+    zinc::CompactBoundaryList blocks(new_parts);
+    zinc::PatchVerifier verifier(blocks, &parameters);
+    REQUIRE(zinc::apply_patch(file, patch, &remote, &parameters, nullptr, &verifier));
+    REQUIRE(verifier.mismatched().empty());
+    REQUIRE(verifier.finish(file));
+    REQUIRE(verifier.digest() == zinc::file_digest(new_parts));
+    fclose(new_fp);
+
+    std::string result(new_data.size(), 0);
+    fseek(file, 0, SEEK_SET);
+    REQUIRE(fread(&result[0], 1, result.size(), file) == result.size());
+    return result;
+}
+
 bool data_sync_test(std::string old_data, const std::string& new_data)
 {
     auto parameters = get_parameters();
@@ -49,6 +82,17 @@ bool data_sync_test(std::string old_data, const std::string& new_data)
 
     zinc::SyncOperationList delta = zinc::compare_files(old_parts, new_parts);
 
+    // Same delta applied as a merged patch, to a file with a descriptor and to a memory stream.
+    auto patch = zinc::build_patch(delta);
+    REQUIRE(patch.size() <= delta.size());
+    std::string padded_old_data = old_data;
+    FILE* patched_fp = tmpfile();
+    REQUIRE(apply_patch_test(patched_fp, padded_old_data, new_data, patch, new_parts, 0) == new_data);
+    fclose(patched_fp);
+    patched_fp = fmemopen(&padded_old_data[0], padded_old_data.size(), "r+b");
+    REQUIRE(apply_patch_test(patched_fp, old_data, new_data, patch, new_parts, 20) == new_data);
+    fclose(patched_fp);
+
     std::string buffer;
     for (const auto& op : delta)
     {
@@ -167,3 +211,1017 @@ TEST_CASE("FuzzTest3")
 {
     REQUIRE(data_sync_test("h'10{'6rI8RI5N@RI5N@u+!BkRI5N@u+!Bk29H0<p+n{ZIu{*", "h'10 |Av2{'6rI8RI5N@u+!Bk2I,Qq){QkZIuX/"));
 }
+
+TEST_CASE("ZeroBlocks")
+{
+    std::string old_data = "1234567890abcdefghijklmnopqrstuvwxyz";
+    std::string new_data = "1234567890" + std::string(200, '\0') + "abcdefghij" + std::string(100, '\0') + "klmnop";
+    REQUIRE(data_sync_test(old_data, new_data));
+    REQUIRE(data_sync_test(new_data, old_data));
+
+    auto parameters = get_parameters();
+    auto old_parts = zinc::partition_buffer(reinterpret_cast<const uint8_t*>(old_data.data()), old_data.size(), 1,
+        nullptr, nullptr, nullptr, &parameters).get();
+    auto new_parts = zinc::partition_buffer(reinterpret_cast<const uint8_t*>(new_data.data()), new_data.size(), 1,
+        nullptr, nullptr, nullptr, &parameters).get();
+
+    // Zero blocks are filled in place, never downloaded
+    int64_t zeroed = 0;
+    for (const auto& operation : zinc::build_patch(zinc::compare_files(old_parts, new_parts)))
+    {
+        if (operation.type == zinc::PatchOperation::Zero)
+            zeroed += operation.length;
+        else if (operation.type == zinc::PatchOperation::Download)
+        {
+            const auto* source = &new_data[operation.source];
+            REQUIRE(std::count(source, source + operation.length, '\0') < operation.length);
+        }
+    }
+    REQUIRE(zeroed > 200);
+}
+
+TEST_CASE("SparseFile")
+{
+    auto parameters = get_parameters();
+    parameters.window_length = 63;      // Fingerprint of zeros in a window of 64 bytes would match any mask
+    parameters.match_bits = 8;
+    parameters.min_block_size = 100;
+    parameters.max_block_size = 4000;
+
+    // Data and holes of various sizes, ending with a hole.
+    std::string data(1200000, '\0');
+    uint32_t seed = 11;
+    for (auto range : {std::make_pair(0, 5000), std::make_pair(300000, 301000), std::make_pair(301050, 310000),
+                       std::make_pair(700000, 700001)})
+    {
+        for (auto i = range.first; i < range.second; i++)
+        {
+            seed = seed * 1103515245U + 12345U;
+            data[i] = static_cast<char>(seed >> 16U);
+        }
+    }
+
+    FILE* fp = tmpfile();
+    for (auto range : {std::make_pair(0, 5000), std::make_pair(300000, 310000), std::make_pair(700000, 700001)})
+    {
+        fseek(fp, range.first, SEEK_SET);
+        fwrite(&data[range.first], 1, range.second - range.first, fp);
+    }
+#if !_WIN32
+    fflush(fp);
+    REQUIRE(ftruncate(fileno(fp), data.size()) == 0);
+#else
+    fseek(fp, data.size() - 1, SEEK_SET);
+    fputc(0, fp);
+#endif
+    rewind(fp);
+
+    auto expected = zinc::partition_buffer(reinterpret_cast<const uint8_t*>(data.data()), data.size(), 1, nullptr,
+        nullptr, nullptr, &parameters).get();
+    parameters.reader_threads = 1;
+    auto result = zinc::partition_file(fp, 2, nullptr, nullptr, nullptr, &parameters).get();
+    fclose(fp);
+
+    REQUIRE(result.size() == expected.size());
+    for (size_t i = 0; i < result.size(); i++)
+    {
+        REQUIRE(result[i].start == expected[i].start);
+        REQUIRE(result[i].length == expected[i].length);
+        REQUIRE(result[i].fingerprint == expected[i].fingerprint);
+        REQUIRE(result[i].hash == expected[i].hash);
+    }
+}
+
+/// Remote source that fails after `reads` reads.
+struct FailingSource : zinc::RemoteSource
+{
+    explicit FailingSource(const std::string& data, int reads) : data_(data), reads_(reads) { }
+    bool read(int64_t offset, uint8_t* buffer, size_t length) override
+    {
+        if (reads_-- <= 0)
+            return false;
+        memcpy(buffer, &data_[offset], length);
+        return true;
+    }
+
+    const std::string& data_;
+    int reads_;
+};
+
+TEST_CASE("PrefetchFailure")
+{
+    std::string old_data(100, 'a');
+    std::string new_data = old_data.substr(0, 50) + std::string(30, 'b') + old_data.substr(50);
+    zinc::PatchOperationList patch{
+        {zinc::PatchOperation::Copy, 50, 80, 50},
+        {zinc::PatchOperation::Download, 50, 50, 30},
+    };
+
+    for (size_t prefetch_size : {0, 10, 1000})
+    {
+        auto parameters = get_parameters();
+        parameters.read_buffer_size = 10;
+        parameters.download_prefetch_size = prefetch_size;
+
+        FILE* file = tmpfile();
+        fwrite(old_data.data(), 1, old_data.size(), file);
+        FailingSource failing(new_data, 2);
+        REQUIRE(!zinc::apply_patch(file, patch, &failing, &parameters));
+
+        FailingSource remote(new_data, 3);
+        fseek(file, 0, SEEK_SET);
+        fwrite(old_data.data(), 1, old_data.size(), file);
+        REQUIRE(zinc::apply_patch(file, patch, &remote, &parameters));
+        std::string result(new_data.size(), 0);
+        fseek(file, 0, SEEK_SET);
+        REQUIRE(fread(&result[0], 1, result.size(), file) == result.size());
+        REQUIRE(result == new_data);
+        fclose(file);
+    }
+}
+
+/// Source that takes `delay` to read, optionally failing.
+struct DelayedSource : zinc::RemoteSource
+{
+    DelayedSource(const std::string& data, std::chrono::milliseconds delay, bool fail = false)
+        : data_(data), delay_(delay), fail_(fail) { }
+
+    bool read(int64_t offset, uint8_t* buffer, size_t length) override
+    {
+        reads_++;
+        auto deadline = std::chrono::steady_clock::now() + delay_;
+        while (std::chrono::steady_clock::now() < deadline)
+        {
+            if (cancelled_.exchange(false))
+                return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (fail_)
+            return false;
+        memcpy(buffer, &data_[offset], length);
+        return true;
+    }
+
+    void cancel() override
+    {
+        cancelled_ = true;
+        cancels_++;
+    }
+
+    const std::string& data_;
+    std::chrono::milliseconds delay_;
+    bool fail_;
+    std::atomic<bool> cancelled_{false};
+    std::atomic<int> reads_{0};
+    std::atomic<int> cancels_{0};
+};
+
+TEST_CASE("MultiSource")
+{
+    std::string data(4 * 1024 * 1024, 0);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<char>(i * 7 + i / 256);
+    std::string result(data.size(), 0);
+    auto* buffer = (uint8_t*)&result[0];
+
+    zinc::MultiSourceOptions options;
+    options.initial_hedge_delay = std::chrono::milliseconds(50);
+    options.min_hedge_delay = std::chrono::milliseconds(10);
+    options.min_piece_size = 1024 * 1024;
+
+    SECTION("Slow reads are reissued on another source")
+    {
+        DelayedSource slow(data, std::chrono::milliseconds(5000));
+        DelayedSource fast(data, std::chrono::milliseconds(1));
+        auto start = std::chrono::steady_clock::now();
+        {
+            zinc::MultiSource source({&slow, &fast}, options);
+            REQUIRE(source.read(100, buffer, 1000));
+            REQUIRE(memcmp(buffer, &data[100], 1000) == 0);
+            REQUIRE(source.hedged_reads() == 1);
+
+            // Source that lost is not used again.
+            for (int i = 0; i < 10; i++)
+                REQUIRE(source.read(i * 1000, buffer, 1000));
+            REQUIRE(source.source_bytes() == std::vector<int64_t>({0, 11000}));
+            REQUIRE(slow.reads_ == 1);
+        }
+        REQUIRE(slow.cancels_ == 1);
+        REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(2000));
+    }
+
+    SECTION("Failed reads are retried on other sources")
+    {
+        DelayedSource broken(data, std::chrono::milliseconds(0), true);
+        DelayedSource working(data, std::chrono::milliseconds(0));
+        zinc::MultiSource source({&broken, &working}, options);
+        REQUIRE(source.read(0, buffer, 1000));
+        REQUIRE(memcmp(buffer, &data[0], 1000) == 0);
+        REQUIRE(source.source_bytes() == std::vector<int64_t>({0, 1000}));
+
+        zinc::MultiSource failing({&broken}, options);
+        REQUIRE(!failing.read(0, buffer, 1000));
+    }
+
+    SECTION("Large reads are split between sources")
+    {
+        DelayedSource first(data, std::chrono::milliseconds(5));
+        DelayedSource second(data, std::chrono::milliseconds(5));
+        DelayedSource third(data, std::chrono::milliseconds(5));
+        zinc::MultiSource source({&first, &second, &third}, options);
+        REQUIRE(source.read(0, buffer, data.size()));
+        REQUIRE(result == data);
+        auto bytes = source.source_bytes();
+        REQUIRE(bytes[0] > 0);
+        REQUIRE(bytes[1] > 0);
+        REQUIRE(bytes[2] > 0);
+        REQUIRE(bytes[0] + bytes[1] + bytes[2] == static_cast<int64_t>(data.size()));
+    }
+
+    SECTION("Patch is applied from multiple sources")
+    {
+        std::string old_data(data.size(), 'a');
+        zinc::PatchOperationList patch{{zinc::PatchOperation::Download, 0, 0, static_cast<int64_t>(data.size())}};
+        auto parameters = get_parameters();
+        parameters.read_buffer_size = 512 * 1024;
+        FILE* file = tmpfile();
+        fwrite(old_data.data(), 1, old_data.size(), file);
+
+        DelayedSource slow(data, std::chrono::milliseconds(5000));
+        DelayedSource fast(data, std::chrono::milliseconds(1));
+        zinc::MultiSource source({&slow, &fast}, options);
+        REQUIRE(zinc::apply_patch(file, patch, &source, &parameters));
+        fseek(file, 0, SEEK_SET);
+        REQUIRE(fread(&result[0], 1, result.size(), file) == result.size());
+        REQUIRE(result == data);
+        REQUIRE(source.hedged_reads() == 1);
+        fclose(file);
+    }
+}
+
+TEST_CASE("DeltaReconstruction")
+{
+    std::string old_data(60000, 0);
+    uint32_t seed = 5;
+    for (auto& value : old_data)
+    {
+        seed = seed * 1103515245U + 12345U;
+        value = static_cast<char>(seed >> 16U);
+    }
+    auto new_data = old_data;
+    for (size_t i = 100; i < new_data.size(); i += 7000)
+        new_data[i] = ~new_data[i];
+
+    auto parameters = get_parameters();
+    parameters.window_length = 64;
+    parameters.min_block_size = 1024;
+    parameters.max_block_size = 8192;
+    parameters.match_bits = 11;
+
+    FILE* local_fp = tmpfile();
+    fwrite(old_data.data(), 1, old_data.size(), local_fp);
+    fflush(local_fp);
+    FILE* new_fp = fmemopen((void*)new_data.data(), new_data.size(), "rb");
+    zinc::CompactBoundaryList local(zinc::partition_file(local_fp, 1, nullptr, nullptr, nullptr, &parameters).get());
+    zinc::CompactBoundaryList remote(zinc::partition_file(new_fp, 1, nullptr, nullptr, nullptr, &parameters).get());
+    fclose(new_fp);
+    auto patch = zinc::build_patch(zinc::compare_files(local, remote, &parameters), local, remote, &parameters);
+
+    // Changed blocks are encoded against most similar local blocks.
+    zinc::SimilarityIndex index(zinc::sketch_file(local_fp, local, 1).get());
+    std::string pack;
+    std::vector<zinc::BlockDelta> deltas;
+    for (size_t i = 0; i < remote.size(); i++)
+    {
+        auto block = remote[i];
+        auto* target = reinterpret_cast<const uint8_t*>(&new_data[block.start]);
+        auto similar = index.find(zinc::detail::block_sketch(target, block.length));
+        if (similar == zinc::SimilarityIndex::npos)
+            continue;
+        auto reference = local[similar];
+        auto delta = zinc::encode_delta(reinterpret_cast<const uint8_t*>(&old_data[reference.start]),
+            reference.length, target, block.length);
+        deltas.push_back(zinc::BlockDelta{i, reference.hash, reference.length, static_cast<int64_t>(pack.size()),
+            static_cast<int64_t>(delta.size())});
+        pack.append(delta.begin(), delta.end());
+    }
+
+    // Remote source fails every read, all downloads must be reconstructed.
+    FILE* pack_fp = fmemopen(&pack[0], pack.size(), "rb");
+    zinc::FileSource pack_source(pack_fp);
+    FailingSource remote_source(new_data, 0);
+    zinc::DeltaSource delta_source(&remote_source);
+    int64_t delta_bytes = 0;
+    REQUIRE(zinc::reconstruct_blocks(local_fp, local, remote, patch, deltas, &pack_source, delta_source, &delta_bytes,
+        &parameters));
+    fclose(pack_fp);
+    REQUIRE(delta_source.reconstructed_bytes() > 0);
+    REQUIRE(delta_bytes * 10 < delta_source.reconstructed_bytes());
+
+    REQUIRE(zinc::apply_patch(local_fp, patch, &delta_source, &parameters));
+    std::string result(new_data.size(), 0);
+    fseek(local_fp, 0, SEEK_SET);
+    REQUIRE(fread(&result[0], 1, result.size(), local_fp) == result.size());
+    REQUIRE(result == new_data);
+    fclose(local_fp);
+}
+
+TEST_CASE("ReuseEstimate")
+{
+    auto random_data = [](size_t size, uint32_t seed)
+    {
+        std::string data(size, 0);
+        for (auto& value : data)
+        {
+            seed = seed * 1103515245U + 12345U;
+            value = static_cast<char>(seed >> 16U);
+        }
+        return data;
+    };
+    auto parameters = get_parameters();
+    parameters.window_length = 64;
+    parameters.min_block_size = 1024;
+    parameters.max_block_size = 8192;
+    parameters.match_bits = 11;
+
+    auto remote_data = random_data(4 * 1024 * 1024, 7);
+    zinc::CompactBoundaryList remote(zinc::partition_buffer(reinterpret_cast<const uint8_t*>(remote_data.data()),
+        remote_data.size(), 1, nullptr, nullptr, nullptr, &parameters).get());
+    auto estimate = [&](const std::string& local_data)
+    {
+        FILE* local_fp = tmpfile();
+        fwrite(local_data.data(), 1, local_data.size(), local_fp);
+        fflush(local_fp);
+        auto result = zinc::estimate_reuse(local_fp, remote, zinc::ReuseEstimateOptions(), &parameters);
+        fclose(local_fp);
+        return result;
+    };
+
+    SECTION("Identical")
+    {
+        auto result = estimate(remote_data);
+        REQUIRE(result.valid);
+        REQUIRE(result.sampled_bytes < static_cast<int64_t>(remote_data.size() / 2));
+        REQUIRE(result.reuse > 0.9);
+        REQUIRE(result.low <= result.reuse);
+        REQUIRE(result.high >= result.reuse);
+    }
+    SECTION("Unrelated")
+    {
+        auto result = estimate(random_data(remote_data.size(), 8));
+        REQUIRE(result.valid);
+        REQUIRE(result.high < 0.1);
+    }
+    SECTION("Half")
+    {
+        auto local_data = remote_data.substr(0, remote_data.size() / 2) + random_data(remote_data.size() / 2, 9);
+        auto result = estimate(local_data);
+        REQUIRE(result.valid);
+        REQUIRE(result.low < 0.5);
+        REQUIRE(result.high > 0.4);
+        REQUIRE(result.high < 0.75);
+    }
+    SECTION("Small file")
+    {
+        REQUIRE(!estimate(remote_data.substr(0, 64 * 1024)).valid);
+    }
+}
+
+#if !_WIN32
+TEST_CASE("BlockStore")
+{
+    char directory[] = "/tmp/zinc-store-XXXXXX";
+    REQUIRE(mkdtemp(directory) != nullptr);
+
+    SECTION("Least recently used blocks are evicted")
+    {
+        std::string a(100, 'a'), b(100, 'b'), c(100, 'c');
+        std::string buffer(100, 0);
+        {
+            zinc::BlockStore store(directory, 250);
+            REQUIRE(store.add(1, (const uint8_t*)a.data(), 100));
+            REQUIRE(store.add(2, (const uint8_t*)b.data(), 100));
+            REQUIRE(store.read(1, 100, (uint8_t*)&buffer[0]));
+            REQUIRE(buffer == a);
+            REQUIRE(store.add(3, (const uint8_t*)c.data(), 100));
+            REQUIRE(store.size() == 200);
+            REQUIRE(!store.contains(2, 100));
+            REQUIRE(!store.contains(1, 50));
+        }
+
+        // Order of use is kept between instances.
+        zinc::BlockStore store(directory, 250);
+        REQUIRE(store.size() == 200);
+        REQUIRE(store.read(3, 100, (uint8_t*)&buffer[0]));
+        REQUIRE(buffer == c);
+        REQUIRE(store.add(2, (const uint8_t*)b.data(), 100));
+        REQUIRE(!store.contains(1, 100));
+        REQUIRE(store.contains(3, 100));
+    }
+
+    SECTION("Blocks are reused when file is synchronized back")
+    {
+        std::string old_data(40000, 0);
+        uint32_t seed = 7;
+        for (auto& value : old_data)
+        {
+            seed = seed * 1103515245U + 12345U;
+            value = static_cast<char>(seed >> 16U);
+        }
+        auto new_data = old_data;
+        for (size_t i = 1000; i < 9000; i++)
+            new_data[i] = ~new_data[i];
+
+        auto parameters = get_parameters();
+        parameters.min_block_size = 512;
+        parameters.max_block_size = 4096;
+        parameters.match_bits = 10;
+        // Blocks are downloaded and read from store in pieces.
+        parameters.read_buffer_size = 1000;
+        auto partition = [&](const std::string& data)
+        {
+            return zinc::CompactBoundaryList(zinc::partition_buffer((const uint8_t*)data.data(), data.size(), 1,
+                nullptr, nullptr, nullptr, &parameters).get());
+        };
+        auto sync = [&](const std::string& local_data, const std::string& remote_data, int reads, int64_t& stored)
+        {
+            auto local = partition(local_data);
+            auto remote = partition(remote_data);
+            auto patch = zinc::build_patch(zinc::compare_files(local, remote, &parameters), local, remote, &parameters);
+            FILE* file = tmpfile();
+            fwrite(local_data.data(), 1, local_data.size(), file);
+            fflush(file);
+
+            zinc::BlockStore store(directory, 1024 * 1024);
+            zinc::retain_blocks(store, file, local, remote, &parameters);
+            FailingSource failing(remote_data, reads);
+            zinc::StoreSource source(&failing, store, remote, &parameters);
+            bool success = zinc::apply_patch(file, patch, &source, &parameters);
+            stored = source.stored_bytes();
+
+            std::string result(remote_data.size(), 0);
+            fseek(file, 0, SEEK_SET);
+            success = success && fread(&result[0], 1, result.size(), file) == result.size() && result == remote_data;
+            fclose(file);
+            return success;
+        };
+
+        int64_t stored = 0;
+        REQUIRE(sync(old_data, new_data, 1000, stored));
+        REQUIRE(stored == 0);
+        // Remote source fails every read, everything comes from the store.
+        REQUIRE(sync(new_data, old_data, 0, stored));
+        REQUIRE(stored > 0);
+        REQUIRE(sync(old_data, new_data, 0, stored));
+        REQUIRE(stored > 0);
+    }
+
+    // Store of size 0 evicts all blocks.
+    zinc::BlockStore(directory, 0).flush();
+    remove((std::string(directory) + "/index").c_str());
+    REQUIRE(rmdir(directory) == 0);
+}
+#endif
+
+#if __linux__
+/// In-memory file of a process that may be killed. Once `budget` bytes were written to files sharing it, further writes
+/// are lost.
+struct InterruptedFile
+{
+    std::string data;
+    int64_t position = 0;
+    int64_t* budget = nullptr;
+};
+
+FILE* open_interrupted_file(InterruptedFile& file)
+{
+    cookie_io_functions_t functions{};
+    functions.read = [](void* cookie, char* buffer, size_t size) -> ssize_t
+    {
+        auto* file = static_cast<InterruptedFile*>(cookie);
+        auto length = std::min<int64_t>(size, std::max<int64_t>(file->data.size() - file->position, 0));
+        memcpy(buffer, &file->data[file->position], length);
+        file->position += length;
+        return length;
+    };
+    functions.write = [](void* cookie, const char* buffer, size_t size) -> ssize_t
+    {
+        auto* file = static_cast<InterruptedFile*>(cookie);
+        auto length = static_cast<int64_t>(size);
+        if (*file->budget >= 0)
+        {
+            length = std::min(length, *file->budget);
+            *file->budget -= length;
+        }
+        if (static_cast<int64_t>(file->data.size()) < file->position + length)
+            file->data.resize(file->position + length);
+        memcpy(&file->data[file->position], buffer, length);
+        file->position += size;
+        return size;
+    };
+    functions.seek = [](void* cookie, off64_t* offset, int whence) -> int
+    {
+        auto* file = static_cast<InterruptedFile*>(cookie);
+        if (whence == SEEK_CUR)
+            *offset += file->position;
+        else if (whence == SEEK_END)
+            *offset += file->data.size();
+        file->position = *offset;
+        return 0;
+    };
+    file.position = 0;
+    FILE* fp = fopencookie(&file, "r+", functions);
+    setvbuf(fp, nullptr, _IONBF, 0);
+    return fp;
+}
+
+TEST_CASE("PatchPack")
+{
+    std::string old_data(40000, 0);
+    uint32_t seed = 11;
+    for (auto& value : old_data)
+    {
+        seed = seed * 1103515245U + 12345U;
+        value = static_cast<char>(seed >> 16U);
+    }
+    auto new_data = old_data.substr(0, 10000) + std::string(5000, 'x') + old_data.substr(20000) +
+        old_data.substr(0, 3000);
+
+    auto parameters = get_parameters();
+    parameters.window_length = 64;
+    parameters.min_block_size = 512;
+    parameters.max_block_size = 4096;
+    parameters.match_bits = 10;
+    auto partition = [&](const std::string& data)
+    {
+        return zinc::CompactBoundaryList(zinc::partition_buffer(reinterpret_cast<const uint8_t*>(data.data()),
+            data.size(), 1, nullptr, nullptr, nullptr, &parameters).get());
+    };
+    auto local = partition(old_data);
+    auto remote = partition(new_data);
+    auto patch = zinc::build_patch(zinc::compare_files(local, remote, &parameters), local, remote, &parameters);
+
+    FILE* new_fp = fmemopen((void*)new_data.data(), new_data.size(), "rb");
+    zinc::FileSource new_source(new_fp);
+    FILE* pack_fp = tmpfile();
+    REQUIRE(zinc::write_patch_pack(pack_fp, patch, &new_source, 1, 2));
+    fclose(new_fp);
+    zinc::FileSource pack_source(pack_fp);
+
+    SECTION("Apply")
+    {
+        zinc::PatchOperationList stored;
+        REQUIRE(zinc::read_patch_pack(&pack_source, 1, 2, stored));
+        REQUIRE(stored.size() == patch.size());
+
+        FILE* file = tmpfile();
+        fwrite(old_data.data(), 1, old_data.size(), file);
+        zinc::PatchVerifier verifier(remote, &parameters);
+        REQUIRE(zinc::apply_patch(file, stored, &pack_source, &parameters, nullptr, &verifier));
+        REQUIRE(verifier.mismatched().empty());
+        std::string result(new_data.size(), 0);
+        fseek(file, 0, SEEK_SET);
+        REQUIRE(fread(&result[0], 1, result.size(), file) == result.size());
+        REQUIRE(result == new_data);
+        fclose(file);
+    }
+    SECTION("Other versions")
+    {
+        zinc::PatchOperationList stored;
+        REQUIRE(!zinc::read_patch_pack(&pack_source, 2, 2, stored));
+        REQUIRE(!zinc::read_patch_pack(&pack_source, 1, 3, stored));
+    }
+    SECTION("Damaged")
+    {
+        fseek(pack_fp, 40, SEEK_SET);
+        fputc(0x55, pack_fp);
+        fflush(pack_fp);
+        zinc::PatchOperationList stored;
+        REQUIRE(!zinc::read_patch_pack(&pack_source, 1, 2, stored));
+
+        // Operation count larger than the pack is not allocated up front.
+        uint64_t count = 1ULL << 28U;
+        fseek(pack_fp, 24, SEEK_SET);
+        fwrite(&count, sizeof(count), 1, pack_fp);
+        fflush(pack_fp);
+        REQUIRE(!zinc::read_patch_pack(&pack_source, 1, 2, stored));
+        REQUIRE(stored.empty());
+    }
+    fclose(pack_fp);
+}
+
+TEST_CASE("PushPack")
+{
+    auto parameters = get_parameters();
+    parameters.window_length = 64;
+    parameters.min_block_size = 512;
+    parameters.max_block_size = 4096;
+    parameters.match_bits = 10;
+    auto random_data = [](size_t size, uint32_t seed)
+    {
+        std::string data(size, 0);
+        for (auto& value : data)
+        {
+            seed = seed * 1103515245U + 12345U;
+            value = static_cast<char>(seed >> 16U);
+        }
+        return data;
+    };
+    auto partition = [&](const std::string& data)
+    {
+        return zinc::CompactBoundaryList(zinc::partition_buffer(reinterpret_cast<const uint8_t*>(data.data()),
+            data.size(), 1, nullptr, nullptr, nullptr, &parameters).get());
+    };
+    auto read_all = [](FILE* file)
+    {
+        std::string result;
+        char buffer[4096];
+        fseek(file, 0, SEEK_SET);
+        for (size_t count; (count = fread(buffer, 1, sizeof(buffer), file)) > 0;)
+            result.append(buffer, count);
+        return result;
+    };
+    // Writes push pack of `data` against `stored` blocks and returns it's content.
+    auto push = [&](const std::string& data, const zinc::CompactBoundaryList& blocks,
+        const zinc::CompactBoundaryList& stored, uint64_t source, uint64_t target)
+    {
+        FILE* local_fp = fmemopen((void*)data.data(), data.size(), "rb");
+        FILE* pack_fp = tmpfile();
+        REQUIRE(zinc::write_push_pack(pack_fp, local_fp, blocks, stored, source, target, &parameters));
+        auto pack = read_all(pack_fp);
+        fclose(pack_fp);
+        fclose(local_fp);
+        return pack;
+    };
+
+    auto first = random_data(40000, 21);
+    auto first_blocks = partition(first);
+    auto second = first.substr(0, 15000) + random_data(3000, 22) + first.substr(15000, 20000) + random_data(500, 23);
+    auto second_blocks = partition(second);
+    FILE* stored_fp = tmpfile();
+
+    // First push uploads entire file into empty store.
+    auto pack = push(first, first_blocks, zinc::CompactBoundaryList(), 1, 2);
+    REQUIRE(pack.size() > first.size());
+    FailingSource first_source(pack, 1000);
+    REQUIRE(zinc::apply_push_pack(stored_fp, &first_source, first_blocks, 1, 2, nullptr, &parameters));
+    REQUIRE(read_all(stored_fp) == first);
+
+    // Pack applies only to the version it was built from.
+    pack = push(second, second_blocks, first_blocks, 2, 3);
+    FailingSource wrong_source(pack, 1000);
+    REQUIRE(!zinc::apply_push_pack(stored_fp, &wrong_source, second_blocks, 1, 3, nullptr, &parameters));
+
+    SECTION("Incremental")
+    {
+        // Only changed blocks are uploaded.
+        REQUIRE(pack.size() < second.size() / 2);
+        FailingSource source(pack, 1000);
+        REQUIRE(zinc::apply_push_pack(stored_fp, &source, second_blocks, 2, 3, nullptr, &parameters));
+        REQUIRE(read_all(stored_fp) == second);
+    }
+    SECTION("Interrupted")
+    {
+        FILE* journal_fp = tmpfile();
+        FailingSource failing(pack, 4);
+        REQUIRE(!zinc::apply_push_pack(stored_fp, &failing, second_blocks, 2, 3, journal_fp, &parameters));
+        FailingSource source(pack, 1000);
+        REQUIRE(zinc::apply_push_pack(stored_fp, &source, second_blocks, 2, 3, journal_fp, &parameters));
+        REQUIRE(read_all(stored_fp) == second);
+        fclose(journal_fp);
+    }
+    fclose(stored_fp);
+}
+
+TEST_CASE("ResumePatch")
+{
+    std::string old_data(3000, '\0');
+    uint32_t seed = 17;
+    for (auto& c : old_data)
+    {
+        seed = seed * 1103515245U + 12345U;
+        c = static_cast<char>(seed >> 16U);
+    }
+    // Data moved by a small distance towards both ends of file, new data and zeros.
+    auto new_data = old_data.substr(0, 100) + "0123456789" + old_data.substr(100, 1500) + std::string(200, '\0') +
+        old_data.substr(1700, 1000) + "new data" + old_data.substr(2750);
+
+    auto parameters = get_parameters();
+    auto old_parts = zinc::partition_buffer(reinterpret_cast<const uint8_t*>(old_data.data()), old_data.size(), 1,
+        nullptr, nullptr, nullptr, &parameters).get();
+    auto new_parts = zinc::partition_buffer(reinterpret_cast<const uint8_t*>(new_data.data()), new_data.size(), 1,
+        nullptr, nullptr, nullptr, &parameters).get();
+    auto patch = zinc::build_patch(zinc::compare_files(old_parts, new_parts));
+
+    FILE* remote_fp = fmemopen((void*)new_data.data(), new_data.size(), "rb");
+    zinc::FileSource remote(remote_fp);
+    parameters.read_buffer_size = 64;
+    for (int64_t limit = 0; ; limit += 29)
+    {
+        int64_t budget = limit;
+        InterruptedFile local, journal_data;
+        local.data = old_data + std::string(new_data.size() - old_data.size(), '\0');
+        local.budget = journal_data.budget = &budget;
+
+        zinc::PatchJournal journal;
+        journal.identity = 12345;
+        FILE* local_fp = open_interrupted_file(local);
+        journal.file = open_interrupted_file(journal_data);
+        REQUIRE(zinc::apply_patch(local_fp, patch, &remote, &parameters, &journal));
+        fclose(local_fp);
+        fclose(journal.file);
+        auto interrupted = budget == 0;
+
+        // Process is started again. Last journal record may be partially written.
+        budget = -1;
+        local_fp = open_interrupted_file(local);
+        journal.file = open_interrupted_file(journal_data);
+        REQUIRE(zinc::apply_patch(local_fp, patch, &remote, &parameters, &journal));
+
+        // Patch is recorded in the journal, but only for the same remote file.
+        zinc::PatchOperationList recorded;
+        REQUIRE(zinc::read_journal(journal, recorded));
+        REQUIRE(recorded.size() == patch.size());
+        auto other_journal = journal;
+        other_journal.identity = 54321;
+        REQUIRE(!zinc::read_journal(other_journal, recorded));
+        fclose(local_fp);
+        fclose(journal.file);
+
+        INFO("interrupted after " << limit << " bytes");
+        local.data.resize(new_data.size());
+        REQUIRE(local.data == new_data);
+        if (!interrupted)
+            break;
+    }
+
+    // Patch is not applied when journal can not be written.
+    std::string local_data = old_data + std::string(new_data.size() - old_data.size(), '\0');
+    std::string journal_data(64, '\0');
+    zinc::PatchJournal journal;
+    journal.identity = 12345;
+    FILE* local_fp = fmemopen(&local_data[0], local_data.size(), "r+b");
+    journal.file = fmemopen(&journal_data[0], journal_data.size(), "rb");
+    REQUIRE(!zinc::apply_patch(local_fp, patch, &remote, &parameters, &journal));
+    fclose(local_fp);
+    fclose(journal.file);
+    fclose(remote_fp);
+}
+#endif
+
+TEST_CASE("VerifyFile")
+{
+    auto parameters = get_parameters();
+    parameters.min_block_size = 100;
+    parameters.max_block_size = 2000;
+    std::string old_data(50000, '\0');
+    uint32_t seed = 19;
+    for (auto& c : old_data)
+    {
+        seed = seed * 1103515245U + 12345U;
+        c = static_cast<char>(seed >> 16U);
+    }
+    auto new_data = old_data.substr(0, 20000) + "inserted" + old_data.substr(20000, 25000) + std::string(5000, '\0');
+
+    for (auto leaf_size : {0, 300})
+    {
+        parameters.hash_leaf_size = leaf_size;
+        auto old_parts = zinc::partition_buffer(reinterpret_cast<const uint8_t*>(old_data.data()), old_data.size(), 1,
+            nullptr, nullptr, nullptr, &parameters).get();
+        auto new_parts = zinc::partition_buffer(reinterpret_cast<const uint8_t*>(new_data.data()), new_data.size(), 1,
+            nullptr, nullptr, nullptr, &parameters).get();
+        zinc::CompactBoundaryList blocks(new_parts);
+
+        // Damaged download is detected while patching.
+        auto damaged_data = new_data;
+        damaged_data[20003] ^= 1;
+        FILE* remote_fp = fmemopen((void*)damaged_data.data(), damaged_data.size(), "rb");
+        zinc::FileSource remote(remote_fp);
+        FILE* local_fp = tmpfile();
+        fwrite(old_data.data(), 1, old_data.size(), local_fp);
+        zinc::PatchVerifier verifier(blocks, &parameters);
+        auto patch = zinc::build_patch(zinc::compare_files(old_parts, new_parts, &parameters), &parameters);
+        REQUIRE(zinc::apply_patch(local_fp, patch, &remote, &parameters, nullptr, &verifier));
+        fclose(remote_fp);
+#if !_WIN32
+        REQUIRE(ftruncate(fileno(local_fp), new_data.size()) == 0);     // Zeros at the end may be left unwritten
+#endif
+        REQUIRE(verifier.mismatched().size() == 1);
+        REQUIRE(blocks.find(20003) == verifier.mismatched()[0]);
+        REQUIRE(verifier.verified_bytes() > 0);
+        REQUIRE(!verifier.finish(local_fp));
+        REQUIRE(verifier.mismatched().size() == 1);
+        REQUIRE(verifier.digest() != zinc::file_digest(blocks));
+        REQUIRE(verifier.verified_bytes() == static_cast<int64_t>(new_data.size()) - blocks.length(blocks.find(20003)));
+
+        // Verification of entire file finds the same block.
+        for (auto threads : {1, 3})
+        {
+            parameters.reader_threads = threads - 1;
+            auto mismatched = zinc::verify_file(local_fp, blocks, threads, nullptr, nullptr, nullptr,
+                &parameters).get();
+
+            REQUIRE(mismatched.size() == 1);
+            REQUIRE(mismatched[0] == verifier.mismatched()[0]);
+        }
+
+        // Repaired file matches, blocks past the end of truncated file do not.
+        fseek(local_fp, 20003, SEEK_SET);
+        fputc(new_data[20003], local_fp);
+        fflush(local_fp);
+        REQUIRE(zinc::verify_file(local_fp, blocks, 2, nullptr, nullptr, nullptr, &parameters).get().empty());
+
+        // Blocks that were not written are hashed from the file, a block written partially does not match.
+        zinc::PatchVerifier untouched(blocks, &parameters);
+        REQUIRE(untouched.finish(local_fp));
+        REQUIRE(untouched.digest() == zinc::file_digest(blocks));
+        zinc::PatchVerifier partial(blocks, &parameters);
+        partial.write(0, reinterpret_cast<const uint8_t*>(new_data.data()), 1);
+        REQUIRE(!partial.finish(local_fp));
+        REQUIRE(partial.mismatched() == std::vector<size_t>{0});
+#if !_WIN32
+        REQUIRE(ftruncate(fileno(local_fp), 30000) == 0);
+        auto mismatched = zinc::verify_file(local_fp, blocks, 2, nullptr, nullptr, nullptr, &parameters).get();
+        REQUIRE(mismatched.size() == blocks.size() - blocks.find(30000));
+        REQUIRE(mismatched[0] == blocks.find(30000));
+#endif
+        fclose(local_fp);
+    }
+}
+
+TEST_CASE("TreeHashing")
+{
+    auto parameters = get_parameters();
+    parameters.min_block_size = 100;
+    parameters.max_block_size = 50000;
+    parameters.match_bits = 14;                 // Few large blocks
+    parameters.hash_leaf_size = 1000;
+    std::string data(200000, '\0');
+    uint32_t seed = 13;
+    for (auto i = 0; i < 150000; i++)
+    {
+        seed = seed * 1103515245U + 12345U;
+        data[i] = static_cast<char>(seed >> 16U);
+    }
+
+    for (auto threads : {1, 3})
+    {
+        parameters.reader_threads = threads - 1;
+        auto result = zinc::partition_buffer(reinterpret_cast<const uint8_t*>(data.data()), data.size(), threads,
+            nullptr, nullptr, nullptr, &parameters).get();
+        REQUIRE(result.back().start + result.back().length == static_cast<int64_t>(data.size()));
+        for (const auto& block : result)
+        {
+            auto* block_data = reinterpret_cast<const uint8_t*>(&data[block.start]);
+            REQUIRE(block.hash == zinc::detail::block_hash(block_data, block.length, parameters.hash_leaf_size));
+        }
+        REQUIRE(zinc::is_zero_block(result.back(), &parameters));
+    }
+}
+
+TEST_CASE("PartitionBuffer")
+{
+    auto parameters = get_parameters();
+    std::string data;
+    uint32_t seed = 3;
+    for (auto i = 0; i < 20000; i++)
+    {
+        seed = seed * 1103515245U + 12345U;
+        data.push_back(static_cast<char>('0' + (seed >> 16U) % 64));
+    }
+
+    FILE* fp = fmemopen((void*)data.data(), data.length(), "rb");
+    auto expected = zinc::partition_file(fp, 1, nullptr, nullptr, nullptr, &parameters).get();
+    fclose(fp);
+    REQUIRE(expected.size() > 100);
+
+    for (auto threads : {1, 3, 8})
+    {
+        parameters.reader_threads = threads % 3;
+        std::atomic<int64_t> bytes_done{0};
+        int64_t bytes_total = 0;
+        auto result = zinc::partition_buffer(reinterpret_cast<const uint8_t*>(data.data()), data.size(), threads,
+            &bytes_done, &bytes_total, nullptr, &parameters).get();
+        REQUIRE(bytes_total == static_cast<int64_t>(data.size()));
+        REQUIRE(bytes_done == bytes_total);
+
+        REQUIRE(result.size() == expected.size());
+        for (size_t i = 0; i < result.size(); i++)
+        {
+            REQUIRE(result[i].start == expected[i].start);
+            REQUIRE(result[i].length == expected[i].length);
+            REQUIRE(result[i].fingerprint == expected[i].fingerprint);
+            REQUIRE(result[i].hash == expected[i].hash);
+        }
+    }
+
+    // File that can not be read has no blocks.
+    char path[] = "/tmp/zinc-unreadable-XXXXXX";
+    auto fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    REQUIRE(write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size()));
+    close(fd);
+    fp = fopen(path, "ab");
+    REQUIRE(zinc::partition_file(fp, 1, nullptr, nullptr, nullptr, &parameters).get().empty());
+    fclose(fp);
+    remove(path);
+}
+
+TEST_CASE("ProgressCallbacks")
+{
+    auto parameters = get_parameters();
+    std::string data(300000, '\0');
+    uint32_t seed = 7;
+    for (auto& c : data)
+    {
+        seed = seed * 1103515245U + 12345U;
+        c = static_cast<char>(seed >> 16U);
+    }
+
+    for (auto threads : {1, 3})
+    {
+        std::atomic<int> active_calls{0};
+        std::atomic<bool> overlapped{false};
+        std::atomic<int> completions{0};
+        int64_t last_done = -1;
+        int64_t last_total = -1;
+        parameters.progress_interval = std::chrono::milliseconds(0);
+        parameters.on_progress = [&](int64_t bytes_done, int64_t bytes_total)
+        {
+            if (active_calls.fetch_add(1) != 0)
+                overlapped = true;
+            last_done = bytes_done;
+            last_total = bytes_total;
+            active_calls.fetch_sub(1);
+        };
+        parameters.on_complete = [&]() { completions++; };
+
+        auto result = zinc::partition_buffer(reinterpret_cast<const uint8_t*>(data.data()), data.size(), threads,
+            nullptr, nullptr, nullptr, &parameters).get();
+        REQUIRE(!result.empty());
+        REQUIRE(!overlapped);
+        REQUIRE(completions == 1);
+        REQUIRE(last_total == static_cast<int64_t>(data.size()));
+        REQUIRE(last_done == last_total);
+    }
+
+    // Inputs shorter than rolling hash window still complete.
+    std::atomic<int> completions{0};
+    parameters.on_progress = nullptr;
+    parameters.on_complete = [&]() { completions++; };
+    auto result = zinc::partition_buffer(reinterpret_cast<const uint8_t*>(data.data()), 3, 1, nullptr, nullptr,
+        nullptr, &parameters).get();
+    REQUIRE(completions == 1);
+    REQUIRE(result.size() == 1);
+    REQUIRE(result[0].length == 3);
+}
+
+TEST_CASE("LargeSparseFile")
+{
+    // Data islands past 2GB and 4GB offsets, around work unit edges and at the very end of file.
+    const int64_t file_size = 5LL * 1024 * 1024 * 1024 + 12345;
+    const int64_t islands[] = {0, 2147483648LL - 3000, 4294967296LL + 4 * 1024 * 1024 - 100, file_size - 70000};
+    FILE* fp = tmpfile();
+    std::string data(70000, 0);
+    uint32_t seed = 5;
+    for (auto offset : islands)
+    {
+        for (auto& c : data)
+        {
+            seed = seed * 1103515245U + 12345U;
+            c = static_cast<char>(seed >> 16U);
+        }
+#if _WIN32
+        _fseeki64(fp, offset, SEEK_SET);
+#else
+        fseeko(fp, offset, SEEK_SET);
+#endif
+        fwrite(data.data(), 1, data.size(), fp);
+    }
+    fflush(fp);
+
+    zinc::Parameters parameters;
+    parameters.min_block_size = 8 * 1024;
+    parameters.max_block_size = 64 * 1024 * 1024;
+    parameters.match_bits = 12;
+    parameters.reader_threads = 1;
+    auto expected = zinc::partition_file(fp, 1, nullptr, nullptr, nullptr, &parameters).get();
+    REQUIRE(expected.back().start + expected.back().length == file_size);
+    REQUIRE(expected.back().start > 4294967296LL);
+
+    for (auto threads : {2, 5})
+    {
+        // Hashing threads reading data themselves, and sequential reader threads passing data to them.
+        parameters.reader_threads = threads - 2;
+        auto result = zinc::partition_file(fp, threads, nullptr, nullptr, nullptr, &parameters).get();
+        REQUIRE(result.size() == expected.size());
+        for (size_t i = 0; i < result.size(); i++)
+        {
+            REQUIRE(result[i].start == expected[i].start);
+            REQUIRE(result[i].length == expected[i].length);
+            REQUIRE(result[i].fingerprint == expected[i].fingerprint);
+            REQUIRE(result[i].hash == expected[i].hash);
+        }
+    }
+    fclose(fp);
+}